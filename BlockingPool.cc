@@ -0,0 +1,96 @@
+#include "BlockingPool.hh"
+#include "Config.hh"
+#include "debug.hh"
+
+#include <chrono>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+void
+BlockingPool::submit(Job *job)
+{
+    bool spawn = false;
+    {
+        std::lock_guard<std::mutex> _(mut_);
+        job->next = nullptr;
+        if ( tail ) {
+            tail->next = job;
+        } else {
+            head = job;
+        }
+        tail = job;
+        ++numQueued;
+
+        if ( numQueued > numIdle && numThreads < Config::Instance().blocking_pool_max_threads ) {
+            ++numThreads;
+            spawn = true;
+        }
+    }
+    if ( spawn ) {
+        try {
+            /* detached, the destructor waits for numThreads to drop */
+            std::thread([this] () { worker(); }).detach();
+        } catch (std::system_error const &e) {
+            DEBUG_PRINT(DEBUG_WARNING, "BlockingPool thread not started: %s", e.what());
+            Job *orphans = nullptr;
+            {
+                std::lock_guard<std::mutex> _(mut_);
+                if ( --numThreads == 0 ) {
+                    /* no thread to take the queued jobs, run them here */
+                    orphans = head;
+                    head = tail = nullptr;
+                    numQueued = 0;
+                    exited_.notify_all();
+                }
+            }
+            /* otherwise they stay queued for the running threads */
+            while ( orphans ) {
+                Job *next = orphans->next;
+                orphans->run();
+                orphans = next;
+            }
+            return;
+        }
+    }
+    cond_.notify_one();
+}
+
+void
+BlockingPool::worker()
+{
+    auto idleTime = std::chrono::milliseconds(Config::Instance().blocking_pool_idle_time);
+    std::unique_lock<std::mutex> lock(mut_);
+    for ( ;; ) {
+        if ( !head && !stopping ) {
+            ++numIdle;
+            cond_.wait_for(lock, idleTime, [this] () { return head || stopping; });
+            --numIdle;
+        }
+        if ( !head ) {
+            /* idle for too long, or stopping */
+            break;
+        }
+        Job *job = head;
+        head = head->next;
+        if ( !head ) {
+            tail = nullptr;
+        }
+        --numQueued;
+
+        lock.unlock();
+        job->run();
+        lock.lock();
+    }
+    if ( --numThreads == 0 ) {
+        exited_.notify_all();
+    }
+}
+
+BlockingPool::~BlockingPool()
+{
+    std::unique_lock<std::mutex> lock(mut_);
+    stopping = true;
+    cond_.notify_all();
+    exited_.wait(lock, [this] () { return numThreads == 0; });
+}
@@ -0,0 +1,57 @@
+#ifndef _BLOCKINGPOOL_HH_
+#define _BLOCKINGPOOL_HH_
+
+#include "util.hh"
+
+#include <condition_variable>
+#include <mutex>
+
+/* OS threads running the calls that would block a worker: the jobs
+ * of co_blocking(), and file I/O when io_uring is not available.
+ *
+ * A job lives on the stack of a parked task and is submitted from
+ * its parking hook; run() ends by resuming the task through
+ * GlobalMediator::wakeUpForeign(), and must not touch the job after
+ * that.
+ *
+ * The pool is elastic: a job finding no idle thread starts one, up
+ * to Config::blocking_pool_max_threads, past it the jobs queue up.
+ * A thread idle for Config::blocking_pool_idle_time exits. When a
+ * thread cannot be started and none is left, submit() runs the queued
+ * jobs itself, blocking its worker rather than losing them.
+ */
+class BlockingPool : public Singleton {
+public:
+    struct Job {
+        virtual void run() = 0;
+
+        Job *next = nullptr;
+    protected:
+        ~Job() = default;
+    };
+
+    void submit(Job *job);
+
+    ~BlockingPool();
+
+    static BlockingPool &Instance() {
+        static BlockingPool p;
+        return p;
+    }
+private:
+    void worker();
+
+    /* guards everything below */
+    std::mutex                  mut_;
+    std::condition_variable     cond_;
+    Job                         *head = nullptr;
+    Job                         *tail = nullptr;
+    int                         numQueued = 0;
+    int                         numThreads = 0;
+    int                         numIdle = 0;
+    bool                        stopping = false;
+    /* the last thread to exit notifies it */
+    std::condition_variable     exited_;
+};
+
+#endif /* _BLOCKINGPOOL_HH_ */
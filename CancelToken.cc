@@ -0,0 +1,98 @@
+#include "CancelToken.hh"
+#include "debug.hh"
+
+#include <mutex>
+
+CancelToken::CancelToken(CancelTokenPtr const &parentPtr)
+    : parent(const_cast<CancelToken*>(parentPtr.get()))
+{
+    if ( !parent ) {
+        return;
+    }
+    CancelToken *p = parent;
+    CancelTokenPtr::increase(p);
+    std::lock_guard<Spinlock> _(p->mut_);
+    if ( p->cancelled() ) {
+        cancelled_.store(true, std::memory_order_relaxed);
+        return;
+    }
+    nextSibling = p->firstChild;
+    if ( nextSibling ) {
+        nextSibling->prevSibling = this;
+    }
+    p->firstChild = this;
+}
+
+CancelToken::~CancelToken()
+{
+    MUST_TRUE(!waiters, "CancelToken destroyed with waiters");
+    if ( !parent ) {
+        return;
+    }
+    CancelToken *p = parent;
+    {
+        std::lock_guard<Spinlock> _(p->mut_);
+        if ( prevSibling ) {
+            prevSibling->nextSibling = nextSibling;
+        } else if ( p->firstChild == this ) {
+            p->firstChild = nextSibling;
+        }
+        if ( nextSibling ) {
+            nextSibling->prevSibling = prevSibling;
+        }
+    }
+    CancelTokenPtr::decrease(p);
+}
+
+void
+CancelToken::cancel()
+{
+    std::lock_guard<Spinlock> _(mut_);
+    if ( cancelled_.exchange(true, std::memory_order_acq_rel) ) {
+        return;
+    }
+    while ( Waiter *w = waiters ) {
+        waiters = w->next;
+        w->queued = false;
+        w->onCancel();
+    }
+    /* a child unlinks itself under mut_, so it outlives this loop */
+    for ( CancelToken *c = firstChild; c; c = c->nextSibling ) {
+        c->cancel();
+    }
+}
+
+bool
+CancelToken::addWaiter(Waiter *w)
+{
+    std::lock_guard<Spinlock> _(mut_);
+    if ( cancelled() ) {
+        return false;
+    }
+    w->prev = nullptr;
+    w->next = waiters;
+    if ( waiters ) {
+        waiters->prev = w;
+    }
+    waiters = w;
+    w->queued = true;
+    return true;
+}
+
+void
+CancelToken::removeWaiter(Waiter *w)
+{
+    std::lock_guard<Spinlock> _(mut_);
+    if ( !w->queued ) {
+        return;
+    }
+    if ( w->prev ) {
+        w->prev->next = w->next;
+    } else {
+        waiters = w->next;
+    }
+    if ( w->next ) {
+        w->next->prev = w->prev;
+    }
+    w->queued = false;
+}
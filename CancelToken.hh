@@ -0,0 +1,65 @@
+#ifndef _CANCELTOKEN_HH_
+#define _CANCELTOKEN_HH_
+
+#include "util.hh"
+#include "Spinlock.hh"
+
+#include <atomic>
+
+class CancelToken;
+using CancelTokenPtr = DerivedRefPtr<CancelToken>;
+
+/* Cooperative cancellation of a tree of tasks.
+ *
+ * A task spawned with go_cancellable() carries the token, the tasks
+ * it spawns inherit it. A token made with a parent is cancelled with
+ * it, so a subtree can be stopped on its own. Cancelling never stops
+ * a task: the task sees co_cancelled(), and its blocking co_select,
+ * chan and co_sleep_for waits return early, see co_select::Cancelled.
+ * TaskGroup::wait() returns WaitStatus::Cancelled, the tasks it
+ * waited for go on running unless they carry the token too; a
+ * Future still waits for its result.
+ */
+class CancelToken : public RefCounted {
+public:
+    /* something parked until the token is cancelled */
+    struct Waiter {
+        /* called once, under the token's lock: must not block
+         * nor touch the token */
+        virtual void onCancel() = 0;
+
+        Waiter  *next = nullptr;
+        Waiter  *prev = nullptr;
+        bool    queued = false;
+    protected:
+        ~Waiter() = default;
+    };
+
+    explicit CancelToken(CancelTokenPtr const &parentPtr = CancelTokenPtr());
+    ~CancelToken();
+
+    /* cancel this token and its children, wake their waiters */
+    void cancel();
+
+    bool cancelled() const {
+        return cancelled_.load(std::memory_order_acquire);
+    }
+
+    /* false, and w not added, if already cancelled */
+    bool addWaiter(Waiter *w);
+    /* after it returns, w->onCancel() is not running and never will */
+    void removeWaiter(Waiter *w);
+private:
+    std::atomic<bool>   cancelled_ = {false};
+    /* holds a reference */
+    CancelToken         *parent;
+
+    /* guards everything below, taken parent first */
+    Spinlock            mut_;
+    CancelToken         *firstChild = nullptr;
+    CancelToken         *nextSibling = nullptr;
+    CancelToken         *prevSibling = nullptr;
+    Waiter              *waiters = nullptr;
+};
+
+#endif /* _CANCELTOKEN_HH_ */
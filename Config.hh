@@ -22,6 +22,39 @@ struct Config : public Singleton {
     /* in milliseconds, 0 for no GC daemon */
     int cache_reclaim_period = 2000;
 
+    /* back task pool layers and task stacks with 2MB pages */
+    bool use_huge_pages = false;
+
+    /* file I/O of tasks through a per-worker io_uring of that many
+     * entries, otherwise through the BlockingPool */
+    bool use_io_uring = true;
+    int io_ring_entries = 256;
+
+    /* threads of the BlockingPool, see co_blocking() */
+    int blocking_pool_max_threads = 64;
+    /* in milliseconds, an idle pool thread exits after it */
+    int blocking_pool_idle_time = 10000;
+
+    /* who tests the MPI requests of parked tasks, see MPIPoller:
+     * Idle: a worker with nothing else to run
+     * Interval: also every mpi_progress_interval rounds of a busy worker
+     * Thread: a progress thread of its own, for all workers */
+    enum class MPIProgress {
+        Idle,
+        Interval,
+        Thread,
+    };
+    MPIProgress mpi_progress = MPIProgress::Interval;
+    int mpi_progress_interval = 64;
+    /* MPI_Recv_Hook() through the MPIDispatcher */
+    bool mpi_recv_dispatch = false;
+    /* small MPI_Send_Hook() through the MPIAggregator, a batch goes
+     * out at that many bytes, or that many microseconds after its first
+     * message; takes mpi_recv_dispatch on the receivers */
+    bool mpi_send_aggregate = false;
+    int mpi_aggregate_bytes = 8192;
+    int mpi_aggregate_delay = 100;
+
     Config() {
         char const *env_value;
         if ( (env_value = getenv("YAMI_NUM_OF_THREADS")) != nullptr ) {
@@ -36,6 +69,59 @@ struct Config : public Singleton {
                 num_of_threads = user_num_of_threads;
             }
         }
+        if ( (env_value = getenv("YAMI_HUGE_PAGES")) != nullptr ) {
+            use_huge_pages = env_value[0] != '\0' && env_value[0] != '0';
+        }
+        if ( (env_value = getenv("YAMI_IO_URING")) != nullptr ) {
+            use_io_uring = env_value[0] != '\0' && env_value[0] != '0';
+        }
+        if ( (env_value = getenv("YAMI_MPI_PROGRESS")) != nullptr ) {
+            std::string mode = env_value;
+            if ( mode == "idle" ) {
+                mpi_progress = MPIProgress::Idle;
+            } else if ( mode == "interval" ) {
+                mpi_progress = MPIProgress::Interval;
+            } else if ( mode == "thread" ) {
+                mpi_progress = MPIProgress::Thread;
+            }
+        }
+        if ( (env_value = getenv("YAMI_MPI_DISPATCH")) != nullptr ) {
+            mpi_recv_dispatch = env_value[0] != '\0' && env_value[0] != '0';
+        }
+        if ( (env_value = getenv("YAMI_MPI_AGGREGATE")) != nullptr ) {
+            mpi_send_aggregate = env_value[0] != '\0' && env_value[0] != '0';
+            mpi_recv_dispatch = mpi_recv_dispatch || mpi_send_aggregate;
+        }
+        if ( (env_value = getenv("YAMI_MPI_AGGREGATE_BYTES")) != nullptr ) {
+            try {
+                int bytes = std::stoi(env_value);
+                if ( bytes > 0 ) {
+                    mpi_aggregate_bytes = bytes;
+                }
+            } catch (std::exception const&) {
+                /* ignore */
+            }
+        }
+        if ( (env_value = getenv("YAMI_MPI_AGGREGATE_DELAY")) != nullptr ) {
+            try {
+                int delay = std::stoi(env_value);
+                if ( delay >= 0 ) {
+                    mpi_aggregate_delay = delay;
+                }
+            } catch (std::exception const&) {
+                /* ignore */
+            }
+        }
+        if ( (env_value = getenv("YAMI_MPI_PROGRESS_INTERVAL")) != nullptr ) {
+            try {
+                int interval = std::stoi(env_value);
+                if ( interval > 0 ) {
+                    mpi_progress_interval = interval;
+                }
+            } catch (std::exception const&) {
+                /* ignore */
+            }
+        }
     }
 
     static Config &Instance() {
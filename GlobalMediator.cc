@@ -5,6 +5,10 @@
 #include "debug.hh"
 #include "util.hh"
 #include "Skiplist.hh"
+#include "NetPoller.hh"
+#ifdef ENABLE_MPI
+#include "MPIAggregator.hh"
+#endif
 
 #include <thread>
 #include <mutex>
@@ -13,6 +17,21 @@
 #include <memory>
 #include <utility>
 
+/* run_once() calls between two polls of a busy worker, a power of two */
+static constexpr unsigned net_poll_interval = 64;
+
+/* The first throw of the process sets the unwinder up, which takes
+ * more than a task stack: throw once here, on the main stack, so that
+ * the callbacks of tasks can throw (see Task::fail()) */
+static void
+warmUpUnwinder()
+{
+    try {
+        throw 0;
+    } catch ( int ) {
+    }
+}
+
 void
 GlobalMediator::Init()
 {
@@ -20,6 +39,7 @@ GlobalMediator::Init()
     DEBUG_PRINT(DEBUG_GlobalMediator, 
             "Init() with num_of_threads = %d", 
             num_of_threads);
+    warmUpUnwinder();
     Instance().threadLocalInfos.resize(num_of_threads);
     for ( auto &ptr : Instance().threadLocalInfos ) {
         ptr = std::make_unique<ThreadLocalInfo>();
@@ -33,6 +53,11 @@ GlobalMediator::Init()
     /* main thread has thread_id 0 */
     thread_id = 0;
     Instance().threadLocalInfos[0]->pmgr.debugId = 0;
+#ifdef ENABLE_MPI
+    if ( Config::Instance().mpi_progress == Config::MPIProgress::Interval ) {
+        Instance().mpiPollInterval = Config::Instance().mpi_progress_interval;
+    }
+#endif
     for ( int i = 1; i < num_of_threads; ++i ) {
         std::thread tid(
             [i] () -> void {
@@ -47,21 +72,84 @@ GlobalMediator::Init()
 }
 
 void
-GlobalMediator::addRunnable(TaskPtr ptr)
+GlobalMediator::addRunnable(TaskPtr &&ptr)
 {
     DEBUG_PRINT(DEBUG_GlobalMediator, "Thread %d: Mediator adds task %d at state %s runnable",
             thread_id, ptr->debugId, Task::getStateName(ptr->state));
-    getThisPerThreadMgr()->addRunnable(ptr);
+    getThisPerThreadMgr()->addRunnable(std::move(ptr));
+    if ( sleep_count != 0 ) {
+        wakeSleeper();
+    }
+}
+
+void
+GlobalMediator::wakeUpForeign(TaskPtr &&ptr)
+{
+    ptr->state = Task::Runnable;
+    {
+        std::lock_guard<Spinlock> _(foreignMut);
+        foreignQueue.push(std::move(ptr));
+    }
+    numForeign.fetch_add(1, std::memory_order_release);
     if ( sleep_count != 0 ) {
-        co_globalWaitCond.notify_one();
+        wakeSleeper();
+    }
+}
+
+void
+GlobalMediator::wakeSleeper()
+{
+    co_globalWaitCond.notify_one();
+    netPoller.interrupt();
+    if ( ring_sleep_count.load(std::memory_order_relaxed) == 0 ) {
+        return;
+    }
+    for ( auto &info : threadLocalInfos ) {
+        PerThreadMgr &mgr = info->pmgr;
+        if ( mgr.ringSleeping.exchange(false, std::memory_order_acq_rel) ) {
+            mgr.ioRing_->wake();
+            return;
+        }
     }
 }
 
+bool
+GlobalMediator::takeForeign(PerThreadMgr *mgr)
+{
+    IntrusiveQueue<Task> taken;
+    {
+        std::lock_guard<Spinlock> _(foreignMut);
+        taken.swap(foreignQueue);
+    }
+    int n = 0;
+    while ( TaskPtr ptr = taken.pop() ) {
+        mgr->addRunnable(std::move(ptr));
+        ++n;
+    }
+    numForeign.fetch_sub(n, std::memory_order_relaxed);
+    return n != 0;
+}
+
 bool
 GlobalMediator::run_once()
 {
     PerThreadMgr *mgr = getThisPerThreadMgr();
+    if ( !mgr->timers.empty() && mgr->run_timers() ) return true;
+    if ( mgr->ioRing_ && mgr->ioRing_->busy() && mgr->run_io() ) return true;
+    if ( numForeign.load(std::memory_order_acquire) != 0 && takeForeign(mgr) ) return true;
+    unsigned ticks = ++mgr->ticks;
+    if ( (ticks & (net_poll_interval - 1)) == 0 && netPoller.poll() ) return true;
+#ifdef ENABLE_MPI
+    /* messages progress under load too */
+    if ( mpiPollInterval != 0 && mgr->mpiPoller_.busy()
+            && ticks % mpiPollInterval == 0 && mgr->run_mpi() ) return true;
+    /* batches out once due */
+    if ( (ticks & (net_poll_interval - 1)) == 0 && MPIAggregator::Instance().busy() ) {
+        MPIAggregator::Instance().progress(false);
+    }
+#endif
     if ( mgr->run_runnable() ) return true;
+    if ( netPoller.poll() ) return true;
 
     // no runnable, traverse and steal
     DEBUG_PRINT(DEBUG_GlobalMediator, "Thread %d: No runnable got locally, try steal", thread_id);
@@ -87,11 +175,19 @@ GlobalMediator::run_once()
     if ( stealSuccess ) return true;
 
     DEBUG_PRINT(DEBUG_GlobalMediator, "Thread %d: Nothing to steal...", thread_id);
-    if ( !mgr->mpi_blocked_queue.empty() ) {
-        DEBUG_PRINT(DEBUG_GlobalMediator, "Thread %d: polling mpi_blocked_queue", thread_id);
-        mgr->run_mpi_blocked();
+#ifdef ENABLE_MPI
+    if ( mgr->mpiPoller_.busy() ) {
+        DEBUG_PRINT(DEBUG_GlobalMediator, "Thread %d: polling MPI requests", thread_id);
+        /* busy polling: no sleep while requests are pending */
+        mgr->run_mpi();
+        return true;
+    }
+    if ( MPIAggregator::Instance().busy() ) {
+        /* nothing to wait for the batches */
+        MPIAggregator::Instance().progress(true);
         return true;
-    } 
+    }
+#endif
 
     return false;
 }
@@ -103,10 +199,10 @@ GlobalMediator::run()
     for ( ;; ) {
         if ( run_once() ) continue;
 
-        // no task, no mpi_blocked_queue
-        // TODO: Do we need to try stealing mpi_blocked_queue from others ?
+        // no task, no pending MPI request
+        // TODO: Do we need to try stealing MPI requests from others ?
         if ( !terminatable ) {
-            DEBUG_PRINT(DEBUG_GlobalMediator, "Thread %d: mpi_blocked_queue is empty, to sleep", thread_id);
+            DEBUG_PRINT(DEBUG_GlobalMediator, "Thread %d: no MPI request pending, to sleep", thread_id);
             mgr->wait_task();
         } else if ( thread_id != 0 ) {
             // normal thread
@@ -118,9 +214,13 @@ GlobalMediator::run()
             TaskPool::Terminate();
 #endif
             globalWaitCond_.notify_all();
+            netPoller.interrupt();
             for ( auto &thread : children ) {
                 thread.join();
             }
+#ifdef ENABLE_MPI
+            MPIProgressThread::Instance().stop();
+#endif
             break;
         }
     }
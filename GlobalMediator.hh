@@ -4,6 +4,8 @@
 #include "util.hh"
 #include "PerThreadMgr.hh"
 #include "Task.hh"
+#include "Spinlock.hh"
+#include "IntrusiveQueue.hh"
 
 #include <utility>
 #include <memory>
@@ -25,7 +27,20 @@ struct ThreadLocalInfo : public NonCopyable {
 
 class GlobalMediator : public Singleton {
 public:
-    void addRunnable(TaskPtr ptr);
+    void addRunnable(TaskPtr const &ptr) {
+        addRunnable(TaskPtr(ptr));
+    }
+    /* hands the reference over, prefer it on hot paths */
+    void addRunnable(TaskPtr &&ptr);
+
+    /* a parked task (GroupWait/Parked/IOBlocked) becomes Runnable */
+    void wakeUp(TaskPtr &&ptr) {
+        ptr->state = Task::Runnable;
+        addRunnable(std::move(ptr));
+    }
+    /* wakeUp() from a thread that is no worker, e.g. in the
+     * BlockingPool: a worker takes the task at its next round */
+    void wakeUpForeign(TaskPtr &&ptr);
     bool run_once();
     void run();
 
@@ -50,10 +65,28 @@ public:
     std::condition_variable globalWaitCond_;
 
     std::atomic<int> sleep_count = {0};
+    /* of them, the ones blocked in their io_uring */
+    std::atomic<int> ring_sleep_count = {0};
 
 private:
     bool terminatable = false;
 
+    /* move the tasks woken by foreign threads to this worker */
+    bool takeForeign(PerThreadMgr *mgr);
+    /* a task became runnable, wake one of the sleeping workers */
+    void wakeSleeper();
+
+    /* not in the runnable_queues: a steal replaces the thief's queue */
+    Spinlock                foreignMut;
+    IntrusiveQueue<Task>    foreignQueue;
+    std::atomic<int>        numForeign = {0};
+
+#ifdef ENABLE_MPI
+    /* run_once() calls between two MPI polls of a busy worker,
+     * 0 to poll only when idle, see Config::mpi_progress */
+    unsigned                mpiPollInterval = 0;
+#endif
+
     std::vector<std::unique_ptr<ThreadLocalInfo>> threadLocalInfos;
     std::vector<std::thread> children;
 };
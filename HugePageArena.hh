@@ -0,0 +1,141 @@
+#ifndef _HUGEPAGEARENA_HH_
+#define _HUGEPAGEARENA_HH_
+
+#include "debug.hh"
+#include "util.hh"
+
+#include <sys/mman.h>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <boost/context/stack_context.hpp>
+
+/* Arena provider backing big, long-lived regions (ObjectLayer arenas,
+ * coroutine stack regions) with 2MB pages to cut dTLB misses.
+ *
+ * allocate() tries, in order:
+ *   1) explicit hugepages (MAP_HUGETLB, needs vm.nr_hugepages > 0)
+ *   2) a 2MB-aligned anonymous mapping with MADV_HUGEPAGE, so that
+ *      transparent hugepages can back it
+ * and returns nullptr if both fail, the caller then falls back to
+ * ordinary heap memory.
+ */
+struct HugePageArena {
+    static constexpr std::size_t huge_page_size = 2 * 1024 * 1024;
+
+    static std::size_t round_up(std::size_t bytes) {
+        return (bytes + huge_page_size - 1) & ~(huge_page_size - 1);
+    }
+
+    /* bytes is rounded up to a multiple of huge_page_size,
+     * deallocate() must be called with the same bytes */
+    static void *allocate(std::size_t bytes) {
+        std::size_t len = round_up(bytes);
+        void *p;
+
+#ifdef MAP_HUGETLB
+        p = ::mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if ( p != MAP_FAILED ) {
+            return p;
+        }
+#endif /* MAP_HUGETLB */
+
+        /* over-map by one hugepage, then trim to a 2MB boundary */
+        p = ::mmap(nullptr, len + huge_page_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if ( p == MAP_FAILED ) {
+            return nullptr;
+        }
+        std::uintptr_t raw = reinterpret_cast<std::uintptr_t>(p);
+        std::uintptr_t aligned = (raw + huge_page_size - 1) & ~(huge_page_size - 1);
+        if ( aligned != raw ) {
+            ::munmap(p, aligned - raw);
+        }
+        std::size_t tail = raw + len + huge_page_size - (aligned + len);
+        if ( tail != 0 ) {
+            ::munmap(reinterpret_cast<void*>(aligned + len), tail);
+        }
+
+#ifdef MADV_HUGEPAGE
+        ::madvise(reinterpret_cast<void*>(aligned), len, MADV_HUGEPAGE);
+#endif /* MADV_HUGEPAGE */
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    static void deallocate(void *p, std::size_t bytes) {
+        ::munmap(p, round_up(bytes));
+    }
+};
+
+/* boost::context StackAllocator carving fixed-size stacks out of
+ * hugepage-backed regions. Freed stacks go to a per-thread free list
+ * and regions are never returned, the same policy as the object pool.
+ * If no region can be mapped, it falls back to malloc'ed stacks.
+ */
+class HugePageStack {
+public:
+    explicit HugePageStack(std::size_t size)
+        : size_((size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1))
+    {}
+
+    boost::context::stack_context allocate() {
+        FreeStack *&head = freeList();
+        void *vp;
+        if ( head ) {
+            vp = head;
+            head = head->next;
+        } else if ( (vp = carve()) == nullptr ) {
+            throw std::bad_alloc();
+        }
+
+        boost::context::stack_context sctx;
+        sctx.size = size_;
+        sctx.sp = static_cast<char*>(vp) + size_;
+        return sctx;
+    }
+
+    void deallocate(boost::context::stack_context &sctx) {
+        MUST_TRUE(sctx.sp, "HugePageStack deallocates a null stack");
+        FreeStack *s = reinterpret_cast<FreeStack*>(static_cast<char*>(sctx.sp) - sctx.size);
+        FreeStack *&head = freeList();
+        s->next = head;
+        head = s;
+    }
+private:
+    struct FreeStack {
+        FreeStack *next;
+    };
+
+    struct Region {
+        char        *cur = nullptr;
+        char        *end = nullptr;
+    };
+
+    static FreeStack *&freeList() {
+        static thread_local FreeStack *head = nullptr;
+        return head;
+    }
+
+    void *carve() {
+        static thread_local Region region;
+        if ( region.cur + size_ > region.end ) {
+            std::size_t len = size_ > HugePageArena::huge_page_size ?
+                HugePageArena::round_up(size_) : HugePageArena::huge_page_size;
+            void *p = HugePageArena::allocate(len);
+            if ( !p ) {
+                DEBUG_PRINT(DEBUG_WARNING, "no hugepage region available, fallback to malloc'ed stack");
+                return ::operator new(size_, std::nothrow);
+            }
+            region.cur = static_cast<char*>(p);
+            region.end = region.cur + len;
+        }
+        void *res = region.cur;
+        region.cur += size_;
+        return res;
+    }
+
+    std::size_t size_;
+};
+
+#endif /* _HUGEPAGEARENA_HH_ */
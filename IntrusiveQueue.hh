@@ -0,0 +1,81 @@
+#ifndef _INTRUSIVEQUEUE_HH_
+#define _INTRUSIVEQUEUE_HH_
+
+#include "util.hh"
+#include "Skiplist.hh"
+
+#include <utility>
+
+/* FIFO threaded through Linkable::next, holding one reference per
+ * queued object. Meant for wait lists: a parked Task is in no
+ * runnable_queue, so its next pointer is free. Not thread-safe.
+ */
+template<class T>
+class IntrusiveQueue : public NonCopyable {
+public:
+    using ref_ptr_type = DerivedRefPtr<T>;
+
+    void push(ref_ptr_type &&ptr) {
+        T *t = ptr.get();
+        ptr.set(nullptr);
+        t->next = nullptr;
+        if ( tail ) {
+            tail->next = t;
+        } else {
+            head = t;
+        }
+        tail = t;
+    }
+
+    ref_ptr_type pop() {
+        ref_ptr_type res;
+        if ( head ) {
+            T *t = head;
+            head = head->next;
+            if ( !head ) {
+                tail = nullptr;
+            }
+            t->next = nullptr;
+            res.set(t);
+        }
+        return res;
+    }
+
+    /* unlink t, a null pointer if t is not queued; linear */
+    ref_ptr_type remove(T *t) {
+        ref_ptr_type res;
+        T *prev = nullptr;
+        for ( T *p = head; p; prev = p, p = p->next ) {
+            if ( p != t ) {
+                continue;
+            }
+            (prev ? prev->next : head) = p->next;
+            if ( tail == p ) {
+                tail = prev;
+            }
+            p->next = nullptr;
+            res.set(p);
+            break;
+        }
+        return res;
+    }
+
+    bool empty() const {
+        return head == nullptr;
+    }
+
+    void swap(IntrusiveQueue &other) {
+        std::swap(head, other.head);
+        std::swap(tail, other.tail);
+    }
+
+    ~IntrusiveQueue() {
+        while ( pop() )
+            ;
+    }
+private:
+    T   *head = nullptr;
+    T   *tail = nullptr;
+};
+
+#endif /* _INTRUSIVEQUEUE_HH_ */
@@ -0,0 +1,234 @@
+#include "IoRing.hh"
+#include "debug.hh"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+static std::atomic<bool> unavailable = {false};
+
+static int
+io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+io_uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags,
+        void *arg, size_t argSize)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize);
+}
+
+std::unique_ptr<IoRing>
+IoRing::create(unsigned entries)
+{
+    if ( unavailable.load(std::memory_order_relaxed) ) {
+        return nullptr;
+    }
+    std::unique_ptr<IoRing> ring(new IoRing());
+    if ( !ring->setup(entries) ) {
+        DEBUG_PRINT(DEBUG_WARNING, "io_uring unavailable: %d", errno);
+        unavailable.store(true, std::memory_order_relaxed);
+        return nullptr;
+    }
+    return ring;
+}
+
+bool
+IoRing::setup(unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    fd = io_uring_setup(entries, &p);
+    if ( fd < 0 ) {
+        return false;
+    }
+    /* wait() needs the timeout of IORING_ENTER_EXT_ARG, 5.11 on;
+     * IORING_OP_READ/WRITE come before it */
+    if ( !(p.features & IORING_FEAT_EXT_ARG) ) {
+        errno = ENOSYS;
+        return false;
+    }
+    /* blocking, io_uring fails a read of a nonblocking fd at once */
+    wakeFd = eventfd(0, EFD_CLOEXEC);
+    if ( wakeFd < 0 ) {
+        return false;
+    }
+
+    sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if ( p.features & IORING_FEAT_SINGLE_MMAP ) {
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    }
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if ( sqRing == MAP_FAILED ) {
+        sqRing = nullptr;
+        return false;
+    }
+    if ( p.features & IORING_FEAT_SINGLE_MMAP ) {
+        cqRing = sqRing;
+    } else {
+        cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if ( cqRing == MAP_FAILED ) {
+            cqRing = nullptr;
+            return false;
+        }
+    }
+    sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    void *mem = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if ( mem == MAP_FAILED ) {
+        return false;
+    }
+    sqes = static_cast<struct io_uring_sqe*>(mem);
+
+    char *sq = static_cast<char*>(sqRing);
+    sqEntries = p.sq_entries;
+    sqHead = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+
+    char *cq = static_cast<char*>(cqRing);
+    cqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+    return true;
+}
+
+IoRing::~IoRing()
+{
+    MUST_TRUE(inflight == 0, "IoRing destroyed with %u requests in flight", inflight);
+    if ( sqes ) {
+        munmap(sqes, sqesSize);
+    }
+    if ( cqRing && cqRing != sqRing ) {
+        munmap(cqRing, cqRingSize);
+    }
+    if ( sqRing ) {
+        munmap(sqRing, sqRingSize);
+    }
+    /* cancels the read of wakeFd */
+    if ( fd >= 0 ) {
+        close(fd);
+    }
+    if ( wakeFd >= 0 ) {
+        close(wakeFd);
+    }
+}
+
+bool
+IoRing::prepare(uint8_t opcode, int targetFd, void *buf, unsigned len, off_t offset,
+        Request *req)
+{
+    if ( !queue(opcode, targetFd, buf, len, offset, req) ) {
+        return false;
+    }
+    ++inflight;
+    return true;
+}
+
+bool
+IoRing::queue(uint8_t opcode, int targetFd, void *buf, unsigned len, off_t offset,
+        Request *req)
+{
+    /* the kernel moves head as it consumes the sqes */
+    unsigned tail = *sqTail;
+    if ( tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) == sqEntries ) {
+        return false;
+    }
+    unsigned index = tail & sqMask;
+    struct io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = targetFd;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = reinterpret_cast<uint64_t>(req);
+    sqArray[index] = index;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    ++unsubmitted;
+    return true;
+}
+
+void
+IoRing::submit()
+{
+    while ( unsubmitted != 0 ) {
+        int r = io_uring_enter(fd, unsubmitted, 0, 0, nullptr, 0);
+        if ( r < 0 ) {
+            /* EAGAIN/EBUSY: short of resources, retry at the next run() */
+            MUST_TRUE(errno == EAGAIN || errno == EBUSY || errno == EINTR,
+                    "io_uring_enter failed: %d", errno);
+            return;
+        }
+        unsubmitted -= r;
+    }
+}
+
+bool
+IoRing::run()
+{
+    if ( unsubmitted != 0 ) {
+        submit();
+    }
+
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    if ( head == tail ) {
+        return false;
+    }
+    for ( ; head != tail; ++head ) {
+        struct io_uring_cqe *cqe = &cqes[head & cqMask];
+        Request *req = reinterpret_cast<Request*>(cqe->user_data);
+        if ( req != &wakeRead ) {
+            --inflight;
+        }
+        req->complete(cqe->res);
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    return true;
+}
+
+void
+IoRing::wait(Timer::clock::duration timeout)
+{
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+    struct __kernel_timespec ts;
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+
+    /* a full ring does without, the timeout bounds the wait */
+    if ( !wakeRead.armed ) {
+        wakeRead.armed = queue(IORING_OP_READ, wakeFd, &wakeRead.count,
+                sizeof(wakeRead.count), 0, &wakeRead);
+    }
+    submit();
+    /* completions are taken by the next run() */
+    io_uring_enter(fd, 0, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+void
+IoRing::wake()
+{
+    uint64_t one = 1;
+    ssize_t r = write(wakeFd, &one, sizeof(one));
+    (void)r;
+}
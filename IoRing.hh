@@ -0,0 +1,86 @@
+#ifndef _IORING_HH_
+#define _IORING_HH_
+
+#include "util.hh"
+#include "Timer.hh"
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <memory>
+
+/* A worker's io_uring, driven through the raw syscalls.
+ *
+ * Only its PerThreadMgr touches it: requests are queued from the
+ * parking hooks of its tasks, run_io() submits them in one
+ * io_uring_enter() and completes the finished ones. So neither the
+ * submission nor the completion ring needs a lock. The exception is
+ * wake(), from any thread: wait() keeps a read of an eventfd in
+ * flight, which wake() completes.
+ */
+class IoRing : public NonCopyable {
+public:
+    /* a request in flight, the cqe result goes to complete() */
+    struct Request {
+        /* on the ring's thread: res as io_uring returns it, -errno on failure */
+        virtual void complete(int res) = 0;
+    protected:
+        ~Request() = default;
+    };
+
+    /* nullptr if io_uring is not available, then it is not tried again */
+    static std::unique_ptr<IoRing> create(unsigned entries);
+    ~IoRing();
+
+    /* queue one request, false if the submission ring is full */
+    bool prepare(uint8_t opcode, int fd, void *buf, unsigned len, off_t offset,
+            Request *req);
+
+    /* submit the queued requests, complete the finished ones,
+     * true if any completed */
+    bool run();
+    /* block until a request completes, at most timeout */
+    void wait(Timer::clock::duration timeout);
+    /* return from wait(), or from the next one; from any thread */
+    void wake();
+
+    bool busy() const {
+        return inflight != 0;
+    }
+private:
+    /* the read of wakeFd, not counted in inflight */
+    struct WakeRead : public Request {
+        void complete(int) override {
+            armed = false;
+        }
+
+        bool        armed = false;
+        uint64_t    count;
+    };
+
+    IoRing() = default;
+    bool setup(unsigned entries);
+    bool queue(uint8_t opcode, int fd, void *buf, unsigned len, off_t offset,
+            Request *req);
+    void submit();
+
+    int             fd = -1;
+    int             wakeFd = -1;
+    WakeRead        wakeRead;
+    unsigned        inflight = 0;
+    unsigned        unsubmitted = 0;
+
+    void            *sqRing = nullptr;
+    size_t          sqRingSize = 0;
+    void            *cqRing = nullptr;
+    size_t          cqRingSize = 0;
+    struct io_uring_sqe *sqes = nullptr;
+    size_t          sqesSize = 0;
+
+    unsigned        sqEntries = 0;
+    unsigned        *sqHead, *sqTail, sqMask, *sqArray;
+    unsigned        *cqHead, *cqTail, cqMask;
+    struct io_uring_cqe *cqes;
+};
+
+#endif /* _IORING_HH_ */
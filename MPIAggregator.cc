@@ -0,0 +1,181 @@
+#include "MPIAggregator.hh"
+#include "MPIPoller.hh"
+#include "Config.hh"
+#include "debug.hh"
+
+#include <cstring>
+#include <utility>
+
+/* of the basic C datatypes, their packed bytes are their bytes; 0 for
+ * the others. By handle: asking MPI takes more than a task stack. */
+static int
+basicSize(MPI_Datatype t)
+{
+    if ( t == MPI_BYTE || t == MPI_CHAR || t == MPI_SIGNED_CHAR || t == MPI_UNSIGNED_CHAR
+            || t == MPI_INT8_T || t == MPI_UINT8_T ) {
+        return 1;
+    }
+    if ( t == MPI_SHORT || t == MPI_UNSIGNED_SHORT || t == MPI_INT16_T || t == MPI_UINT16_T ) {
+        return sizeof(short);
+    }
+    if ( t == MPI_INT || t == MPI_UNSIGNED || t == MPI_INT32_T || t == MPI_UINT32_T ) {
+        return sizeof(int);
+    }
+    if ( t == MPI_LONG || t == MPI_UNSIGNED_LONG ) {
+        return sizeof(long);
+    }
+    if ( t == MPI_LONG_LONG || t == MPI_UNSIGNED_LONG_LONG || t == MPI_INT64_T || t == MPI_UINT64_T ) {
+        return sizeof(long long);
+    }
+    if ( t == MPI_FLOAT ) {
+        return sizeof(float);
+    }
+    if ( t == MPI_DOUBLE ) {
+        return sizeof(double);
+    }
+    return 0;
+}
+
+bool
+MPIAggregator::send(const void *buf, int count, MPI_Datatype datatype,
+        int dest, int tag, MPI_Comm comm, int *err)
+{
+    if ( tag == batch_tag ) {
+        /* the receiver would take it for a batch */
+        *err = MPI_ERR_TAG;
+        return true;
+    }
+    int size = basicSize(datatype);
+    /* nothing would flush the batch of a thread that blocks */
+    if ( !MPIPoller::parkable() || size == 0 || dest == MPI_PROC_NULL
+            || count < 0 || (long)size * count > max_message ) {
+        return false;
+    }
+    Header header{tag, size * count};
+
+    bool full;
+    {
+        std::lock_guard<std::mutex> _(mut_);
+        Key key{dest, comm};
+        auto it = batches.find(key);
+        if ( it == batches.end() ) {
+            it = batches.emplace(key, Batch()).first;
+            if ( !freeData.empty() ) {
+                it->second.data = std::move(freeData.back());
+                freeData.pop_back();
+            }
+            it->second.since = Clock::now();
+            updateBusy();
+        }
+        std::vector<char> &data = it->second.data;
+        std::size_t at = data.size();
+        data.resize(at + sizeof(header) + header.bytes);
+        memcpy(&data[at], &header, sizeof(header));
+        memcpy(&data[at + sizeof(header)], buf, header.bytes);
+        full = data.size() >= (std::size_t)Config::Instance().mpi_aggregate_bytes;
+    }
+
+    *err = MPI_SUCCESS;
+    if ( full ) {
+        *err = MPIPoller::call([&] (MPI_Request *request) {
+                    *request = MPI_REQUEST_NULL;
+                    return flush(dest, comm);
+                }, MPI_STATUS_IGNORE);
+    }
+    return true;
+}
+
+int
+MPIAggregator::flush(int dest, MPI_Comm comm)
+{
+    if ( !busy() ) {
+        return MPI_SUCCESS;
+    }
+    std::lock_guard<std::mutex> _(mut_);
+    auto it = batches.find(Key{dest, comm});
+    if ( it == batches.end() ) {
+        return MPI_SUCCESS;
+    }
+    int r = post(it->first, it->second);
+    batches.erase(it);
+    updateBusy();
+    return r;
+}
+
+void
+MPIAggregator::progress(bool idle)
+{
+    /* one worker at a time, the others go on */
+    std::unique_lock<std::mutex> lock(mut_, std::try_to_lock);
+    if ( !lock ) {
+        return;
+    }
+
+    if ( !inflight.empty() ) {
+        int n = (int)inflight.size();
+        indices.resize(n);
+        int outcount;
+        int r = MPI_Testsome(n, inflight.data(), &outcount, indices.data(), MPI_STATUSES_IGNORE);
+        if ( r != MPI_SUCCESS ) {
+            DEBUG_PRINT(DEBUG_WARNING, "MPI_Testsome of batches failed: %d", r);
+        }
+        if ( outcount != MPI_UNDEFINED && outcount > 0 ) {
+            /* completed ones are null now, drop them in one pass */
+            std::size_t kept = 0;
+            for ( std::size_t i = 0; i < inflight.size(); ++i ) {
+                if ( inflight[i] == MPI_REQUEST_NULL ) {
+                    recycle(std::move(inflightData[i]));
+                    continue;
+                }
+                if ( kept != i ) {
+                    /* not onto itself, that would free it */
+                    inflight[kept] = inflight[i];
+                    inflightData[kept] = std::move(inflightData[i]);
+                }
+                ++kept;
+            }
+            inflight.resize(kept);
+            inflightData.resize(kept);
+        }
+    }
+
+    if ( !batches.empty() ) {
+        Clock::time_point due = Clock::now()
+            - std::chrono::microseconds(Config::Instance().mpi_aggregate_delay);
+        for ( auto it = batches.begin(); it != batches.end(); ) {
+            if ( idle || it->second.since <= due ) {
+                post(it->first, it->second);
+                it = batches.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    updateBusy();
+}
+
+int
+MPIAggregator::post(Key const &key, Batch &batch)
+{
+    MPI_Request request;
+    int r = MPI_Isend(batch.data.data(), (int)batch.data.size(), MPI_BYTE,
+            key.dest, batch_tag, key.comm, &request);
+    if ( r != MPI_SUCCESS ) {
+        DEBUG_PRINT(DEBUG_WARNING, "MPI_Isend of a batch to %d failed: %d", key.dest, r);
+        recycle(std::move(batch.data));
+        return r;
+    }
+    /* moving the vector keeps its buffer where it is */
+    inflight.push_back(request);
+    inflightData.push_back(std::move(batch.data));
+    return r;
+}
+
+void
+MPIAggregator::recycle(std::vector<char> &&data)
+{
+    if ( freeData.size() < max_free_batches ) {
+        data.clear();
+        freeData.push_back(std::move(data));
+    }
+}
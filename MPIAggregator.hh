@@ -0,0 +1,110 @@
+#ifndef _MPIAGGREGATOR_HH_
+#define _MPIAGGREGATOR_HH_
+
+#include "util.hh"
+
+#include <mpi.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+/* Small sends of all tasks of the rank, coalesced per destination, with
+ * Config::mpi_send_aggregate.
+ *
+ * MPI_Send_Hook() of at most max_message bytes of a basic C datatype,
+ * from a task that MPIPoller would park rather than block, copies the message into the batch of its (dest, comm) and returns, as
+ * a buffered send would. The batch goes out as one MPI_Isend() of tag
+ * batch_tag once it holds Config::mpi_aggregate_bytes, once its first
+ * message is Config::mpi_aggregate_delay old, or once a worker runs out
+ * of tasks. The MPIDispatcher of the receiver unpacks it and matches
+ * each message to the receiving tasks by its own tag, so the receivers
+ * must dispatch too. The hooks fail a send or a dispatched receive of
+ * batch_tag with MPI_ERR_TAG.
+ *
+ * The sends bypassing the batch (larger ones, MPI_Sendrecv_Hook())
+ * flush the batch of their destination first: messages of a task to a
+ * destination are not reordered.
+ */
+class MPIAggregator : public Singleton {
+public:
+    /* the least MPI_TAG_UB, reserved on the communicators aggregated */
+    static constexpr int batch_tag = 32767;
+    /* larger messages are sent on their own */
+    static constexpr int max_message = 1024;
+
+    /* one message and its tag, in a batch */
+    struct Header {
+        int     tag;
+        int     bytes;
+    };
+
+    /* MPI_Send() through the batch of dest, into *err; false if the
+     * message cannot be aggregated. MPI_ERR_TAG for batch_tag. */
+    bool send(const void *buf, int count, MPI_Datatype datatype,
+            int dest, int tag, MPI_Comm comm, int *err);
+
+    /* the batch of (dest, comm) out, on the worker's stack */
+    int flush(int dest, MPI_Comm comm);
+
+    /* from the workers: the batches due out, all of them if idle, and
+     * the batches in flight tested */
+    void progress(bool idle);
+
+    /* batches pending or in flight */
+    bool busy() const {
+        return numBusy.load(std::memory_order_relaxed) != 0;
+    }
+
+    static MPIAggregator &Instance() {
+        static MPIAggregator a;
+        return a;
+    }
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Key {
+        int         dest;
+        MPI_Comm    comm;
+
+        bool operator==(Key const &k) const {
+            return dest == k.dest && comm == k.comm;
+        }
+    };
+    struct KeyHash {
+        std::size_t operator()(Key const &k) const {
+            return std::hash<MPI_Comm>()(k.comm) * 31 + (std::size_t)k.dest;
+        }
+    };
+
+    struct Batch {
+        std::vector<char>   data;
+        /* of its first message */
+        Clock::time_point   since;
+    };
+
+    static constexpr std::size_t max_free_batches = 64;
+
+    /* with mut_ held */
+    int post(Key const &key, Batch &batch);
+    void recycle(std::vector<char> &&data);
+    void updateBusy() {
+        numBusy.store((int)(batches.size() + inflight.size()), std::memory_order_relaxed);
+    }
+
+    std::mutex      mut_;
+    std::unordered_map<Key, Batch, KeyHash>     batches;
+    /* side by side, as MPI_Testsome() takes them */
+    std::vector<MPI_Request>                    inflight;
+    std::vector<std::vector<char>>              inflightData;
+    std::vector<std::vector<char>>              freeData;
+    std::atomic<int>                            numBusy = {0};
+
+    /* MPI_Testsome() output */
+    std::vector<int>                            indices;
+};
+
+#endif /* _MPIAGGREGATOR_HH_ */
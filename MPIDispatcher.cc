@@ -0,0 +1,384 @@
+#include "MPIDispatcher.hh"
+#include "MPIAggregator.hh"
+#include "GlobalMediator.hh"
+#include "debug.hh"
+
+#include <algorithm>
+#include <cstring>
+
+class MPIDispatcher::Recv : public MPIPoller::Request {
+public:
+    enum {
+        /* queued in the dispatcher */
+        Waiting,
+        /* matched, MPI_Imrecv() into buf in flight */
+        Receiving,
+        /* copied from a buffer of the pool */
+        Done,
+    };
+
+    Recv(void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm)
+        : buf(buf)
+        , count(count)
+        , datatype(datatype)
+        , key{source, tag, comm}
+    {
+        polled = true;
+    }
+
+    bool wildcard() const {
+        return key.source == MPI_ANY_SOURCE || key.tag == MPI_ANY_TAG;
+    }
+    bool matches(Key const &k) const {
+        return key.comm == k.comm
+            && (key.source == MPI_ANY_SOURCE || key.source == k.source)
+            && (key.tag == MPI_ANY_TAG || key.tag == k.tag);
+    }
+protected:
+    int start() override {
+        return MPIDispatcher::Instance().post(this);
+    }
+    int test(int *flag) override {
+        switch ( state.load(std::memory_order_acquire) ) {
+        case Receiving:
+            return MPI_Test(&request, flag, &status);
+        case Done:
+            *flag = 1;
+            return result;
+        default:
+            *flag = 0;
+            return MPI_SUCCESS;
+        }
+    }
+private:
+    friend class MPIDispatcher;
+
+    void                *buf;
+    int                 count;
+    MPI_Datatype        datatype;
+    Key                 key;
+    unsigned long       seq = 0;
+    /* set by whichever thread matches it */
+    std::atomic<int>    state = {Waiting};
+    int                 result = MPI_SUCCESS;
+};
+
+int
+MPIDispatcher::recv(void *buf, int count, MPI_Datatype datatype,
+        int source, int tag, MPI_Comm comm, MPI_Status *status)
+{
+    if ( tag == MPIAggregator::batch_tag ) {
+        /* taken apart by unbatch(), never matched */
+        return MPI_ERR_TAG;
+    }
+    Recv r(buf, count, datatype, source, tag, comm);
+    if ( GlobalMediator::thread_id >= 0 && co_currentTask && !co_currentTask->pure() ) {
+        return r.park(status);
+    }
+
+    /* no task to park, poll until done */
+    int flag = 0;
+    int err = post(&r);
+    while ( err == MPI_SUCCESS && (err = r.test(&flag)) == MPI_SUCCESS && !flag ) {
+        poll();
+    }
+    if ( status != MPI_STATUS_IGNORE ) {
+        *status = r.status;
+    }
+    return err;
+}
+
+/* polls the dispatcher until a message matching it arrived */
+class MPIDispatcher::Probe : public MPIPoller::Request {
+public:
+    Probe(int source, int tag, MPI_Comm comm)
+        : key{source, tag, comm}
+    {
+        polled = true;
+    }
+protected:
+    int start() override {
+        MPIDispatcher::Instance().watch(key.comm);
+        return MPI_SUCCESS;
+    }
+    int test(int *flag) override {
+        MPIDispatcher &d = MPIDispatcher::Instance();
+        std::lock_guard<std::mutex> _(d.mut_);
+        *flag = d.peekUnexpected(key, &status);
+        return MPI_SUCCESS;
+    }
+private:
+    friend class MPIDispatcher;
+
+    Key     key;
+};
+
+int
+MPIDispatcher::probe(int source, int tag, MPI_Comm comm, MPI_Status *status)
+{
+    if ( tag == MPIAggregator::batch_tag ) {
+        return MPI_ERR_TAG;
+    }
+    Probe p(source, tag, comm);
+    if ( MPIPoller::parkable() ) {
+        return p.park(status);
+    }
+
+    /* no task to park, poll until one arrived */
+    int flag = 0;
+    int err = p.start();
+    while ( err == MPI_SUCCESS && (err = p.test(&flag)) == MPI_SUCCESS && !flag ) {
+        poll();
+    }
+    if ( status != MPI_STATUS_IGNORE ) {
+        *status = p.status;
+    }
+    return err;
+}
+
+void
+MPIDispatcher::watch(MPI_Comm comm)
+{
+    std::lock_guard<std::mutex> _(mut_);
+    if ( std::find(comms.begin(), comms.end(), comm) == comms.end() ) {
+        comms.push_back(comm);
+        numComms.store((int)comms.size(), std::memory_order_release);
+    }
+}
+
+int
+MPIDispatcher::post(Recv *r)
+{
+    watch(r->key.comm);
+
+    std::lock_guard<std::mutex> _(mut_);
+    Message m;
+    if ( takeUnexpected(r, m) ) {
+        deliver(r, m);
+        return MPI_SUCCESS;
+    }
+    r->seq = ++numPosted;
+    if ( r->wildcard() ) {
+        wildcards.push_back(r);
+    } else {
+        waiters[r->key].push_back(r);
+    }
+    return MPI_SUCCESS;
+}
+
+void
+MPIDispatcher::poll()
+{
+    if ( numComms.load(std::memory_order_acquire) == 0 ) {
+        return;
+    }
+    /* one thread at a time matches, the others go on */
+    std::unique_lock<std::mutex> lock(mut_, std::try_to_lock);
+    if ( !lock ) {
+        return;
+    }
+    for ( MPI_Comm comm : comms ) {
+        for ( int i = 0; i < max_arrivals; ++i ) {
+            int flag;
+            MPI_Message msg;
+            MPI_Status st;
+            if ( MPI_Improbe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &flag, &msg, &st) != MPI_SUCCESS
+                    || !flag ) {
+                break;
+            }
+            arrive(comm, msg, st);
+        }
+    }
+}
+
+void
+MPIDispatcher::arrive(MPI_Comm comm, MPI_Message msg, MPI_Status &st)
+{
+    Message m;
+    m.source = st.MPI_SOURCE;
+    m.tag = st.MPI_TAG;
+    /* the size of the message received as MPI_PACKED */
+    MPI_Get_count(&st, MPI_PACKED, &m.bytes);
+    m.buffer = nullptr;
+    m.message = msg;
+    if ( m.tag == MPIAggregator::batch_tag ) {
+        unbatch(comm, m);
+        return;
+    }
+    m.seq = ++numArrived;
+    match(comm, m);
+}
+
+void
+MPIDispatcher::unbatch(MPI_Comm comm, Message &b)
+{
+    static_assert(MPIAggregator::max_message <= buffer_size, "a message fits a buffer");
+    batch.resize(b.bytes);
+    if ( MPI_Mrecv(batch.data(), b.bytes, MPI_BYTE, &b.message, MPI_STATUS_IGNORE) != MPI_SUCCESS ) {
+        DEBUG_PRINT(DEBUG_WARNING, "MPI_Mrecv of a batch from %d failed", b.source);
+        return;
+    }
+    MPIAggregator::Header header;
+    for ( std::size_t at = 0; at + sizeof(header) <= batch.size(); at += sizeof(header) + header.bytes ) {
+        memcpy(&header, &batch[at], sizeof(header));
+        if ( header.bytes < 0 || header.bytes > buffer_size
+                || (std::size_t)header.bytes > batch.size() - at - sizeof(header) ) {
+            DEBUG_PRINT(DEBUG_WARNING, "malformed batch from %d, the rest of it dropped", b.source);
+            return;
+        }
+        Message m;
+        m.source = b.source;
+        m.tag = header.tag;
+        m.bytes = header.bytes;
+        m.seq = ++numArrived;
+        /* as if received by itself */
+        m.buffer = allocBuffer();
+        memcpy(m.buffer, &batch[at + sizeof(header)], header.bytes);
+        m.message = MPI_MESSAGE_NULL;
+        match(comm, m);
+    }
+}
+
+void
+MPIDispatcher::match(MPI_Comm comm, Message &m)
+{
+    Key key{m.source, m.tag, comm};
+    Recv *r = takeWaiter(key);
+    if ( r ) {
+        deliver(r, m);
+        return;
+    }
+    if ( !m.buffer && m.bytes <= buffer_size ) {
+        /* frees the sender, and MPI's own buffers; packed, any
+         * datatype may take it apart with MPI_Unpack() */
+        m.buffer = allocBuffer();
+        MPI_Mrecv(m.buffer, m.bytes, MPI_PACKED, &m.message, MPI_STATUS_IGNORE);
+    }
+    unexpected[key].push_back(m);
+}
+
+void
+MPIDispatcher::deliver(Recv *r, Message &m)
+{
+    int elements = 0;
+    if ( !m.buffer ) {
+        int err = MPI_Imrecv(r->buf, r->count, r->datatype, &m.message, &r->request);
+        if ( err == MPI_SUCCESS ) {
+            r->state.store(Recv::Receiving, std::memory_order_release);
+            return;
+        }
+        r->result = err;
+    } else {
+        /* the packed size of one element of the receive */
+        int packed;
+        MPI_Pack_size(1, r->datatype, r->key.comm, &packed);
+        if ( (long)packed * r->count < m.bytes ) {
+            r->result = MPI_ERR_TRUNCATE;
+        } else if ( m.bytes != 0 ) {
+            int position = 0;
+            elements = m.bytes / packed;
+            r->result = MPI_Unpack(m.buffer, m.bytes, &position,
+                    r->buf, elements, r->datatype, r->key.comm);
+        }
+        freeBuffer(m.buffer);
+    }
+    r->status.MPI_SOURCE = m.source;
+    r->status.MPI_TAG = m.tag;
+    r->status.MPI_ERROR = r->result;
+    MPI_Status_set_elements(&r->status, r->datatype, elements);
+    r->state.store(Recv::Done, std::memory_order_release);
+}
+
+MPIDispatcher::Recv*
+MPIDispatcher::takeWaiter(Key const &key)
+{
+    auto it = waiters.find(key);
+    auto wit = std::find_if(wildcards.begin(), wildcards.end(),
+            [&key] (Recv *r) { return r->matches(key); });
+
+    if ( it != waiters.end() && (wit == wildcards.end() || it->second.front()->seq < (*wit)->seq) ) {
+        Recv *r = it->second.front();
+        it->second.pop_front();
+        if ( it->second.empty() ) {
+            waiters.erase(it);
+        }
+        return r;
+    }
+    if ( wit != wildcards.end() ) {
+        Recv *r = *wit;
+        wildcards.erase(wit);
+        return r;
+    }
+    return nullptr;
+}
+
+MPIDispatcher::Unexpected::iterator
+MPIDispatcher::findUnexpected(Key const &key)
+{
+    if ( key.source != MPI_ANY_SOURCE && key.tag != MPI_ANY_TAG ) {
+        return unexpected.find(key);
+    }
+    auto it = unexpected.end();
+    for ( auto i = unexpected.begin(); i != unexpected.end(); ++i ) {
+        Key const &k = i->first;
+        if ( k.comm == key.comm
+                && (key.source == MPI_ANY_SOURCE || key.source == k.source)
+                && (key.tag == MPI_ANY_TAG || key.tag == k.tag)
+                && (it == unexpected.end() || i->second.front().seq < it->second.front().seq) ) {
+            it = i;
+        }
+    }
+    return it;
+}
+
+bool
+MPIDispatcher::peekUnexpected(Key const &key, MPI_Status *status)
+{
+    auto it = findUnexpected(key);
+    if ( it == unexpected.end() ) {
+        return false;
+    }
+    Message const &m = it->second.front();
+    status->MPI_SOURCE = m.source;
+    status->MPI_TAG = m.tag;
+    status->MPI_ERROR = MPI_SUCCESS;
+    /* its packed size, MPI_Get_count() divides it by the datatype's */
+    MPI_Status_set_elements(status, MPI_BYTE, m.bytes);
+    return true;
+}
+
+bool
+MPIDispatcher::takeUnexpected(Recv *r, Message &m)
+{
+    auto it = findUnexpected(r->key);
+    if ( it == unexpected.end() ) {
+        return false;
+    }
+    m = it->second.front();
+    it->second.pop_front();
+    if ( it->second.empty() ) {
+        unexpected.erase(it);
+    }
+    return true;
+}
+
+char*
+MPIDispatcher::allocBuffer()
+{
+    if ( freeBuffers.empty() ) {
+        return new char[buffer_size];
+    }
+    char *buffer = freeBuffers.back();
+    freeBuffers.pop_back();
+    return buffer;
+}
+
+void
+MPIDispatcher::freeBuffer(char *buffer)
+{
+    if ( freeBuffers.size() < max_free_buffers ) {
+        freeBuffers.push_back(buffer);
+    } else {
+        delete[] buffer;
+    }
+}
@@ -0,0 +1,131 @@
+#ifndef _MPIDISPATCHER_HH_
+#define _MPIDISPATCHER_HH_
+
+#include "util.hh"
+#include "MPIPoller.hh"
+
+#include <mpi.h>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+/* The receives of all tasks of the rank, matched in one place, with
+ * Config::mpi_recv_dispatch.
+ *
+ * Instead of one MPI_Irecv() per receiving task, flooding the posted
+ * receive queue of MPI, the dispatcher posts none: at each poll it
+ * takes the arrived messages with a wildcard MPI_Improbe() on the
+ * communicators in use, and matches them by (source, tag, comm) in a
+ * hash map to the parked tasks, in the order they posted. A match is
+ * received right into the task's buffer by MPI_Imrecv(). An unexpected
+ * message is received into a buffer of the pool if it is small, kept
+ * matched but not received otherwise, until a task asks for it.
+ *
+ * It takes over the communicators it receives or probes on: receive
+ * on them only through MPI_Recv_Hook() and MPI_Sendrecv_Hook(), and
+ * probe through MPI_Probe_Hook(), which looks at the unexpected
+ * messages, not with MPI_Irecv() nor MPI_Probe(). Wildcard receives
+ * are matched too, by a linear scan. The batches of the MPIAggregator are taken
+ * apart here, their messages matched one by one.
+ */
+class MPIDispatcher : public Singleton {
+public:
+    /* MPI_Recv() through the dispatcher, parking the current task */
+    int recv(void *buf, int count, MPI_Datatype datatype,
+            int source, int tag, MPI_Comm comm, MPI_Status *status);
+
+    /* MPI_Probe() of the messages arrived through the dispatcher,
+     * parking the current task; the message stays to receive */
+    int probe(int source, int tag, MPI_Comm comm, MPI_Status *status);
+
+    /* match the messages arrived since, from MPIPoller::run() */
+    void poll();
+
+    static MPIDispatcher &Instance() {
+        static MPIDispatcher d;
+        return d;
+    }
+private:
+    class Recv;
+    class Probe;
+
+    /* arrived, not asked for yet */
+    struct Message {
+        int             source;
+        int             tag;
+        int             bytes;
+        unsigned long   seq;
+        /* received into it if small, otherwise still to receive */
+        char            *buffer;
+        MPI_Message     message;
+    };
+
+    struct Key {
+        int         source;
+        int         tag;
+        MPI_Comm    comm;
+
+        bool operator==(Key const &k) const {
+            return source == k.source && tag == k.tag && comm == k.comm;
+        }
+    };
+    struct KeyHash {
+        std::size_t operator()(Key const &k) const {
+            return std::hash<MPI_Comm>()(k.comm) * 31
+                + (std::size_t)k.source * 1000003 + (std::size_t)k.tag;
+        }
+    };
+    using Unexpected = std::unordered_map<Key, std::deque<Message>, KeyHash>;
+
+    /* unexpected messages of up to that many bytes are received
+     * into a buffer of the pool */
+    static constexpr int buffer_size = 4096;
+    static constexpr std::size_t max_free_buffers = 1024;
+    /* per communicator and poll, the others wait for the next */
+    static constexpr int max_arrivals = 256;
+
+    /* probed at each poll from now on */
+    void watch(MPI_Comm comm);
+    /* r matched to an unexpected message right away, or queued */
+    int post(Recv *r);
+    void arrive(MPI_Comm comm, MPI_Message msg, MPI_Status &st);
+    /* the messages of a batch of the MPIAggregator, one by one */
+    void unbatch(MPI_Comm comm, Message &b);
+    /* to the earliest posted receive, or kept unexpected */
+    void match(MPI_Comm comm, Message &m);
+    void deliver(Recv *r, Message &m);
+    /* the earliest posted receive matching a message of key */
+    Recv *takeWaiter(Key const &key);
+    /* the earliest arrived message matching r */
+    bool takeUnexpected(Recv *r, Message &m);
+    /* the queue of the earliest arrived message matching key, which
+     * may hold MPI_ANY_SOURCE or MPI_ANY_TAG */
+    Unexpected::iterator findUnexpected(Key const &key);
+    /* fills status from the earliest message matching key, if any */
+    bool peekUnexpected(Key const &key, MPI_Status *status);
+
+    char *allocBuffer();
+    void freeBuffer(char *buffer);
+
+    std::mutex      mut_;
+    /* probed at each poll */
+    std::vector<MPI_Comm>       comms;
+    std::atomic<int>            numComms = {0};
+
+    std::unordered_map<Key, std::deque<Recv*>, KeyHash>     waiters;
+    /* with MPI_ANY_SOURCE or MPI_ANY_TAG, in posting order */
+    std::vector<Recv*>                                      wildcards;
+    Unexpected                                              unexpected;
+    unsigned long   numPosted = 0;
+    unsigned long   numArrived = 0;
+
+    std::vector<char*>  freeBuffers;
+    /* the batch unbatch() takes apart */
+    std::vector<char>   batch;
+};
+
+#endif /* _MPIDISPATCHER_HH_ */
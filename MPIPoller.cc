@@ -0,0 +1,234 @@
+#include "MPIPoller.hh"
+#include "MPIDispatcher.hh"
+#include "GlobalMediator.hh"
+#include "PerThreadMgr.hh"
+#include "Config.hh"
+#include "debug.hh"
+
+#include <utility>
+
+/* from a worker, or from the MPIProgressThread */
+static void
+resume(TaskPtr &&ptr)
+{
+    if ( GlobalMediator::thread_id >= 0 ) {
+        globalMediator.wakeUp(std::move(ptr));
+    } else {
+        globalMediator.wakeUpForeign(std::move(ptr));
+    }
+}
+
+bool
+MPIPoller::Request::resumeIfNothingToWait(TaskPtr &ptr)
+{
+    /* on the worker's stack, done already if it can */
+    int flag;
+    if ( (error = start()) != MPI_SUCCESS
+            || (error = test(&flag)) != MPI_SUCCESS
+            || flag ) {
+        ptr->state = Task::Runnable;
+        return true;
+    }
+    task = std::move(ptr);
+    if ( Config::Instance().mpi_progress == Config::MPIProgress::Thread ) {
+        MPIProgressThread::Instance().add(this);
+    } else {
+        globalMediator.getThisPerThreadMgr()->mpiPoller().add(this);
+    }
+    return false;
+}
+
+int
+MPIPoller::Request::park(MPI_Status *status)
+{
+    co_currentTask->parkOn(this, Task::MPIBlocked);
+    if ( status != MPI_STATUS_IGNORE ) {
+        *status = this->status;
+    }
+    return error;
+}
+
+bool
+MPIPoller::parkable()
+{
+    return GlobalMediator::thread_id >= 0 && co_currentTask && !co_currentTask->pure();
+}
+
+int
+MPIPoller::wait(MPI_Request *request, MPI_Status *status)
+{
+    if ( !parkable() ) {
+        return MPI_Wait(request, status);
+    }
+    Request req(*request);
+    int r = req.park(status);
+    *request = req.request;
+    return r;
+}
+
+class MPIPoller::Probe : public MPIPoller::Request {
+public:
+    Probe(int source, int tag, MPI_Comm comm)
+        : source(source)
+        , tag(tag)
+        , comm(comm)
+    {
+        polled = true;
+    }
+protected:
+    int test(int *flag) override {
+        return MPI_Iprobe(source, tag, comm, flag, &status);
+    }
+private:
+    int         source;
+    int         tag;
+    MPI_Comm    comm;
+};
+
+int
+MPIPoller::probe(int source, int tag, MPI_Comm comm, MPI_Status *status)
+{
+    if ( !parkable() ) {
+        return MPI_Probe(source, tag, comm, status);
+    }
+    return Probe(source, tag, comm).park(status);
+}
+
+void
+MPIPoller::add(Request *req)
+{
+    requests.push_back(req->request);
+    waiters.push_back(req);
+    if ( req->polled ) {
+        ++numPolled;
+    }
+}
+
+bool
+MPIPoller::run()
+{
+    if ( numPolled != 0 ) {
+        /* the dispatched receives among them */
+        MPIDispatcher::Instance().poll();
+    }
+
+    int n = (int)requests.size();
+    indices.resize(n);
+    statuses.resize(n);
+
+    int outcount;
+    int r = MPI_Testsome(n, requests.data(), &outcount, indices.data(), statuses.data());
+    if ( r != MPI_SUCCESS && r != MPI_ERR_IN_STATUS ) {
+        /* no telling which ones completed, fail them all */
+        DEBUG_PRINT(DEBUG_WARNING, "MPI_Testsome failed: %d", r);
+        for ( Request *req : waiters ) {
+            req->error = r;
+            TaskPtr ptr = std::move(req->task);
+            resume(std::move(ptr));
+        }
+        requests.clear();
+        waiters.clear();
+        numPolled = 0;
+        return true;
+    }
+    if ( outcount == MPI_UNDEFINED ) {
+        outcount = 0;
+    }
+
+    for ( int i = 0; i < outcount; ++i ) {
+        int idx = indices[i];
+        Request *req = waiters[idx];
+        waiters[idx] = nullptr;
+
+        /* null, or inactive if persistent */
+        req->request = requests[idx];
+        req->status = statuses[i];
+        req->error = r == MPI_ERR_IN_STATUS ? statuses[i].MPI_ERROR : MPI_SUCCESS;
+        /* *req is gone once the task is resumed */
+        TaskPtr ptr = std::move(req->task);
+        resume(std::move(ptr));
+    }
+
+    int completed = outcount;
+    for ( std::size_t i = 0; numPolled != 0 && i < waiters.size(); ++i ) {
+        Request *req = waiters[i];
+        int flag;
+        if ( !req || !req->polled
+                || ((req->error = req->test(&flag)) == MPI_SUCCESS && !flag) ) {
+            continue;
+        }
+        waiters[i] = nullptr;
+        --numPolled;
+        ++completed;
+        TaskPtr ptr = std::move(req->task);
+        resume(std::move(ptr));
+    }
+    if ( completed == 0 ) {
+        return false;
+    }
+
+    /* drop the completed ones, in one pass */
+    std::size_t kept = 0;
+    for ( std::size_t i = 0; i < waiters.size(); ++i ) {
+        if ( waiters[i] ) {
+            requests[kept] = requests[i];
+            waiters[kept] = waiters[i];
+            ++kept;
+        }
+    }
+    requests.resize(kept);
+    waiters.resize(kept);
+    return true;
+}
+
+void
+MPIProgressThread::add(MPIPoller::Request *req)
+{
+    std::call_once(started, [this] () {
+        thread = std::thread([this] () { run(); });
+    });
+    {
+        std::lock_guard<std::mutex> _(mut_);
+        incoming.push_back(req);
+    }
+    cond_.notify_one();
+}
+
+void
+MPIProgressThread::stop()
+{
+    {
+        std::lock_guard<std::mutex> _(mut_);
+        stopping = true;
+    }
+    cond_.notify_one();
+    if ( thread.joinable() ) {
+        thread.join();
+    }
+}
+
+void
+MPIProgressThread::run()
+{
+    std::vector<MPIPoller::Request*> taken;
+    for ( ;; ) {
+        {
+            std::unique_lock<std::mutex> lock(mut_);
+            if ( !poller.busy() ) {
+                cond_.wait(lock, [this] () { return stopping || !incoming.empty(); });
+            }
+            if ( stopping ) {
+                return;
+            }
+            taken.swap(incoming);
+        }
+        for ( MPIPoller::Request *req : taken ) {
+            poller.add(req);
+        }
+        taken.clear();
+
+        if ( !poller.run() ) {
+            std::this_thread::yield();
+        }
+    }
+}
@@ -0,0 +1,164 @@
+#ifndef _MPIPOLLER_HH_
+#define _MPIPOLLER_HH_
+
+#include "util.hh"
+#include "Waitable.hh"
+#include "Task.hh"
+
+#include <mpi.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/* The MPI requests the tasks of a worker are parked on, MPIBlocked.
+ *
+ * A task parks on a Request; its parking hook adds the MPI_Request
+ * to the MPIPoller of the worker it switched out on. run() tests all
+ * of them in one MPI_Testsome() and resumes only the tasks whose
+ * requests completed, instead of resuming every task for its own
+ * MPI_Test(). Only its PerThreadMgr touches it, without a lock; the
+ * workers call MPI concurrently, which takes MPI_THREAD_MULTIPLE.
+ *
+ * The MPI calls themselves run in the parking hook too, on the
+ * worker's stack: they need more than a task stack has.
+ *
+ * When a worker polls is up to Config::mpi_progress. With
+ * MPIProgress::Thread the requests go to the MPIPoller of the
+ * MPIProgressThread instead, the workers never test them.
+ */
+class MPIPoller : public NonCopyable {
+public:
+    /* a pending request, on the stack of the task parked on it */
+    class Request : public Waitable {
+    public:
+        explicit Request(MPI_Request request = MPI_REQUEST_NULL)
+            : request(request)
+        {}
+
+        /* park the current task until the request completes: the
+         * error code, status filled unless MPI_STATUS_IGNORE */
+        int park(MPI_Status *status);
+
+        bool resumeIfNothingToWait(TaskPtr &ptr) override;
+
+        /* null once completed, or inactive if persistent */
+        MPI_Request request;
+    protected:
+        /* start the nonblocking call setting request, if any */
+        virtual int start() {
+            return MPI_SUCCESS;
+        }
+        /* for what MPI_Testsome() cannot test, see polled */
+        virtual int test(int *flag) {
+            return MPI_Test(&request, flag, &status);
+        }
+
+        /* tested by test() at each run(), request stays null */
+        bool        polled = false;
+        MPI_Status  status;
+    private:
+        friend class MPIPoller;
+
+        int         error = MPI_SUCCESS;
+        TaskPtr     task;
+    };
+
+    /* MPI_Wait() parking the current task instead of blocking its
+     * worker; a plain MPI_Wait() outside non-pure tasks */
+    static int wait(MPI_Request *request, MPI_Status *status);
+
+    /* start(&request) a nonblocking call, then wait() for it */
+    template<class Start>
+    static int call(Start const &start, MPI_Status *status);
+
+    /* MPI_Probe(), the same way; MPI_Iprobe() at each run() */
+    static int probe(int source, int tag, MPI_Comm comm, MPI_Status *status);
+
+    /* in the current non-pure task: the calls above park it */
+    static bool parkable();
+
+    /* test all the requests, resume the tasks of the completed ones,
+     * true if any did complete */
+    bool run();
+
+    bool busy() const {
+        return !requests.empty();
+    }
+private:
+    friend class MPIProgressThread;
+
+    template<class Start>
+    class Call;
+    class Probe;
+
+    void add(Request *req);
+
+    /* side by side, as MPI_Testsome() takes them */
+    std::vector<MPI_Request>    requests;
+    std::vector<Request*>       waiters;
+    /* waiters that are polled */
+    int                         numPolled = 0;
+
+    /* MPI_Testsome() output, kept for the next rounds */
+    std::vector<int>            indices;
+    std::vector<MPI_Status>     statuses;
+};
+
+template<class Start>
+class MPIPoller::Call : public MPIPoller::Request {
+public:
+    explicit Call(Start const &start)
+        : start_(start)
+    {}
+protected:
+    int start() override {
+        return start_(&request);
+    }
+private:
+    Start const &start_;
+};
+
+template<class Start>
+int
+MPIPoller::call(Start const &start, MPI_Status *status)
+{
+    if ( !parkable() ) {
+        MPI_Request request;
+        int r = start(&request);
+        return r != MPI_SUCCESS ? r : MPI_Wait(&request, status);
+    }
+    return Call<Start>(start).park(status);
+}
+
+/* The thread testing all MPI requests with MPIProgress::Thread: it
+ * spins over MPI_Testsome() while any is pending, and waits for the
+ * next one otherwise. Started at the first request, stopped at the
+ * end of co_mainloop(), before MPI_Finalize(). */
+class MPIProgressThread : public Singleton {
+public:
+    /* from the parking hooks of all workers */
+    void add(MPIPoller::Request *req);
+    void stop();
+
+    static MPIProgressThread &Instance() {
+        static MPIProgressThread t;
+        return t;
+    }
+private:
+    void run();
+
+    std::mutex                          mut_;
+    std::condition_variable             cond_;
+    std::vector<MPIPoller::Request*>    incoming;
+    bool                                stopping = false;
+    std::once_flag                      started;
+    std::thread                         thread;
+
+    /* only touched by the thread */
+    MPIPoller                           poller;
+};
+
+#endif /* _MPIPOLLER_HH_ */
@@ -0,0 +1,282 @@
+#include "MPIStealer.hh"
+#include "MPIPoller.hh"
+#include "GlobalMediator.hh"
+#include "Task.hh"
+#include "co_chan.hh"
+#include "Config.hh"
+#include "debug.hh"
+
+#include <cstring>
+#include <utility>
+
+int
+MPIStealer::registe(Function fn)
+{
+    functions.push_back(fn);
+    return (int)functions.size() - 1;
+}
+
+void
+MPIStealer::spawn(int fn, std::string args)
+{
+    std::lock_guard<std::mutex> _(mut_);
+    pool.push_back(Descriptor{fn, std::move(args)});
+}
+
+void
+MPIStealer::run(MPI_Comm c)
+{
+    MPIPoller::call([&] (MPI_Request *request) {
+                MPI_Comm_rank(c, &me);
+                MPI_Comm_size(c, &size);
+                return MPI_Comm_idup(c, &comm, request);
+            }, MPI_STATUS_IGNORE);
+
+    random.seed(me + 1);
+    numExecuted = 0;
+    numStolen = 0;
+    stealing = false;
+    backoff = 0;
+    nextSteal = Clock::now();
+    haveToken = me == 0;
+    tokenBlack = black = roundOver = false;
+    done = draining = finished = false;
+
+    while ( !finished ) {
+        bool launched = launch();
+        bool got = false;
+        MPIPoller::call([&] (MPI_Request *request) {
+                    *request = MPI_REQUEST_NULL;
+                    got = step();
+                    return MPI_SUCCESS;
+                }, MPI_STATUS_IGNORE);
+        if ( !launched && !got && !finished ) {
+            co_sleep_for(std::chrono::microseconds(idle_sleep_us));
+        }
+    }
+
+    MPIPoller::call([&] (MPI_Request *request) {
+                *request = MPI_REQUEST_NULL;
+                return MPI_Comm_free(&comm);
+            }, MPI_STATUS_IGNORE);
+}
+
+bool
+MPIStealer::launch()
+{
+    long limit = running_per_worker * Config::Instance().num_of_threads;
+    bool any = false;
+    while ( numRunning.load(std::memory_order_relaxed) < limit ) {
+        Descriptor d;
+        {
+            std::lock_guard<std::mutex> _(mut_);
+            if ( pool.empty() ) {
+                break;
+            }
+            /* the newest first, the oldest are for thieves */
+            d = std::move(pool.back());
+            pool.pop_back();
+        }
+        if ( d.fn < 0 || d.fn >= (int)functions.size() ) {
+            DEBUG_PRINT(DEBUG_WARNING, "no function %d registered", d.fn);
+            continue;
+        }
+        numRunning.fetch_add(1, std::memory_order_relaxed);
+        /* only the runnable_queue holds it */
+        Task *task = new Task([this, d] () {
+                    functions[d.fn](d.args);
+                    numExecuted.fetch_add(1, std::memory_order_relaxed);
+                    /* after its spawns, see passive() */
+                    numRunning.fetch_sub(1, std::memory_order_release);
+                });
+        task->inheritCancelToken();
+        TaskPtr::presetCount(task, 1);
+        globalMediator.addRunnable(TaskPtr::adopt(task));
+        any = true;
+    }
+    return any;
+}
+
+bool
+MPIStealer::passive()
+{
+    if ( stealing || numRunning.load(std::memory_order_acquire) != 0 ) {
+        return false;
+    }
+    std::lock_guard<std::mutex> _(mut_);
+    return pool.empty();
+}
+
+bool
+MPIStealer::step()
+{
+    testSends();
+
+    bool got = false;
+    for ( ;; ) {
+        int flag, bytes;
+        MPI_Status st;
+        if ( MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &flag, &st) != MPI_SUCCESS || !flag ) {
+            break;
+        }
+        /* the driver is the only one receiving on comm */
+        MPI_Get_count(&st, MPI_BYTE, &bytes);
+        received.resize(bytes);
+        MPI_Recv(received.data(), bytes, MPI_BYTE, st.MPI_SOURCE, st.MPI_TAG, comm, MPI_STATUS_IGNORE);
+        handle(st.MPI_SOURCE, st.MPI_TAG, received.data(), bytes);
+        got = true;
+    }
+
+    if ( done ) {
+        /* no request of ours pending once in the barrier */
+        if ( !draining && !stealing ) {
+            MPI_Ibarrier(comm, &barrier);
+            draining = true;
+        }
+        if ( draining ) {
+            int flag;
+            MPI_Test(&barrier, &flag, MPI_STATUS_IGNORE);
+            finished = flag && sends.empty();
+        }
+        return got;
+    }
+
+    if ( size > 1 && passive() && Clock::now() >= nextSteal ) {
+        int victim = (int)(random() % (size - 1));
+        if ( victim >= me ) {
+            ++victim;
+        }
+        send(victim, tag_request, std::string());
+        stealing = true;
+    }
+    if ( haveToken && passive() ) {
+        passToken();
+    }
+    return got;
+}
+
+void
+MPIStealer::handle(int source, int tag, char *data, int bytes)
+{
+    switch ( tag ) {
+    case tag_request:
+        reply(source);
+        break;
+    case tag_reply: {
+        int n = 0;
+        std::lock_guard<std::mutex> _(mut_);
+        for ( int at = 0; at + 2 * (int)sizeof(int) <= bytes; ++n ) {
+            Descriptor d;
+            int len;
+            memcpy(&d.fn, data + at, sizeof(int));
+            memcpy(&len, data + at + sizeof(int), sizeof(int));
+            at += 2 * sizeof(int);
+            d.args.assign(data + at, len);
+            at += len;
+            pool.push_back(std::move(d));
+        }
+        stealing = false;
+        numStolen += n;
+        if ( n != 0 ) {
+            backoff = 0;
+        } else {
+            backoff = backoff == 0 ? min_backoff_us : std::min(2 * backoff, max_backoff_us);
+        }
+        nextSteal = Clock::now() + std::chrono::microseconds(backoff);
+        break;
+    }
+    case tag_token: {
+        int color = 0;
+        memcpy(&color, data, std::min(bytes, (int)sizeof(int)));
+        haveToken = true;
+        tokenBlack = color != 0;
+        roundOver = me == 0;
+        break;
+    }
+    case tag_done:
+        done = true;
+        break;
+    default:
+        DEBUG_PRINT(DEBUG_WARNING, "unknown tag %d from %d", tag, source);
+    }
+}
+
+void
+MPIStealer::reply(int thief)
+{
+    std::string data;
+    std::size_t n = 0;
+    if ( !done ) {
+        std::lock_guard<std::mutex> _(mut_);
+        /* the oldest half, rounded up: what launch() left */
+        n = (pool.size() + 1) / 2;
+        for ( std::size_t i = 0; i < n; ++i ) {
+            Descriptor &d = pool.front();
+            int len = (int)d.args.size();
+            data.append((char const*)&d.fn, sizeof(int));
+            data.append((char const*)&len, sizeof(int));
+            data.append(d.args);
+            pool.pop_front();
+        }
+    }
+    if ( n != 0 ) {
+        black = true;
+    }
+    send(thief, tag_reply, data);
+}
+
+void
+MPIStealer::passToken()
+{
+    haveToken = false;
+    if ( me == 0 ) {
+        if ( size == 1 || (roundOver && !tokenBlack && !black) ) {
+            done = true;
+            for ( int r = 1; r < size; ++r ) {
+                send(r, tag_done, std::string());
+            }
+            return;
+        }
+        /* another round */
+        roundOver = false;
+        black = false;
+        int white = 0;
+        send(1, tag_token, std::string((char const*)&white, sizeof(white)));
+        return;
+    }
+    int color = tokenBlack || black;
+    black = false;
+    send((me + 1) % size, tag_token, std::string((char const*)&color, sizeof(color)));
+}
+
+void
+MPIStealer::send(int dest, int tag, std::string const &data)
+{
+    Outgoing o;
+    o.buffer.reset(new char[data.size() + 1]);
+    memcpy(o.buffer.get(), data.data(), data.size());
+    int r = MPI_Isend(o.buffer.get(), (int)data.size(), MPI_BYTE, dest, tag, comm, &o.request);
+    if ( r != MPI_SUCCESS ) {
+        DEBUG_PRINT(DEBUG_WARNING, "MPI_Isend to %d failed: %d", dest, r);
+        return;
+    }
+    sends.push_back(std::move(o));
+}
+
+void
+MPIStealer::testSends()
+{
+    std::size_t kept = 0;
+    for ( std::size_t i = 0; i < sends.size(); ++i ) {
+        int flag;
+        MPI_Test(&sends[i].request, &flag, MPI_STATUS_IGNORE);
+        if ( flag ) {
+            continue;
+        }
+        if ( kept != i ) {
+            sends[kept] = std::move(sends[i]);
+        }
+        ++kept;
+    }
+    sends.resize(kept);
+}
@@ -0,0 +1,146 @@
+#ifndef _MPISTEALER_HH_
+#define _MPISTEALER_HH_
+
+#include "util.hh"
+
+#include <mpi.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+/* Work stealing across the ranks of a communicator.
+ *
+ * The tasks to share are descriptors, a registered function and its
+ * arguments as bytes: spawn() queues one in the pool of the rank. Inside
+ * run(), a driver task of each rank starts the newest descriptors of
+ * its pool as tasks, a few per worker, and serves the steal requests of
+ * the other ranks with the oldest half of its pool. A rank with nothing
+ * to run sends a steal request to a random rank, one at a time.
+ *
+ * Termination is detected by Dijkstra's token ring: rank 0 sends a
+ * token around once it has nothing to do, each rank passes it on once
+ * it has nothing to do either, and any rank that gave work away since
+ * the token last passed blackens it. A white token back at a white
+ * idle rank 0 means no work is left anywhere, and rank 0 tells them
+ * all. They then answer the steal requests still on their way until
+ * an MPI_Ibarrier() completes.
+ *
+ * The same functions must be registered in the same order on all ranks,
+ * before run(). The MPI calls are made from the driver's parking hook,
+ * on the worker's stack.
+ */
+class MPIStealer : public Singleton {
+public:
+    using Function = void (*)(std::string const &args);
+
+    /* its id, the same on all ranks */
+    int registe(Function fn);
+
+    /* queue fn(args), here or on whichever rank steals it */
+    void spawn(int fn, std::string args);
+
+    /* collective over comm, from a task: run the descriptors spawned
+     * on all ranks and by them, until there are none left anywhere */
+    void run(MPI_Comm comm);
+
+    /* descriptors run by this rank, and taken from others, in run() */
+    long executed() const {
+        return numExecuted.load(std::memory_order_relaxed);
+    }
+    long stolen() const {
+        return numStolen;
+    }
+
+    static MPIStealer &Instance() {
+        static MPIStealer s;
+        return s;
+    }
+private:
+    struct Descriptor {
+        int             fn;
+        std::string     args;
+    };
+
+    enum {
+        /* empty */
+        tag_request = 1,
+        /* descriptors, none if the victim had none to spare */
+        tag_reply,
+        /* an int, nonzero if black */
+        tag_token,
+        /* empty, from rank 0 */
+        tag_done,
+    };
+
+    /* a send in flight, its buffer kept until it completes */
+    struct Outgoing {
+        MPI_Request             request;
+        std::unique_ptr<char[]> buffer;
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    /* descriptors started per worker, the others can be stolen */
+    static constexpr int running_per_worker = 2;
+    /* between steal requests coming back empty, doubling */
+    static constexpr int min_backoff_us = 50;
+    static constexpr int max_backoff_us = 2000;
+    /* the driver sleeps that long after a round with nothing new */
+    static constexpr int idle_sleep_us = 20;
+
+    /* start descriptors as tasks, true if any */
+    bool launch();
+
+    /* one round of MPI on the worker's stack, true if anything came */
+    bool step();
+    void handle(int source, int tag, char *data, int bytes);
+    void reply(int thief);
+    void passToken();
+    void send(int dest, int tag, std::string const &data);
+    void testSends();
+
+    /* nothing to run, nothing running, no steal request pending */
+    bool passive();
+
+    std::vector<Function>   functions;
+
+    std::mutex              mut_;
+    std::deque<Descriptor>  pool;
+    std::atomic<long>       numRunning = {0};
+    std::atomic<long>       numExecuted = {0};
+
+    /* only touched by the driver */
+    MPI_Comm                comm = MPI_COMM_NULL;
+    int                     me = 0;
+    int                     size = 1;
+    std::minstd_rand        random;
+    std::vector<Outgoing>   sends;
+    std::vector<char>       received;
+    long                    numStolen = 0;
+
+    bool                    stealing = false;
+    int                     backoff = 0;
+    Clock::time_point       nextSteal;
+
+    bool                    haveToken = false;
+    bool                    tokenBlack = false;
+    /* gave work away since the token last passed */
+    bool                    black = false;
+    /* rank 0: a token came back, a round is over */
+    bool                    roundOver = false;
+
+    /* told by rank 0, then answering the late steal requests until
+     * the barrier completes */
+    bool                    done = false;
+    bool                    draining = false;
+    bool                    finished = false;
+    MPI_Request             barrier = MPI_REQUEST_NULL;
+};
+
+#endif /* _MPISTEALER_HH_ */
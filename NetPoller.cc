@@ -0,0 +1,343 @@
+#include "NetPoller.hh"
+#include "GlobalMediator.hh"
+#include "Task.hh"
+#include "Spinlock.hh"
+#include "Waitable.hh"
+#include "debug.hh"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <utility>
+
+struct NetPoller::PollDesc {
+    /* one direction of the fd, parked on by IOBlocked tasks */
+    struct Half : public Waitable {
+        bool resumeIfNothingToWait(TaskPtr &ptr) override {
+            std::lock_guard<Spinlock> _(pd->mut_);
+            if ( ready ) {
+                ready = false;
+                ptr->state = Task::Runnable;
+                return true;
+            }
+            if ( timer ) {
+                /* fires on this thread, not before this hook returns */
+                globalMediator.getThisPerThreadMgr()->addTimer(TimerPtr(timer));
+            }
+            waiter = std::move(ptr);
+            return false;
+        }
+
+        /* under pd->mut_ */
+        void notify(TaskPtr &toWake) {
+            if ( waiter ) {
+                toWake = std::move(waiter);
+            } else {
+                ready = true;
+            }
+        }
+
+        PollDesc    *pd;
+        bool        ready = false;
+        /* a task is in wait(), parked or about to */
+        bool        claimed = false;
+        TaskPtr     waiter;
+        /* of the waiter in wait_until(), set before it parks */
+        TimerPtr    timer;
+    };
+
+    PollDesc() {
+        halves[Read].pd = this;
+        halves[Write].pd = this;
+    }
+
+    /* guards everything below */
+    Spinlock    mut_;
+    bool        registered = false;
+    Half        halves[2];
+};
+
+void
+NetPoller::init()
+{
+    int fd = epoll_create1(EPOLL_CLOEXEC);
+    MUST_TRUE(fd >= 0, "epoll_create1 failed: %d", errno);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    MUST_TRUE(wakeFd >= 0, "eventfd failed: %d", errno);
+
+    /* data.ptr == nullptr tells the eventfd apart */
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = nullptr;
+    if ( epoll_ctl(fd, EPOLL_CTL_ADD, wakeFd, &ev) != 0 ) {
+        DEBUG_PRINT(DEBUG_WARNING, "epoll_ctl of the eventfd failed: %d", errno);
+    }
+    epfd.store(fd, std::memory_order_release);
+}
+
+NetPoller::PollDesc*
+NetPoller::desc(int fd)
+{
+    MUST_TRUE(fd >= 0 && fd < max_fd, "fd %d out of the NetPoller range", fd);
+    std::atomic<PollDesc*> &slot = chunks[fd >> chunk_bits];
+    PollDesc *chunk = slot.load(std::memory_order_acquire);
+    if ( !chunk ) {
+        PollDesc *fresh = new PollDesc[chunk_size];
+        if ( slot.compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel) ) {
+            chunk = fresh;
+        } else {
+            delete[] fresh;
+        }
+    }
+    return &chunk[fd & (chunk_size - 1)];
+}
+
+class NetPoller::WaitTimer : public Timer {
+public:
+    WaitTimer(PollDesc::Half *half, clock::time_point deadline)
+        : Timer(deadline)
+        , half(half)
+    {}
+
+    bool timedOut = false;
+protected:
+    void fire() override {
+        TaskPtr ptr;
+        {
+            std::lock_guard<Spinlock> _(half->pd->mut_);
+            /* otherwise an event has taken the waiter */
+            if ( half->timer.get() == this ) {
+                ptr = std::move(half->waiter);
+            }
+        }
+        if ( ptr ) {
+            timedOut = true;
+            globalMediator.wakeUp(std::move(ptr));
+        }
+    }
+private:
+    PollDesc::Half  *half;
+};
+
+bool
+NetPoller::registe(PollDesc *pd, int fd, Direction d)
+{
+    /* held across epoll_ctl(): close() does not slip in between */
+    std::lock_guard<Spinlock> _(pd->mut_);
+    int op = EPOLL_CTL_ADD;
+    if ( pd->registered ) {
+        /* the wait returns without parking */
+        if ( pd->halves[d].ready ) {
+            return true;
+        }
+        op = EPOLL_CTL_MOD;
+    }
+
+    /* edge-triggered: an fd ready already reports it right away */
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = pd;
+    int ep = epfd.load(std::memory_order_relaxed);
+    int r = epoll_ctl(ep, op, fd, &ev);
+    if ( r != 0 && op == EPOLL_CTL_MOD && errno == ENOENT ) {
+        /* closed without close() here, its number taken again since */
+        r = epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+    }
+    if ( r != 0 ) {
+        DEBUG_PRINT(DEBUG_WARNING, "epoll_ctl on fd %d failed: %d", fd, errno);
+        pd->registered = false;
+        return false;
+    }
+    if ( !pd->registered ) {
+        /* flags left by a closed fd of the same number */
+        pd->registered = true;
+        pd->halves[Read].ready = false;
+        pd->halves[Write].ready = false;
+    }
+    return true;
+}
+
+int
+NetPoller::wait(int fd, Direction d)
+{
+    return park(fd, d, nullptr);
+}
+
+int
+NetPoller::wait_until(int fd, Direction d, Timer::clock::time_point deadline)
+{
+    return park(fd, d, &deadline);
+}
+
+int
+NetPoller::park(int fd, Direction d, Timer::clock::time_point const *deadline)
+{
+    if ( fd < 0 ) {
+        return EBADF;
+    }
+    if ( fd >= max_fd ) {
+        return blockingWait(fd, d, deadline);
+    }
+    std::call_once(inited, [this] () { init(); });
+    PollDesc *pd = desc(fd);
+    /* not pollable: let the caller retry, and see the error */
+    if ( !registe(pd, fd, d) ) {
+        return 0;
+    }
+
+    PollDesc::Half &half = pd->halves[d];
+    DerivedRefPtr<WaitTimer> timer;
+    {
+        std::lock_guard<Spinlock> _(pd->mut_);
+        if ( half.claimed ) {
+            return EBUSY;
+        }
+        half.claimed = true;
+        if ( deadline ) {
+            timer = DerivedRefPtr<WaitTimer>(new WaitTimer(&half, *deadline));
+            half.timer = TimerPtr(timer.get());
+        }
+    }
+    co_currentTask->parkOn(&half, Task::IOBlocked);
+    {
+        std::lock_guard<Spinlock> _(pd->mut_);
+        half.claimed = false;
+        half.timer = nullptr;
+    }
+    if ( !timer ) {
+        return 0;
+    }
+    /* fire() touches the half, wait until it cannot */
+    timer->cancel();
+    return timer->timedOut ? ETIMEDOUT : 0;
+}
+
+int
+NetPoller::blockingWait(int fd, Direction d, Timer::clock::time_point const *deadline)
+{
+    struct pollfd p = {fd, static_cast<short>(d == Read ? POLLIN : POLLOUT), 0};
+    struct timespec ts;
+    if ( deadline ) {
+        Timer::clock::duration left = std::max(*deadline - Timer::clock::now(),
+                Timer::clock::duration::zero());
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+        ts.tv_sec = ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+    }
+    /* EINTR is a spurious wakeup */
+    if ( ppoll(&p, 1, deadline ? &ts : nullptr, nullptr) == 0 ) {
+        return ETIMEDOUT;
+    }
+    return 0;
+}
+
+int
+NetPoller::close(int fd)
+{
+    if ( !active() || fd < 0 || fd >= max_fd ||
+            !chunks[fd >> chunk_bits].load(std::memory_order_acquire) ) {
+        return (int)syscall(SYS_close, fd);
+    }
+    PollDesc *pd = desc(fd);
+    TaskPtr toWake[2];
+    int r, err;
+    {
+        std::lock_guard<Spinlock> _(pd->mut_);
+        if ( pd->registered ) {
+            pd->registered = false;
+            epoll_ctl(epfd.load(std::memory_order_relaxed), EPOLL_CTL_DEL, fd, nullptr);
+            /* ready, for a task about to park: its retry fails too */
+            for ( int d = Read; d <= Write; ++d ) {
+                pd->halves[d].notify(toWake[d]);
+            }
+        }
+        /* under mut_: a woken task retrying cannot register the fd
+         * again before it is closed */
+        r = (int)syscall(SYS_close, fd);
+        err = errno;
+    }
+    /* their syscalls fail on the closed fd */
+    for ( TaskPtr &ptr : toWake ) {
+        if ( !ptr ) {
+            continue;
+        }
+        /* close() may come from any thread */
+        if ( GlobalMediator::thread_id >= 0 ) {
+            globalMediator.wakeUp(std::move(ptr));
+        } else {
+            globalMediator.wakeUpForeign(std::move(ptr));
+        }
+    }
+    errno = err;
+    return r;
+}
+
+bool
+NetPoller::pollFor(int timeoutMs)
+{
+    constexpr int max_events = 128;
+    struct epoll_event events[max_events];
+    int n = epoll_wait(epfd.load(std::memory_order_relaxed), events, max_events, timeoutMs);
+
+    bool woken = false;
+    for ( int i = 0; i < n; ++i ) {
+        PollDesc *pd = static_cast<PollDesc*>(events[i].data.ptr);
+        if ( !pd ) {
+            uint64_t count;
+            while ( read(wakeFd, &count, sizeof(count)) > 0 )
+                ;
+            continue;
+        }
+
+        uint32_t e = events[i].events;
+        TaskPtr toWake[2];
+        {
+            std::lock_guard<Spinlock> _(pd->mut_);
+            if ( e & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR) ) {
+                pd->halves[Read].notify(toWake[Read]);
+            }
+            if ( e & (EPOLLOUT | EPOLLHUP | EPOLLERR) ) {
+                pd->halves[Write].notify(toWake[Write]);
+            }
+        }
+        for ( TaskPtr &ptr : toWake ) {
+            if ( ptr ) {
+                globalMediator.wakeUp(std::move(ptr));
+                woken = true;
+            }
+        }
+    }
+    return woken;
+}
+
+bool
+NetPoller::tryBlockingPoll(Timer::clock::duration timeout)
+{
+    if ( !active() || blocking.exchange(true, std::memory_order_acquire) ) {
+        return false;
+    }
+    /* round up, not to spin on a timer due within the millisecond */
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            timeout + std::chrono::milliseconds(1) - Timer::clock::duration(1));
+    pollFor(static_cast<int>(ms.count()));
+    blocking.store(false, std::memory_order_release);
+    return true;
+}
+
+void
+NetPoller::interrupt()
+{
+    if ( blocking.load(std::memory_order_acquire) ) {
+        uint64_t one = 1;
+        ssize_t r = write(wakeFd, &one, sizeof(one));
+        (void)r;
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef _NETPOLLER_HH_
+#define _NETPOLLER_HH_
+
+#include "util.hh"
+#include "Timer.hh"
+
+#include <atomic>
+#include <mutex>
+
+#define netPoller   NetPoller::Instance()
+
+/* Readiness of the fds tasks do I/O on, through one epoll instance
+ * shared by all workers; see co_net.hh for the calls using it.
+ *
+ * An fd is added at its first wait, edge-triggered for both
+ * directions, and stays until close(). A wait about to park re-arms
+ * it with EPOLL_CTL_MOD, adding it back if a plain close(2) dropped it
+ * from epoll: close() here is for waking the waiters of the fd, a new
+ * fd of the same number is polled anyway. Each direction keeps a ready
+ * flag and at most one task, IOBlocked: an event wakes the task, or
+ * sets the flag for the next wait to consume; a second task waiting
+ * on it gets EBUSY. A woken task retries its syscall and waits again
+ * on EAGAIN, spurious wakeups are fine. A wait_until() arms a Timer
+ * taking the task back out of its half. The fds past the ones
+ * tracked block the worker in ppoll(), as the plain syscall would.
+ *
+ * Workers poll without blocking before they steal, and now and then
+ * while their runnable queue keeps them busy. One idle worker
+ * at a time blocks in epoll_wait() instead of the condition
+ * variable, addRunnable() interrupts it through an eventfd.
+ */
+class NetPoller : public Singleton {
+public:
+    enum Direction {
+        Read,
+        Write,
+    };
+
+    /* park the current task until fd may be ready for d: 0, or
+     * EBUSY if another task waits on it, EBADF for a negative fd */
+    int wait(int fd, Direction d);
+    /* wait(), ETIMEDOUT once the deadline has passed */
+    int wait_until(int fd, Direction d, Timer::clock::time_point deadline);
+    /* close(2) fd, waking the tasks waiting on it, whose retries
+     * fail with EBADF; from any thread */
+    int close(int fd);
+
+    /* resume the tasks whose fds got ready, true if any */
+    bool poll() {
+        return active() && pollFor(0);
+    }
+    /* poll() blocking up to timeout, false right away
+     * if another worker is blocked in it */
+    bool tryBlockingPoll(Timer::clock::duration timeout);
+    /* return from the blocking poll, if a worker is in it */
+    void interrupt();
+
+    /* no epoll instance before the first wait() */
+    bool active() const {
+        return epfd.load(std::memory_order_acquire) >= 0;
+    }
+
+    static NetPoller &Instance() {
+        static NetPoller p;
+        return p;
+    }
+private:
+    struct PollDesc;
+    class WaitTimer;
+
+    static constexpr int chunk_bits = 10;
+    static constexpr int chunk_size = 1 << chunk_bits;
+    static constexpr int num_chunks = 1 << 10;
+    static constexpr int max_fd = chunk_size * num_chunks;
+
+    /* descriptors are never freed, a late event finds a stale one;
+     * fd within [0, max_fd) */
+    PollDesc *desc(int fd);
+    int park(int fd, Direction d, Timer::clock::time_point const *deadline);
+    int blockingWait(int fd, Direction d, Timer::clock::time_point const *deadline);
+    /* in epoll before a wait on d parks, false if fd cannot be polled */
+    bool registe(PollDesc *pd, int fd, Direction d);
+    bool pollFor(int timeoutMs);
+    void init();
+
+    std::atomic<int>            epfd = {-1};
+    int                         wakeFd = -1;
+    std::once_flag              inited;
+    std::atomic<bool>           blocking = {false};
+    std::atomic<PollDesc*>      chunks[num_chunks] = {};
+};
+
+#endif /* _NETPOLLER_HH_ */
@@ -4,13 +4,17 @@
 #include "debug.hh"
 #include "util.hh"
 #include "Spinlock.hh"
+#include "HugePageArena.hh"
 
 #include <new>
+#include <cstdlib>
 #include <memory>
 #include <array>
 #include <vector>
 #include <mutex>
 #include <thread>
+#include <chrono>
+#include <condition_variable>
 
 //#define ENABLE_DEBUG_LOCAL
 #include "debug_local_begin.hh"
@@ -26,7 +30,8 @@
 
 template<class T>
 struct FakeT_ {
-    char fake_[sizeof(T)];
+    /* keep over-aligned T (e.g. cache line aligned Task) aligned */
+    alignas(T) char fake_[sizeof(T)];
 
     /* leading 16 bits: id_of_creation_pool, last 16 bits: layer */
     unsigned combined_info;
@@ -69,13 +74,33 @@ public:
         StillInUseAfter,
     };
 
-    explicit ObjectLayer(std::size_t sz)
-        : arena_cap(sz)
-        , arena(new FakeEntry<T>[sz])
+    explicit ObjectLayer(std::size_t sz, bool use_huge_pages = false)
+        : arena(nullptr)
+        , arena_cap(sz)
         , used(0)
+        , huge(false)
     {
         MUST_TRUE(sz > 0, "ObjectLayer size must >0 ");
 
+        /* FakeEntry<T> is trivial, raw hugepage memory can be used as is */
+        if ( use_huge_pages ) {
+            arena = static_cast<FakeEntry<T>*>(HugePageArena::allocate(sz * sizeof(FakeEntry<T>)));
+            if ( arena ) {
+                /* the region is rounded up to whole hugepages, use all of it */
+                huge = true;
+                sz = arena_cap = HugePageArena::round_up(sz * sizeof(FakeEntry<T>)) / sizeof(FakeEntry<T>);
+            }
+        }
+        if ( !huge ) {
+            /* new[] does not honor over-alignment before C++17 */
+            void *p;
+            if ( posix_memalign(&p, alignof(FakeEntry<T>) < sizeof(void*) ? sizeof(void*) : alignof(FakeEntry<T>),
+                        sz * sizeof(FakeEntry<T>)) != 0 ) {
+                throw std::bad_alloc();
+            }
+            arena = static_cast<FakeEntry<T>*>(p);
+        }
+
         head = arena;
         for ( std::size_t i = 0; i < sz - 1; i++ ) {
             arena[i].next = &arena[i+1];
@@ -84,7 +109,12 @@ public:
     }
 
     ~ObjectLayer() {
-        delete[] arena;
+        if ( huge ) {
+            /* arena_cap * sizeof(FakeEntry<T>) rounds up to the same mapping */
+            HugePageArena::deallocate(arena, arena_cap * sizeof(FakeEntry<T>));
+        } else {
+            free(arena);
+        }
     }
 
     FakeEntry<T> *my_alloc() {
@@ -139,6 +169,9 @@ private:
     /* in number-of-object, NOT byte */
     std::size_t     arena_cap;
     std::size_t     used;
+
+    /* arena comes from HugePageArena rather than the heap */
+    bool            huge;
 };
 
 struct ObjectPoolConfig {
@@ -148,6 +181,9 @@ struct ObjectPoolConfig {
     int max_total_cached = 1024;
     int cache_reclaim_period = 0;
 
+    /* back layers big enough with 2MB pages, see HugePageArena */
+    bool use_huge_pages = false;
+
     ObjectPoolConfig &set_num_of_thread(int p) {
         num_of_thread = p;
         return *this;
@@ -172,6 +208,11 @@ struct ObjectPoolConfig {
         cache_reclaim_period = p;
         return *this;
     }
+
+    ObjectPoolConfig &set_use_huge_pages(bool p) {
+        use_huge_pages = p;
+        return *this;
+    }
 };
 
 template<class T, class LockType>
@@ -187,9 +228,10 @@ public:
         , num_of_thread(config.num_of_thread)
         , pool_init_size(config.pool_init_size)
         , enlarge_rate(config.enlarge_rate)
+        , use_huge_pages(config.use_huge_pages)
         , max_total_cached(config.max_total_cached)
     {
-        layers[0] = std::make_unique<ObjectLayer<T>>(pool_init_size);
+        layers[0] = std::make_unique<ObjectLayer<T>>(pool_init_size, layer_wants_huge_pages(pool_init_size));
         caches.resize(num_of_thread);
     }
 
@@ -208,7 +250,8 @@ public:
         MUST_TRUE(current_layer + 1 < layers.size(),
                 "ObjectPool %d exceeds its maximal layer: %lu", id, layers.size());
         current_size *= enlarge_rate;
-        layers[++current_layer] = std::make_unique<ObjectLayer<T>>(current_size);
+        layers[++current_layer] = std::make_unique<ObjectLayer<T>>(current_size,
+                layer_wants_huge_pages(current_size));
 
         res = layers[current_layer]->my_alloc();
         set_id_and_layer(res->fakeT_, id, current_layer);
@@ -236,6 +279,12 @@ public:
         }
     }
 private:
+    /* small layers would waste most of a 2MB page */
+    bool layer_wants_huge_pages(std::size_t nobjs) const {
+        return use_huge_pages &&
+            nobjs * sizeof(FakeEntry<T>) >= HugePageArena::huge_page_size / 2;
+    }
+
     void remove_layer_if_not_in_use(int layer, int state) {
         if ( state == ObjectLayer<T>::NotInUseAfter && layer > 0 && layer == current_layer ) {
             /* this layer can be freed */
@@ -262,6 +311,7 @@ private:
 
     std::size_t pool_init_size;
     std::size_t enlarge_rate;
+    bool        use_huge_pages;
 
     std::array<std::unique_ptr<ObjectLayer<T>>, NLayers> layers;
     int current_layer = 0;
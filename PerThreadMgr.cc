@@ -2,6 +2,7 @@
 #include "GlobalMediator.hh"
 #include "PerThreadMgr.hh"
 #include "TaskGroup.hh"
+#include "NetPoller.hh"
 #include "debug.hh"
 #include "Config.hh"
 
@@ -15,20 +16,18 @@ PerThreadMgr::handle_after_continuationOut(TaskPtr &ptr)
 {
     switch ( ptr->state ) {
     case Task::Runnable:
-        runnable_queue->enqueue(ptr);
-        break;
-    case Task::MPIBlocked:
-        mpi_blocked_queue.push_back(ptr);
-        DEBUG_PRINT(DEBUG_PerThreadMgr,
-                "PerThreadMgr %d: MPIBlocked got Task %d", debugId, ptr->debugId);
+        runnable_queue->enqueue(std::move(ptr));
         break;
     case Task::GroupWait:
+    case Task::Parked:
+    case Task::IOBlocked:
+    case Task::MPIBlocked:
         DEBUG_PRINT(DEBUG_TaskGroup,
-                "Task %d continuationOut with GroupWait at TaskGroup %d",
-                ptr->debugId, ptr->blockedBy->debugId);
+                "Task %d continuationOut with %s",
+                ptr->debugId, Task::getStateName(ptr->state));
 
         if ( ptr->blockedBy->resumeIfNothingToWait(ptr) ) {
-            runnable_queue->enqueue(ptr);
+            runnable_queue->enqueue(std::move(ptr));
         }
         break;
     default:
@@ -46,14 +45,15 @@ PerThreadMgr::run_runnable()
                 "PerThreadMgr %d: runnable got locally: task %d...", debugId, ptr->debugId);
 
         MUST_TRUE(ptr != nullptr, "PerThreadMgr: %d", debugId);
-        currentTask__ = ptr;
 
-        if ( ptr->isPure ) {
-            ptr->runInStack();
+        /* move the only reference around, no refcount traffic */
+        currentTask__ = std::move(ptr);
+        if ( currentTask__->isPure ) {
+            currentTask__->runInStack();
         } else {
-            ptr->continuationIn();
+            currentTask__->continuationIn();
         }
-        currentTask__ = nullptr;
+        ptr = std::move(currentTask__);
         handle_after_continuationOut(ptr);
 
         return true;
@@ -64,35 +64,105 @@ PerThreadMgr::run_runnable()
     }
 }
 
+static bool
+laterDeadline(TimerPtr const &a, TimerPtr const &b)
+{
+    return a->deadline > b->deadline;
+}
+
+void
+PerThreadMgr::addTimer(TimerPtr &&timer)
+{
+    if ( timers.size() >= timersCompactAt ) {
+        compact_timers();
+    }
+    timers.push_back(std::move(timer));
+    std::push_heap(timers.begin(), timers.end(), laterDeadline);
+}
+
+void
+PerThreadMgr::compact_timers()
+{
+    std::size_t kept = 0;
+    for ( std::size_t i = 0; i < timers.size(); ++i ) {
+        if ( timers[i]->cancelled() ) {
+            continue;
+        }
+        if ( kept != i ) {
+            timers[kept] = std::move(timers[i]);
+        }
+        ++kept;
+    }
+    timers.resize(kept);
+    std::make_heap(timers.begin(), timers.end(), laterDeadline);
+    timersCompactAt = 2 * kept > min_timers_compact ? 2 * kept : min_timers_compact;
+}
+
 bool
-PerThreadMgr::run_mpi_blocked()
+PerThreadMgr::run_timers()
 {
-    for ( auto &ptr : mpi_blocked_queue ) {
-        currentTask__ = ptr;
-        ptr->continuationIn();
-        currentTask__ = nullptr;
-
-        if ( ptr->state != Task::MPIBlocked ) {
-            handle_after_continuationOut(ptr);
-            mpi_blocked_queue.erase(std::find(mpi_blocked_queue.begin(), mpi_blocked_queue.end(), ptr));
-            return true;
-        } else {
-            /* still MPIBlocked, note that it might run for a while
-             * and fall into MPIBlocked state once again
-             */
+    bool fired = false;
+    Timer::clock::time_point now = Timer::clock::now();
+    while ( !timers.empty() && timers.front()->deadline <= now ) {
+        std::pop_heap(timers.begin(), timers.end(), laterDeadline);
+        TimerPtr timer = std::move(timers.back());
+        timers.pop_back();
+
+        /* nothing if cancelled meanwhile */
+        timer->run();
+        fired = true;
+    }
+    return fired;
+}
+
+IoRing*
+PerThreadMgr::ioRing()
+{
+    if ( !ioRingTried ) {
+        ioRingTried = true;
+        if ( Config::Instance().use_io_uring ) {
+            ioRing_ = IoRing::create(Config::Instance().io_ring_entries);
         }
     }
-    DEBUG_PRINT(DEBUG_PerThreadMgr,
-            "PerThreadMgr %d: either no MPIBlocked becomes runnable, either someone run and MPIBlocked again", debugId);
-    return false;
+    return ioRing_.get();
+}
+
+bool
+PerThreadMgr::run_io()
+{
+    return ioRing_->run();
 }
 
 void
 PerThreadMgr::wait_task()
 {
-    std::unique_lock<std::mutex> lock(co_globalWaitMut);
+    Timer::clock::duration timeout = std::chrono::microseconds(Config::Instance().max_wait_task_time);
+    if ( !timers.empty() ) {
+        /* wake up in time for the next timer */
+        Timer::clock::duration untilNext = timers.front()->deadline - Timer::clock::now();
+        if ( untilNext < timeout ) {
+            timeout = std::max(untilNext, Timer::clock::duration::zero());
+        }
+    }
+
     DEBUG_PRINT(DEBUG_PerThreadMgr, "PerThreadMgr %d: starts sleeping...", debugId);
+    if ( ioRing_ && ioRing_->busy() ) {
+        /* only this worker can take the completions, wait for them */
+        ++globalMediator.ring_sleep_count;
+        ringSleeping.store(true, std::memory_order_release);
+        ++globalMediator.sleep_count;
+        ioRing_->wait(timeout);
+        --globalMediator.sleep_count;
+        ringSleeping.store(false, std::memory_order_relaxed);
+        --globalMediator.ring_sleep_count;
+        return;
+    }
+
     ++globalMediator.sleep_count;
-    co_globalWaitCond.wait_for(lock, std::chrono::microseconds(Config::Instance().max_wait_task_time));
+    /* one sleeper waits for fd readiness instead */
+    if ( !netPoller.tryBlockingPoll(timeout) ) {
+        std::unique_lock<std::mutex> lock(co_globalWaitMut);
+        co_globalWaitCond.wait_for(lock, timeout);
+    }
     --globalMediator.sleep_count;
 }
@@ -4,20 +4,52 @@
 #include "util.hh"
 #include "Task.hh"
 #include "Skiplist.hh"
+#include "Timer.hh"
+#include "IoRing.hh"
+#ifdef ENABLE_MPI
+#include "MPIPoller.hh"
+#endif
 
 #include <vector>
 #include <memory>
+#include <atomic>
+
+/* thieves contend on the runnable_queue of their victim,
+ * see Spinlock.hh for the alternatives */
+using RunnableQueueLock = Spinlock;
 
 class PerThreadMgr : public NonCopyable {
 public:
-    void addRunnable(TaskPtr &ptr) {
+    void addRunnable(TaskPtr const &ptr) {
         runnable_queue->enqueue(ptr);
     }
+    /* hands the reference over to the runnable_queue */
+    void addRunnable(TaskPtr &&ptr) {
+        runnable_queue->enqueue(std::move(ptr));
+    }
     bool run_runnable();
 
     // stealing is done in GlobalMediator
 
-    bool run_mpi_blocked();
+#ifdef ENABLE_MPI
+    /* the MPI requests of this worker's MPIBlocked tasks */
+    MPIPoller &mpiPoller() { return mpiPoller_; }
+    /* resume the tasks whose MPI requests completed */
+    bool run_mpi() {
+        return mpiPoller_.run();
+    }
+#endif
+
+    /* the timer fires on this thread, see run_timers() */
+    void addTimer(TimerPtr &&timer);
+    /* fire the expired timers, true if any did */
+    bool run_timers();
+
+    /* this worker's io_uring, created at the first call,
+     * nullptr if io_uring is not available */
+    IoRing *ioRing();
+    /* submit the queued I/O, resume the tasks whose I/O completed */
+    bool run_io();
 
     // wait at this condition with timeout
     void wait_task();
@@ -27,9 +59,11 @@ public:
             if ( run_runnable() ) {
                 continue;
             }
-            if ( run_mpi_blocked() ) {
+#ifdef ENABLE_MPI
+            if ( mpiPoller_.busy() && run_mpi() ) {
                 continue;
             }
+#endif
             break;
             wait_task();
         }
@@ -37,12 +71,36 @@ public:
 
     TaskPtr &currentTask() { return currentTask__; }
 private:
+    /* consumes ptr unless the task is Terminated */
     void handle_after_continuationOut(TaskPtr &ptr);
+    /* drop the cancelled timers, long before their deadlines */
+    void compact_timers();
+
+    static constexpr std::size_t min_timers_compact = 64;
 
     friend class GlobalMediator;
-    std::unique_ptr<Skiplist<Task>> runnable_queue = std::make_unique<Skiplist<Task>>();
+    using RunnableQueue = Skiplist<Task, RunnableQueueLock>;
+    std::unique_ptr<RunnableQueue> runnable_queue = std::make_unique<RunnableQueue>();
+
+#ifdef ENABLE_MPI
+    MPIPoller               mpiPoller_;
+#endif
+
+    /* min-heap on Timer::deadline */
+    std::vector<TimerPtr>   timers;
+    /* compacted once it grows that large: twice the timers the last
+     * compaction left, a cancelled timer cannot outstay it by much */
+    std::size_t             timersCompactAt = min_timers_compact;
+
+    std::unique_ptr<IoRing> ioRing_;
+    bool                    ioRingTried = false;
+    /* in wait_task(), blocked in the ring rather than the condition
+     * variable: a wakeup from elsewhere goes through the ring */
+    std::atomic<bool>       ringSleeping = {false};
 
-    std::vector<TaskPtr>    mpi_blocked_queue;
+    /* run_once() calls, polls the NetPoller (and the MPIPoller) now
+     * and then even when the runnable queue never drains */
+    unsigned                ticks = 0;
 
     TaskPtr                 currentTask__ = nullptr;
     int                     debugId;
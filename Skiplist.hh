@@ -27,6 +27,8 @@ protected:
 private:
     template<class T, class LockType, int SkipGap, int NLayers>
     friend class Skiplist;
+    template<class T>
+    friend class IntrusiveQueue;
     Derived     *next;
 };
 
@@ -159,13 +161,13 @@ public:
         return std::move(res);
     }
 
-    std::unique_ptr<Skiplist<T>> dequeue_half_() {
+    std::unique_ptr<Skiplist> dequeue_half_() {
         std::lock_guard<LockType>   _(mut_);
 
         if ( !head ) {
             return nullptr;
         }
-        std::unique_ptr<Skiplist> res = std::make_unique<Skiplist<T>>();
+        std::unique_ptr<Skiplist> res = std::make_unique<Skiplist>();
 
         int toGiveAway = (tail_off - head_off + 1) / 2;
         for ( int i = 0; i < toGiveAway; ++i ) {
@@ -174,7 +176,7 @@ public:
         return std::move(res);
     }
 
-    std::unique_ptr<Skiplist<T>> dequeue_half() {
+    std::unique_ptr<Skiplist> dequeue_half() {
         enum {
             UpperCleanuped,
             SingleNodePreserved,
@@ -392,10 +394,10 @@ public:
             DEBUG_PRINT_LOCAL("Destructor of Skiplist called when head_off:%d,tail_off:%d",
                    head_off, tail_off);
             while ( head != nullptr ) {
+                T *next = head->next;
                 ref_ptr_type::decrease(head);
-                head = head->next;
+                head = next;
             }
-            ref_ptr_type::decrease(head);
         }
     }
 
@@ -1,7 +1,60 @@
 #ifndef _SPINLOCK_HH_
 #define _SPINLOCK_HH_
 
+#include "util.hh"
+
 #include <atomic>
+#include <cstdint>
+#include <new>
+#include <thread>
+
+/* LockTypes for Skiplist, ObjectPool and friends. All of them spin,
+ * none parks: they guard a few dozen instructions at most.
+ *
+ *  Spinlock        test_and_set, fine when uncontended
+ *  BackoffSpinlock test-and-test-and-set with exponential backoff,
+ *                  waiters spin on their cached copy of the line
+ *  TicketLock      FIFO, waiters back off in proportion to their
+ *                  distance from the head
+ *  McsLock         FIFO queue lock, each waiter spins on its own
+ *                  node, the line of the lock moves once per handoff
+ *
+ * The FIFO ones need no more threads than cores: a handoff to a
+ * waiter that is not running stalls everybody behind it.
+ *
+ * The new ones yield once they have spun for a while: with more
+ * threads than cores, the holder (or the next in line of a FIFO
+ * lock) may be waiting for the very core the waiter spins on.
+ *
+ * Wrap any of them in CountingLock<> to count contended acquisitions.
+ */
+
+inline void
+cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+class SpinWait {
+public:
+    void wait(unsigned n = 1) {
+        if ( spins >= yield_after ) {
+            std::this_thread::yield();
+            return;
+        }
+        spins += n;
+        for ( ; n > 0; --n ) {
+            cpu_relax();
+        }
+    }
+private:
+    static constexpr unsigned yield_after = 1 << 14;
+    unsigned spins = 0;
+};
 
 class Spinlock {
 public:
@@ -9,6 +62,9 @@ public:
         while ( locked.test_and_set() )
             ; /* spin */
     }
+    bool try_lock() {
+        return !locked.test_and_set();
+    }
     void unlock() {
         locked.clear();
     }
@@ -16,5 +72,187 @@ private:
     volatile std::atomic_flag locked = ATOMIC_FLAG_INIT;
 };
 
-#endif /* _SPINLOCK_HH_ */
+class BackoffSpinlock {
+public:
+    void lock() {
+        unsigned delay = min_delay;
+        SpinWait w;
+        while ( !try_lock() ) {
+            do {
+                w.wait(delay);
+                if ( delay < max_delay ) {
+                    delay <<= 1;
+                }
+            } while ( locked.load(std::memory_order_relaxed) );
+        }
+    }
+    bool try_lock() {
+        return !locked.load(std::memory_order_relaxed) &&
+            !locked.exchange(true, std::memory_order_acquire);
+    }
+    void unlock() {
+        locked.store(false, std::memory_order_release);
+    }
+private:
+    static constexpr unsigned min_delay = 4;
+    static constexpr unsigned max_delay = 1024;
+
+    std::atomic<bool> locked = {false};
+};
+
+class TicketLock {
+public:
+    void lock() {
+        std::uint32_t ticket = next.fetch_add(1, std::memory_order_relaxed);
+        SpinWait w;
+        for ( ;; ) {
+            std::uint32_t s = serving.load(std::memory_order_acquire);
+            if ( s == ticket ) {
+                return;
+            }
+            w.wait((ticket - s) * per_waiter_delay);
+        }
+    }
+    bool try_lock() {
+        std::uint32_t s = serving.load(std::memory_order_relaxed);
+        std::uint32_t n = s;
+        return next.compare_exchange_strong(n, s + 1, std::memory_order_acquire);
+    }
+    void unlock() {
+        serving.store(serving.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+private:
+    static constexpr std::uint32_t per_waiter_delay = 32;
+
+    std::atomic<std::uint32_t> next = {0};
+    std::atomic<std::uint32_t> serving = {0};
+};
 
+/* The node of a waiter is taken from a per-thread free list in lock()
+ * and given back in unlock(), so McsLock keeps the plain lock()/unlock()
+ * interface; lock and unlock must happen on the same thread, which
+ * holds for every lock guarding a short critical section.
+ */
+class McsLock {
+public:
+    void lock() {
+        Node *me = allocNode();
+        Node *prev = tail.exchange(me, std::memory_order_acq_rel);
+        if ( prev ) {
+            prev->next.store(me, std::memory_order_release);
+            SpinWait w;
+            while ( me->locked.load(std::memory_order_acquire) ) {
+                w.wait();
+            }
+        }
+        owner = me;
+    }
+    bool try_lock() {
+        Node *me = allocNode();
+        Node *expected = nullptr;
+        if ( tail.compare_exchange_strong(expected, me, std::memory_order_acquire) ) {
+            owner = me;
+            return true;
+        }
+        freeNode(me);
+        return false;
+    }
+    void unlock() {
+        Node *me = owner;
+        Node *succ = me->next.load(std::memory_order_acquire);
+        if ( !succ ) {
+            Node *expected = me;
+            if ( tail.compare_exchange_strong(expected, nullptr, std::memory_order_release) ) {
+                freeNode(me);
+                return;
+            }
+            /* a successor is linking itself in */
+            SpinWait w;
+            while ( !(succ = me->next.load(std::memory_order_acquire)) ) {
+                w.wait();
+            }
+        }
+        succ->locked.store(false, std::memory_order_release);
+        freeNode(me);
+    }
+private:
+    struct alignas(cache_line_size) Node {
+        std::atomic<Node*>  next;
+        std::atomic<bool>   locked;
+        Node                *nextFree;
+    };
+
+    /* nodes are never freed, a thread needs as many
+     * as the McsLocks it holds at once */
+    static Node *&freeNodes() {
+        static thread_local Node *head = nullptr;
+        return head;
+    }
+    static Node *allocNode() {
+        Node *n = freeNodes();
+        if ( n ) {
+            freeNodes() = n->nextFree;
+        } else {
+            /* cache line aligned, plain new does not align that much */
+            auto raw = reinterpret_cast<std::uintptr_t>(::operator new(2 * sizeof(Node)));
+            n = new (reinterpret_cast<void*>((raw + sizeof(Node) - 1) & ~(sizeof(Node) - 1))) Node;
+        }
+        n->next.store(nullptr, std::memory_order_relaxed);
+        n->locked.store(true, std::memory_order_relaxed);
+        return n;
+    }
+    static void freeNode(Node *n) {
+        n->nextFree = freeNodes();
+        freeNodes() = n;
+    }
+
+    std::atomic<Node*>  tail = {nullptr};
+    /* written by the holder only */
+    Node                *owner = nullptr;
+};
+
+/* LockType counting its acquisitions and the contended ones, i.e.
+ * those where try_lock() failed first. The counters are only written
+ * by the holder, reading them is approximate while the lock is used.
+ */
+template<class LockType>
+class CountingLock {
+public:
+    void lock() {
+        bool contended = !lock_.try_lock();
+        if ( contended ) {
+            lock_.lock();
+        }
+        bump(acquisitions_);
+        if ( contended ) {
+            bump(contentions_);
+        }
+    }
+    bool try_lock() {
+        if ( !lock_.try_lock() ) {
+            return false;
+        }
+        bump(acquisitions_);
+        return true;
+    }
+    void unlock() {
+        lock_.unlock();
+    }
+
+    unsigned long acquisitions() const {
+        return acquisitions_.load(std::memory_order_relaxed);
+    }
+    unsigned long contentions() const {
+        return contentions_.load(std::memory_order_relaxed);
+    }
+private:
+    static void bump(std::atomic<unsigned long> &c) {
+        c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    LockType                    lock_;
+    std::atomic<unsigned long>  acquisitions_ = {0};
+    std::atomic<unsigned long>  contentions_ = {0};
+};
+
+#endif /* _SPINLOCK_HH_ */
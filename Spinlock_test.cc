@@ -0,0 +1,92 @@
+#include "Spinlock.hh"
+#include "Skiplist.hh"
+#include "util.hh"
+
+#include <stdio.h>
+#include <cassert>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+constexpr long num_of_ops = 1000000;
+
+/* the shared data of the critical section, on its own line */
+struct alignas(cache_line_size) Shared {
+    long counter = 0;
+};
+
+template<class LockType>
+void
+bench(char const *name, int nthreads)
+{
+    CountingLock<LockType> lock;
+    Shared shared;
+    std::vector<std::thread> threads;
+    long per_thread = num_of_ops / nthreads;
+
+    auto start = std::chrono::steady_clock::now();
+    for ( int t = 0; t < nthreads; ++t ) {
+        threads.emplace_back([&lock, &shared, per_thread] () {
+            for ( long i = 0; i < per_thread; ++i ) {
+                std::lock_guard<CountingLock<LockType>> _(lock);
+                ++shared.counter;
+            }
+        });
+    }
+    for ( auto &t : threads ) {
+        t.join();
+    }
+    auto period = std::chrono::steady_clock::now() - start;
+
+    assert(shared.counter == per_thread * nthreads);
+    assert(lock.acquisitions() == (unsigned long)shared.counter);
+    printf("<%-16s %2d threads> %7.2lf ns/op, %5.2lf%% contended\n", name, nthreads,
+            (double)std::chrono::duration_cast<std::chrono::nanoseconds>(period).count() / shared.counter,
+            100.0 * lock.contentions() / lock.acquisitions());
+}
+
+template<class LockType>
+void
+test(char const *name)
+{
+    LockType lock;
+    bool locked = lock.try_lock();
+    assert(locked);
+    locked = lock.try_lock();
+    assert(!locked);
+    lock.unlock();
+
+    /* McsLock nodes come from a per-thread list, hold several at once */
+    LockType other;
+    lock.lock();
+    other.lock();
+    lock.unlock();
+    other.unlock();
+
+    /* any of them can guard a Skiplist */
+    struct Item : public RefCounted, public Linkable<Item> {};
+    Skiplist<Item, LockType> list;
+    for ( int i = 0; i < 1000; ++i ) {
+        list.enqueue(makeRefPtr<Item>());
+    }
+    auto half = list.dequeue_half();
+    assert(half->size() + list.size() == 1000);
+
+    /* FIFO locks crawl once threads outnumber cores: the next
+     * in line is often not running, so stay within the cores */
+    for ( unsigned n : {1, 2, 4, 8} ) {
+        if ( n == 1 || n <= std::thread::hardware_concurrency() ) {
+            bench<LockType>(name, n);
+        }
+    }
+}
+
+int main() {
+    test<Spinlock>("Spinlock");
+    test<BackoffSpinlock>("BackoffSpinlock");
+    test<TicketLock>("TicketLock");
+    test<McsLock>("McsLock");
+    test<std::mutex>("std::mutex");
+    printf("Spinlock_test passed.\n");
+}
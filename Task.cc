@@ -1,6 +1,6 @@
 /* 
  * 1) runnable_queue
- * 2) mpi_blocked_queue
+ * 2) the pending MPI requests, see MPIPoller
  *
  * In every term of Run:
  *    start:
@@ -9,8 +9,8 @@
  *         a runnable_queue task
  *              -- if success, run it
  *              -- else 
- *                      -- if mpi_blocked_queue is not empty
- *                          MPI_Test
+ *                      -- if MPI requests are pending
+ *                          MPI_Testsome
  *                      -- else
  *                           mut_wait_task
  *                           cond_wait_task.wait()
@@ -72,7 +72,7 @@
  *             3, the poped Task is a pure computation:
  *             run it directly in the current stack
  *          -- else, regard the yielding function as in MPIBlocked,
- *             perform mpi_blocked_queue polling.
+ *             poll the pending MPI requests.
  *
  *  -- else, it's in a coroutine
  *          pop a Task from runnable_queue, or steal a Task
@@ -94,14 +94,83 @@
 #include <array>
 #include <vector>
 #include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <boost/context/all.hpp>
 
 std::atomic<int> Task::debugId_counter = {0};
 
+/* Task is not standard-layout, but it has no virtual base,
+ * offsetof works on all compilers we care about */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winvalid-offsetof"
+
+#define TASK_FIELD_END(field) (offsetof(Task, field) + sizeof(Task::field))
+
+void
+Task::dumpLayout(FILE *out)
+{
+    static_assert(alignof(Task) == cache_line_size,
+            "Task must be cache line aligned");
+    static_assert(sizeof(RefCounted) + sizeof(Linkable<Task>) <= offsetof(Task, state),
+            "RefCounted and Linkable must lead the Task");
+    static_assert(TASK_FIELD_END(state) <= cache_line_size &&
+            TASK_FIELD_END(isPure) <= cache_line_size &&
+            TASK_FIELD_END(saved_continuation) <= cache_line_size &&
+            TASK_FIELD_END(task_continuation) <= cache_line_size &&
+            TASK_FIELD_END(blockedBy) <= cache_line_size &&
+            TASK_FIELD_END(cancelToken) <= cache_line_size,
+            "scheduler-hot fields of Task must fit in the first cache line");
+    static_assert(offsetof(Task, debugId) >= cache_line_size &&
+            offsetof(Task, callback) >= cache_line_size &&
+            offsetof(Task, groups) >= cache_line_size &&
+            offsetof(Task, mut_) >= cache_line_size &&
+            offsetof(Task, failed_) >= cache_line_size &&
+            offsetof(Task, result_) >= cache_line_size &&
+            offsetof(Task, destroyResult) >= cache_line_size,
+            "cold fields of Task must stay out of the first cache line");
+    static_assert(sizeof(Task) == 2 * cache_line_size,
+            "Task must take two cache lines");
+
+    /* base subobjects, offsetof cannot name their private members */
+    Task *t = reinterpret_cast<Task*>(cache_line_size);
+    auto base_off = [t] (void const *base) -> std::size_t {
+        return reinterpret_cast<char const*>(base) - reinterpret_cast<char const*>(t);
+    };
+
+    fprintf(out, "sizeof(Task): %zu, alignof(Task): %zu, cache line: %zu\n",
+            sizeof(Task), alignof(Task), cache_line_size);
+#define DUMP_FIELD(name, off, sz) \
+    fprintf(out, "  %-28s offset %4zu size %3zu line %zu\n", name, (std::size_t)(off), (std::size_t)(sz), \
+            (std::size_t)(off) / cache_line_size)
+    DUMP_FIELD("RefCounted::counter__", base_off(static_cast<RefCounted*>(t)), sizeof(RefCounted));
+    DUMP_FIELD("Linkable<Task>::next", base_off(static_cast<Linkable<Task>*>(t)), sizeof(Linkable<Task>));
+    DUMP_FIELD("state", offsetof(Task, state), sizeof(Task::state));
+    DUMP_FIELD("isPure", offsetof(Task, isPure), sizeof(Task::isPure));
+    DUMP_FIELD("saved_continuation", offsetof(Task, saved_continuation), sizeof(Task::saved_continuation));
+    DUMP_FIELD("task_continuation", offsetof(Task, task_continuation), sizeof(Task::task_continuation));
+    DUMP_FIELD("blockedBy", offsetof(Task, blockedBy), sizeof(Task::blockedBy));
+    DUMP_FIELD("cancelToken", offsetof(Task, cancelToken), sizeof(Task::cancelToken));
+    DUMP_FIELD("debugId", offsetof(Task, debugId), sizeof(Task::debugId));
+    DUMP_FIELD("mut_", offsetof(Task, mut_), sizeof(Task::mut_));
+    DUMP_FIELD("failed_", offsetof(Task, failed_), sizeof(Task::failed_));
+    DUMP_FIELD("callback", offsetof(Task, callback), sizeof(Task::callback));
+    DUMP_FIELD("groups", offsetof(Task, groups), sizeof(Task::groups));
+    DUMP_FIELD("result_", offsetof(Task, result_), sizeof(Task::result_));
+    DUMP_FIELD("destroyResult", offsetof(Task, destroyResult), sizeof(Task::destroyResult));
+#undef DUMP_FIELD
+}
+
+#undef TASK_FIELD_END
+#pragma GCC diagnostic pop
+
 Task::~Task()
 {
     DEBUG_PRINT(DEBUG_Task,
             "Task %d destructor called", debugId); 
+    if ( destroyResult ) {
+        destroyResult(this);
+    }
 }
 
 void
@@ -113,36 +182,78 @@ Task::continuationOut()
     saved_continuation = saved_continuation.resume();
 }
 
+void
+Task::parkOn(Waitable *w, int parkedState)
+{
+    MUST_TRUE(!isPure, "pure task %d cannot park", debugId);
+    DEBUG_PRINT(DEBUG_Task, "Task %d parking", debugId);
+    state = parkedState;
+    blockedBy = w;
+    continuationOut();
+}
+
+void
+Task::inheritCancelToken()
+{
+    TaskPtr &current = globalMediator.getThisPerThreadMgr()->currentTask();
+    if ( current ) {
+        cancelToken = current->cancelToken;
+    }
+}
+
 bool
-Task::addToGroup(TaskGroup *gp)
+Task::addToGroup(GroupMembership *m)
 {
     std::lock_guard<Spinlock> _(mut_);
 
-    DEBUG_PRINT(DEBUG_Task, "Task %d addToGroup %d...", debugId, gp->debugId);
+    DEBUG_PRINT(DEBUG_Task, "Task %d addToGroup %d...", debugId, m->group->debugId);
     if ( !isFini() ) {
-        MUST_TRUE(cur_groups + 1 < max_groups, "Too many groups for Task %d", debugId);
-        groups[cur_groups++] = gp;
-//        groups.push_back(gp);
-        ++gp->blocking_count;
+        m->next = groups;
+        groups = m;
+        m->group->state_.fetch_add(TaskGroup::OneTask, std::memory_order_relaxed);
         return true;
     } else {
         return false;
     }
 }
 
+bool
+Task::removeFromGroup(TaskGroup *g)
+{
+    std::lock_guard<Spinlock> _(mut_);
+    if ( isFini() ) {
+        return false;
+    }
+    for ( GroupMembership **pm = &groups; *pm; pm = &(*pm)->next ) {
+        if ( (*pm)->group == g ) {
+            (*pm)->task.store(nullptr, std::memory_order_relaxed);
+            *pm = (*pm)->next;
+            return true;
+        }
+    }
+    MUST_TRUE(false, "Task %d is not in TaskGroup %d", debugId, g->debugId);
+    return false;
+}
+
 void
 Task::terminate()
 {
-    std::lock_guard<Spinlock> _(mut_);
-    DEBUG_PRINT(DEBUG_Task, "Task %d terminating...", debugId);
-    state = Terminated;
+    {
+        std::lock_guard<Spinlock> _(mut_);
+        DEBUG_PRINT(DEBUG_Task, "Task %d terminating...", debugId);
+        state = Terminated;
+    }
 
-    for ( int i = 0; i < cur_groups; ++i ) {
-        groups[i]->informDone(TaskPtr(this));
+    /* once Terminated, addToGroup() never touches groups again,
+     * so the groups can be informed without holding mut_;
+     * the membership lives in the group, which may be gone
+     * as soon as it is informed */
+    GroupMembership *m = groups;
+    while ( m ) {
+        GroupMembership *next = m->next;
+        m->group->informDone(m);
+        m = next;
     }
-//    for ( auto group : groups ) {
-//        group->informDone(TaskPtr(this));
-//    }
 }
 
 const char*
@@ -153,6 +264,8 @@ Task::getStateName(int s)
         "Runnable",
         "MPIBlocked",
         "GroupWait",
+        "Parked",
+        "IOBlocked",
         "Terminated",
     };
     if ( s < dict.size() ) {
@@ -162,7 +275,18 @@ Task::getStateName(int s)
     }
 }
 
-boost::context::fixedsize_stack Task::salloc(Config::Instance().max_stack_size);
+TaskStackAllocator Task::salloc(Config::Instance().max_stack_size, Config::Instance().use_huge_pages);
+
+void
+Task::fail(std::exception_ptr e)
+{
+    /* kept for Future<T>::get(), in place of the result */
+    if ( destroyResult ) {
+        destroyResult(this);
+    }
+    emplaceResult<std::exception_ptr>(std::move(e));
+    failed_ = true;
+}
 
 void
 Task::continuationIn()
@@ -178,8 +302,8 @@ Task::continuationIn()
                 try {
                     callback();
                     terminate();
-                } catch ( std::exception const &e ) {
-                    // TODO: add exception handling
+                } catch ( std::exception const & ) {
+                    fail(std::current_exception());
                     terminate();
                 }
                 return std::move(saved_continuation);
@@ -199,8 +323,8 @@ Task::runInStack()
     try {
         callback();
         terminate();
-    } catch ( std::exception const &e ) {
-        // TODO: add exception handling
+    } catch ( std::exception const & ) {
+        fail(std::current_exception());
         terminate();
     }
 }
@@ -215,11 +339,12 @@ TaskPool::Init()
         .set_enlarge_rate(Config::Instance().enlarge_rate)
         .set_max_total_cached(Config::Instance().max_total_cached)
         .set_cache_reclaim_period(Config::Instance().cache_reclaim_period)
+        .set_use_huge_pages(Config::Instance().use_huge_pages)
         ;
-    mediator = std::make_unique<ObjectPoolMediator<Task>>(config);
+    mediator = std::make_unique<ObjectPoolMediator<Task, TaskPoolLock>>(config);
 }
 
-std::unique_ptr<ObjectPoolMediator<Task>> TaskPool::mediator;
+std::unique_ptr<ObjectPoolMediator<Task, TaskPoolLock>> TaskPool::mediator;
 
 void*
 Task::operator new(std::size_t sz)
@@ -228,7 +353,14 @@ Task::operator new(std::size_t sz)
     MUST_TRUE(sz == sizeof(Task), "Task new operator only for Task object");
     return TaskPool::Instance()->my_alloc(globalMediator.thread_id);
 #else
-    return ::operator new(sz);
+    /* C++14 operator new knows nothing about alignas(cache_line_size),
+     * and posix_memalign is slow in some mallocs: over-allocate and keep
+     * the raw pointer just below the aligned Task */
+    char *raw = static_cast<char*>(::operator new(sz + alignof(Task)));
+    std::uintptr_t aligned = (reinterpret_cast<std::uintptr_t>(raw) + sizeof(void*) + alignof(Task) - 1)
+        & ~(static_cast<std::uintptr_t>(alignof(Task)) - 1);
+    reinterpret_cast<void**>(aligned)[-1] = raw;
+    return reinterpret_cast<void*>(aligned);
 #endif /* ENABLE_OBJECT_POOL */
 }
 
@@ -238,6 +370,6 @@ Task::operator delete(void *ptr, std::size_t)
 #ifdef ENABLE_OBJECT_POOL
     TaskPool::Instance()->my_release(globalMediator.thread_id, ptr);
 #else
-    ::operator delete (ptr);
+    ::operator delete(static_cast<void**>(ptr)[-1]);
 #endif /* ENABLE_OBJECT_POOL */
 }
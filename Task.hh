@@ -4,20 +4,69 @@
 #include "util.hh"
 #include "debug.hh"
 #include "Spinlock.hh"
+#include "CancelToken.hh"
 #include "Skiplist.hh"
 #include "ObjectPool.hh"
+#include "HugePageArena.hh"
+#include "Waitable.hh"
 
 #include <atomic>
+#include <exception>
 #include <mutex>
 #include <functional>
 #include <memory>
 #include <vector>
 #include <array>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include <boost/context/all.hpp>
 
 class TaskGroup;
 
-class Task 
+/* one TaskGroup waiting on one Task: the node lives in the TaskGroup,
+ * and is linked into the Task's membership list */
+struct GroupMembership {
+    TaskGroup       *group = nullptr;
+    GroupMembership *next = nullptr;
+    /* nullptr once the task has informed the group or left it, the
+     * group detaching from its tasks reads it, see ~TaskGroup() */
+    std::atomic<Task*> task = {nullptr};
+};
+
+/* stacks come either from boost's fixedsize_stack or, with
+ * Config::use_huge_pages, from hugepage-backed regions */
+class TaskStackAllocator {
+public:
+    TaskStackAllocator(std::size_t size, bool use_huge_pages)
+        : use_huge_pages(use_huge_pages)
+        , fixed(size)
+        , huge(size)
+    {}
+
+    boost::context::stack_context allocate() {
+        return use_huge_pages ? huge.allocate() : fixed.allocate();
+    }
+    void deallocate(boost::context::stack_context &sctx) {
+        if ( use_huge_pages ) {
+            huge.deallocate(sctx);
+        } else {
+            fixed.deallocate(sctx);
+        }
+    }
+private:
+    bool                            use_huge_pages;
+    boost::context::fixedsize_stack fixed;
+    HugePageStack                   huge;
+};
+
+/* Layout: the RefCounted counter and the Linkable next pointer (the
+ * bases) plus the scheduler-hot members share the first cache line;
+ * members touched at spawn/terminate only live after it. Tasks are
+ * cache-line aligned, so a thief touching one Task never shares a
+ * line with its neighbours. Checked in Task.cc, see dumpLayout().
+ */
+class alignas(cache_line_size) Task 
     : public RefCounted
     , public Linkable<Task>
 {
@@ -25,7 +74,6 @@ class Task
     friend class TaskGroup;
     friend class GlobalMediator;
 public:
-    static constexpr int max_groups = 5;
     enum {
         /* when the Task is spawned */
         Initial,
@@ -33,12 +81,18 @@ public:
         /* in the runnable_queue */
         Runnable,
 
-        /* in the mpi_blocked_queue */
+        /* Parked on an MPI request, see MPIPoller */
         MPIBlocked,
 
         /* not in any queue, in the on-stack TaskGroup */
         GroupWait,
 
+        /* not in any queue, parked on the Waitable in blockedBy */
+        Parked,
+
+        /* Parked on an fd of the NetPoller */
+        IOBlocked,
+
         /* the task is about to be deleted,
          * but maybe it's in a TaskGroup,
          * so let the shared_ptr delete it automatically
@@ -51,31 +105,64 @@ public:
     static const char *getStateName(int s);
 
     explicit Task(std::function<void()> callback, bool isPure = false)
-        : callback(callback)
-        , debugId(++debugId_counter)
+        : debugId(++debugId_counter)
+        , callback(callback)
     {
         DEBUG_PRINT(DEBUG_Task, "Task %d creating", debugId);
     
     }
     ~Task();
-    bool addToGroup(TaskGroup *gp);
+    /* false if the task is already Terminated */
+    bool addToGroup(GroupMembership *m);
+    /* unlink g's membership, false if the task is already Terminated
+     * (then g is informed, or is about to be) */
+    bool removeFromGroup(TaskGroup *g);
     void terminate();
 
     void setPure(bool v = true) { isPure = v; }
+    bool pure() const { return isPure; }
+    /* take the cancelToken of the running task, if any */
+    void inheritCancelToken();
     void runInStack();
 
     void continuationIn();
     void continuationOut();
 
-    int debugId;
-    int state = Initial;
+    /* switch out as Parked (or IOBlocked, MPIBlocked),
+     * w->resumeIfNothingToWait() decides when the task runs again */
+    void parkOn(Waitable *w, int parkedState = Parked);
+
+    /* the result of a go_future() task, see Future<T>: constructed
+     * in result_ if it fits, otherwise on the heap */
+    template<class T, class... Args>
+    void emplaceResult(Args&&... args) {
+        constructResult<T>(std::integral_constant<bool, resultFitsInline<T>()>(),
+                std::forward<Args>(args)...);
+        destroyResult = &destroyResultOf<T>;
+    }
+    template<class T>
+    T &result() {
+        return resultFitsInline<T>() ?
+            *reinterpret_cast<T*>(result_) : **reinterpret_cast<T**>(result_);
+    }
+    /* the callback threw, there is no result */
+    bool failed() const { return failed_; }
+    void rethrowIfFailed() {
+        if ( failed_ ) {
+            std::rethrow_exception(result<std::exception_ptr>());
+        }
+    }
+
+    /* print sizeof/offsets of the fields, to catch layout regressions */
+    static void dumpLayout(FILE *out);
 
     // memory management
     static void* operator new(std::size_t sz);
     static void operator delete(void *p, std::size_t sz);
-private:
-    std::function<void()>   callback;
 
+    /* ---- hot: first cache line ---- */
+    int state = Initial;
+private:
     /* a pure task will not block, and can be scheduled in the current stack */
     bool                    isPure = false;
 
@@ -87,24 +174,67 @@ private:
     continuation_t          saved_continuation;
     continuation_t          task_continuation;
 
-    /* this vector will be accessed concurrently */
-    TaskGroup               *blockedBy = nullptr;
-//    std::vector<TaskGroup*> groups;
-    std::array<TaskGroup*, max_groups>  groups;
-    int                     cur_groups = 0;
+    Waitable                *blockedBy = nullptr;
+public:
+    /* checked at the task's waits, inherited by the tasks it spawns */
+    CancelTokenPtr          cancelToken;
+private:
+
+    /* ---- cold: spawn, group registration, terminate ---- */
+public:
+    alignas(cache_line_size) int debugId;
+private:
     Spinlock                mut_;
+    /* result_ holds the exception the callback threw, see fail() */
+    bool                    failed_ = false;
+    std::function<void()>   callback;
+
+    /* groups waiting on this task, any number of them,
+     * guarded by mut_ until the task is Terminated */
+    GroupMembership         *groups = nullptr;
+
+    /* fills the cold line up */
+    alignas(void*) unsigned char result_[sizeof(void*)];
+    void                    (*destroyResult)(Task*) = nullptr;
+
+    /* from the catch around the callback */
+    void fail(std::exception_ptr e);
+
+    template<class T>
+    static constexpr bool resultFitsInline() {
+        return sizeof(T) <= sizeof(result_) && alignof(T) <= alignof(void*);
+    }
+    template<class T, class... Args>
+    void constructResult(std::true_type, Args&&... args) {
+        new (result_) T(std::forward<Args>(args)...);
+    }
+    template<class T, class... Args>
+    void constructResult(std::false_type, Args&&... args) {
+        *reinterpret_cast<T**>(result_) = new T(std::forward<Args>(args)...);
+    }
+    template<class T>
+    static void destroyResultOf(Task *t) {
+        if ( resultFitsInline<T>() ) {
+            t->result<T>().~T();
+        } else {
+            delete &t->result<T>();
+        }
+    }
 
     static std::atomic<int> debugId_counter;
-    static boost::context::fixedsize_stack salloc;
+    static TaskStackAllocator salloc;
 };
 
 using TaskPtr = DerivedRefPtr<Task>;
 
+/* every thread returning tasks contends on it, see Spinlock.hh */
+using TaskPoolLock = Spinlock;
+
 class TaskPool : public NonCopyable {
 public:
     static void Init();
 
-    static std::unique_ptr<ObjectPoolMediator<Task>> &Instance() {
+    static std::unique_ptr<ObjectPoolMediator<Task, TaskPoolLock>> &Instance() {
         return mediator;
     }
 
@@ -112,7 +242,7 @@ public:
         mediator->daemonTerminate();
     }
 private:
-    static std::unique_ptr<ObjectPoolMediator<Task>> mediator;
+    static std::unique_ptr<ObjectPoolMediator<Task, TaskPoolLock>> mediator;
 };
 
 #endif /* _TASK_HH_ */
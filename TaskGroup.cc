@@ -11,38 +11,181 @@
 #include <vector>
 #include <thread>
 #include <chrono>
+#include <new>
+
+WaitStatus
+TaskGroup::wait(bool cancellable)
+{
+    if ( pending() == 0 ) {
+        DEBUG_PRINT(DEBUG_TaskGroup, "TaskGroup nothing to wait");
+        return WaitStatus::Ready;
+    }
+    EarlyWake ew(this);
+    return park(ew, cancellable);
+}
 
 void
-TaskGroup::wait()
+TaskGroup::waitAny()
 {
-    if ( blocking_count != 0 ) {
-        DEBUG_PRINT(DEBUG_TaskGroup, "task %d starts GroupWait at TaskGroup %d",
-                co_currentTask->debugId, debugId);
-        co_currentTask->state = Task::GroupWait;
-        co_currentTask->blockedBy = this;
-        co_yield;
-    } else {
+    if ( finishedAtRegiste || numMemberships == 0 ) {
         DEBUG_PRINT(DEBUG_TaskGroup, "TaskGroup nothing to wait");
+        return;
     }
+    state_.fetch_or(WaitAny, std::memory_order_relaxed);
+    wait(false);
+}
+
+WaitStatus
+TaskGroup::park(EarlyWake &ew, bool cancellable)
+{
+    CancelToken *token = cancellable ? co_currentTask->cancelToken.get() : nullptr;
+    if ( token && !token->addWaiter(&ew) ) {
+        return WaitStatus::Cancelled;
+    }
+
+    DEBUG_PRINT(DEBUG_TaskGroup, "task %d starts GroupWait at TaskGroup %d",
+            co_currentTask->debugId, debugId);
+    earlyWake = &ew;
+    co_currentTask->state = Task::GroupWait;
+    co_currentTask->blockedBy = this;
+    co_yield;
+    earlyWake = nullptr;
+
+    if ( token ) {
+        /* waits for a running onCancel() */
+        token->removeWaiter(&ew);
+        state_.fetch_and(~static_cast<unsigned long>(CancelReq), std::memory_order_relaxed);
+    }
+    /* fire() touches ew and the group, wait until it cannot */
+    if ( ew.timer ) {
+        ew.timer->cancel();
+    }
+    return ew.status;
+}
+
+void
+TaskGroup::wakeEarly(EarlyWake *ew, WaitStatus status)
+{
+    /* the same CAS as informDone(): its winner owns blockedTask */
+    unsigned long s = state_.load(std::memory_order_acquire);
+    while ( s & Waiting ) {
+        if ( state_.compare_exchange_weak(s, s & ~static_cast<unsigned long>(Waiting | WaitAny),
+                    std::memory_order_acq_rel, std::memory_order_acquire) ) {
+            DEBUG_PRINT(DEBUG_TaskGroup, "TaskGroup %d wait ends early", debugId);
+            ew->status = status;
+            globalMediator.wakeUp(std::move(blockedTask));
+            return;
+        }
+    }
+}
+
+void
+TaskGroup::EarlyWake::onCancel()
+{
+    /* seen by the parking hook if the waiter is not parked yet */
+    group->state_.fetch_or(CancelReq, std::memory_order_acq_rel);
+    group->wakeEarly(this, WaitStatus::Cancelled);
+}
+
+class TaskGroup::WaitTimer : public Timer {
+public:
+    explicit WaitTimer(EarlyWake *ew)
+        : Timer(ew->deadline)
+        , ew(ew)
+    {}
+protected:
+    void fire() override {
+        ew->group->wakeEarly(ew, WaitStatus::Timeout);
+    }
+private:
+    EarlyWake   *ew;
+};
+
+WaitStatus
+TaskGroup::wait_until(Timer::clock::time_point deadline)
+{
+    if ( pending() == 0 ) {
+        return WaitStatus::Ready;
+    }
+    if ( Timer::clock::now() >= deadline ) {
+        return WaitStatus::Timeout;
+    }
+
+    EarlyWake ew(this);
+    ew.hasDeadline = true;
+    ew.deadline = deadline;
+    return park(ew, true);
 }
 
 bool
 TaskGroup::resumeIfNothingToWait(TaskPtr &ptr)
 {
-    std::lock_guard<Spinlock> _(mut_);
-    if ( blocking_count == 0 ) {
-        ptr->state = Task::Runnable;
-        return true;
+    if ( earlyWake->hasDeadline ) {
+        /* fires on this thread, not before this hook returns;
+         * armed before blockedTask is published, as a finisher may
+         * resume the waiter and end park() from then on */
+        earlyWake->timer = TimerPtr(new WaitTimer(earlyWake));
+        globalMediator.getThisPerThreadMgr()->addTimer(TimerPtr(earlyWake->timer));
+    }
+    blockedTask = std::move(ptr);
+    unsigned long s = state_.load(std::memory_order_acquire);
+    for ( ;; ) {
+        if ( s < OneTask ||
+                ((s & WaitAny) && s / OneTask < static_cast<unsigned long>(numMemberships)) ) {
+            ptr = std::move(blockedTask);
+            ptr->state = Task::Runnable;
+            return true;
+        }
+        if ( s & CancelReq ) {
+            /* cancelled before parking, nobody else resumes it */
+            earlyWake->status = WaitStatus::Cancelled;
+            ptr = std::move(blockedTask);
+            ptr->state = Task::Runnable;
+            return true;
+        }
+        /* after this CAS, blockedTask belongs to the last finisher */
+        if ( state_.compare_exchange_weak(s, s | Waiting,
+                    std::memory_order_acq_rel, std::memory_order_acquire) ) {
+            return false;
+        }
+    }
+}
+
+GroupMembership*
+TaskGroup::newMembership()
+{
+    GroupMembership *m;
+    if ( numMemberships == 0 ) {
+        m = &inlineMembership;
     } else {
-        blockedTask = ptr;
-        return false;
+        if ( !chunks || usedInChunk == chunks->size ) {
+            int size = chunks ? chunks->size * 2 : first_chunk_size;
+            void *mem = ::operator new(sizeof(MembershipChunk) + size * sizeof(GroupMembership));
+            MembershipChunk *chunk = new (mem) MembershipChunk{chunks, size};
+            new (chunk->nodes()) GroupMembership[size];
+            chunks = chunk;
+            usedInChunk = 0;
+        }
+        m = &chunks->nodes()[usedInChunk++];
     }
+    ++numMemberships;
+    m->group = this;
+    return m;
 }
 
 TaskGroup&
-TaskGroup::registe(TaskPtr ptr)
+TaskGroup::registe(TaskPtr const &ptr)
 {
-    if ( !ptr->addToGroup(this) ) {
+    GroupMembership *m = newMembership();
+    Task *task = const_cast<Task*>(ptr.get());
+    /* published to the finisher by addToGroup() */
+    m->task.store(task, std::memory_order_relaxed);
+    if ( !task->addToGroup(m) ) {
+        finishedAtRegiste = true;
+        /* give the node back, it is the last one handed out */
+        if ( --numMemberships > 0 ) {
+            --usedInChunk;
+        }
         return *this;
     }
 
@@ -51,28 +194,88 @@ TaskGroup::registe(TaskPtr ptr)
 }
 
 void
-TaskGroup::informDone(TaskPtr ptr)
+TaskGroup::informDone(GroupMembership *m)
 {
-    std::lock_guard<Spinlock> _(mut_);
-    TaskPtr nowCanRun = nullptr;
+    DEBUG_PRINT(DEBUG_TaskGroup, "task %d informDone to TaskGroup %d...",
+            m->task.load(std::memory_order_relaxed)->debugId, debugId);
+    /* released by the CAS below, a detaching group sees it */
+    m->task.store(nullptr, std::memory_order_relaxed);
+    unsigned long s = state_.load(std::memory_order_acquire);
+    for ( ;; ) {
+        if ( s & Detaching ) {
+            std::this_thread::yield();
+            s = state_.load(std::memory_order_acquire);
+            continue;
+        }
+        if ( state_.compare_exchange_weak(s, s - OneTask,
+                    std::memory_order_acq_rel, std::memory_order_acquire) ) {
+            break;
+        }
+    }
 
-    if ( --blocking_count == 0 ) {
-        DEBUG_PRINT(DEBUG_TaskGroup, "task %d informDone to TaskGroup %d...", ptr->debugId, debugId);
-        nowCanRun = std::move(blockedTask);
+    s -= OneTask;
+    for ( ;; ) {
+        if ( !(s & Waiting) || (!(s & WaitAny) && s >= OneTask) ) {
+            return;
+        }
+        /* after this CAS, blockedTask belongs to this finisher */
+        if ( state_.compare_exchange_weak(s, s & ~static_cast<unsigned long>(Waiting | WaitAny),
+                    std::memory_order_acq_rel, std::memory_order_acquire) ) {
+            break;
+        }
     }
 
-    if ( nowCanRun ) {
-        nowCanRun->state = Task::Runnable;
-        DEBUG_PRINT(DEBUG_TaskGroup,
-                "informDone causes task %d blocked by %d runnable", nowCanRun->debugId, debugId);
+    TaskPtr nowCanRun = std::move(blockedTask);
+
+    DEBUG_PRINT(DEBUG_TaskGroup,
+            "informDone causes task %d blocked by %d runnable", nowCanRun->debugId, debugId);
 
-        globalMediator.addRunnable(nowCanRun);
+    globalMediator.wakeUp(std::move(nowCanRun));
+}
+
+bool
+TaskGroup::unregiste(Task *ptr)
+{
+    if ( !ptr->removeFromGroup(this) ) {
+        return false;
+    }
+    state_.fetch_sub(OneTask, std::memory_order_relaxed);
+    return true;
+}
+
+void
+TaskGroup::drain()
+{
+    while ( pending() != 0 ) {
+        co_yield;
     }
 }
 
 TaskGroup::~TaskGroup()
 {
     DEBUG_PRINT(DEBUG_TaskGroup, "TaskGroup %d destroying...", debugId);
+    if ( pending() != 0 ) {
+        /* left by a timed out wait: detach from the running tasks,
+         * alive as long as they have not informed the group */
+        state_.fetch_or(Detaching, std::memory_order_acq_rel);
+        forEachMembership([this] (GroupMembership &m) {
+            Task *task = m.task.load(std::memory_order_relaxed);
+            if ( task && task->removeFromGroup(this) ) {
+                state_.fetch_sub(OneTask, std::memory_order_relaxed);
+            }
+        });
+        state_.fetch_and(~static_cast<unsigned long>(Detaching), std::memory_order_acq_rel);
+        /* the Terminated ones are informing it, a few instructions
+         * away; they never touch the group once they have */
+        while ( pending() != 0 ) {
+            std::this_thread::yield();
+        }
+    }
+    while ( chunks ) {
+        MembershipChunk *next = chunks->next;
+        ::operator delete(chunks);
+        chunks = next;
+    }
 }
 
 std::atomic<int> TaskGroup::debugId_counter = {0};
@@ -3,7 +3,10 @@
 
 #include "util.hh"
 #include "Task.hh"
+#include "Timer.hh"
+#include "CancelToken.hh"
 
+#include <chrono>
 #include <memory>
 #include <vector>
 #include <mutex>
@@ -11,25 +14,145 @@
 
 /* TaskGroup might be accessed by multiple threads
  * through informDone();
+ *
+ * It is lock-free: the number of unfinished tasks and whether the
+ * waiter is parked live in one atomic word, state_. The waiter
+ * publishes blockedTask with the CAS setting Waiting, the finisher
+ * taking the count to zero with Waiting set is the only one to
+ * resume it; if the count is already zero at that CAS, the waiter
+ * resumes itself.
+ *
+ * The GroupMembership nodes linking tasks to the group live here:
+ * the first one inline, then in chunks growing geometrically, so
+ * a task carries one pointer whatever number of groups wait on it.
+ * registe() is meant to be called by one task at a time.
+ *
+ * waitAny() resumes the waiter once any registered task finished:
+ * then every finisher may see Waiting, the one clearing it resumes
+ * the waiter. when_any() uses it with unregiste() and drain().
+ *
+ * wait_until() arms a Timer racing the finishers for the Waiting
+ * bit, the timer wins by clearing it and resumes the waiter, so
+ * blockedTask always has exactly one owner. A cancellable wait
+ * parks on the CancelToken of the waiting task the same way: the
+ * cancel sets CancelReq, seen by the parking hook if the waiter is
+ * not parked yet, then races for Waiting. The tasks stay
+ * registered after a Timeout or a cancel: wait again, or destroy
+ * the group, which detaches from the tasks still running.
+ *
+ * The group holds no reference to its tasks. To detach, it sets
+ * Detaching, which holds back the finishers about to inform it: a
+ * task whose membership still names it has not informed the group,
+ * and stays alive until Detaching is cleared.
  */
-class TaskGroup : public NonCopyable {
+class TaskGroup : public Waitable, public NonCopyable {
 public:
-    void wait();
-    TaskGroup &registe(TaskPtr ptr);
-    void informDone(TaskPtr ptr);
-    bool resumeIfNothingToWait(TaskPtr &ptr);
+    /* Ready, or Cancelled once the token of the waiting task is
+     * cancelled: then the tasks go on running */
+    WaitStatus wait(bool cancellable = true);
+    /* wait until one registered task finished, once per group */
+    void waitAny();
+    /* wait(), Timeout once the deadline has passed */
+    WaitStatus wait_until(Timer::clock::time_point deadline);
+    template<class Rep, class Period>
+    WaitStatus wait_for(std::chrono::duration<Rep, Period> const &d) {
+        return wait_until(Timer::clock::now() + std::chrono::duration_cast<Timer::clock::duration>(d));
+    }
+    TaskGroup &registe(TaskPtr const &ptr);
+    /* from the terminating task of m */
+    void informDone(GroupMembership *m);
+
+    /* forget an unfinished task, false if it has finished
+     * (its informDone() may still be on the way) */
+    bool unregiste(Task *ptr);
+    /* yield until the informDone() calls on the way have arrived */
+    void drain();
+
+    /* takes ptr over if the task has to wait */
+    bool resumeIfNothingToWait(TaskPtr &ptr) override;
+
+    /* number of registered tasks not finished yet */
+    unsigned long pending() const {
+        return state_.load(std::memory_order_acquire) / OneTask;
+    }
     
     ~TaskGroup();
 
     int debugId = ++debugId_counter;
-    std::atomic<int>    blocking_count = {0};
 private:
     friend class Task;
-    TaskPtr blockedTask;
-    Spinlock            mut_;
+    enum : unsigned long {
+        Waiting = 1,
+        WaitAny = 2,
+        /* set by the destructor, see above */
+        Detaching = 4,
+        /* set by a cancel of the waiter, see above */
+        CancelReq = 8,
+        OneTask = 16,
+    };
+
+    static constexpr int first_chunk_size = 16;
+
+    /* chunks of GroupMembership, allocated with the nodes behind it */
+    struct MembershipChunk {
+        MembershipChunk *next;
+        int             size;
+        GroupMembership *nodes() {
+            return reinterpret_cast<GroupMembership*>(this + 1);
+        }
+    };
+
+    GroupMembership *newMembership();
+
+    template<class Fn>
+    void forEachMembership(Fn fn) {
+        if ( numMemberships == 0 ) {
+            return;
+        }
+        fn(inlineMembership);
+        /* only the newest chunk may be partly used */
+        int used = usedInChunk;
+        for ( MembershipChunk *c = chunks; c; c = c->next ) {
+            for ( int i = 0; i < used; ++i ) {
+                fn(c->nodes()[i]);
+            }
+            used = c->next ? c->next->size : 0;
+        }
+    }
+
+    class WaitTimer;
+    /* on the stack of the waiting task, what may end the wait early */
+    struct EarlyWake : public CancelToken::Waiter {
+        explicit EarlyWake(TaskGroup *group)
+            : group(group)
+        {}
+        void onCancel() override;
+
+        TaskGroup                   *group;
+        bool                        hasDeadline = false;
+        Timer::clock::time_point    deadline;
+        TimerPtr                    timer;
+        WaitStatus                  status = WaitStatus::Ready;
+    };
+
+    WaitStatus park(EarlyWake &ew, bool cancellable);
+    /* by a timer or a cancel, resumes the waiter if still parked */
+    void wakeEarly(EarlyWake *ew, WaitStatus status);
+
+    /* (unfinished tasks << 4) | CancelReq | Detaching | WaitAny | Waiting */
+    std::atomic<unsigned long>  state_ = {0};
+    TaskPtr                     blockedTask;
+    /* set during park(), the parking hook arms its timer */
+    EarlyWake                   *earlyWake = nullptr;
+
+    /* TaskGroups live on small coroutine stacks, keep them small */
+    GroupMembership             inlineMembership;
+    MembershipChunk             *chunks = nullptr;
+    int                         usedInChunk = 0;
+    int                         numMemberships = 0;
+    bool                        finishedAtRegiste = false;
 
     static std::atomic<int> debugId_counter;
 };
 
 #endif /* _TASKGROUP_HH_ */
-
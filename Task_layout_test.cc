@@ -0,0 +1,9 @@
+#include "Task.hh"
+
+#include <stdio.h>
+
+/* prints the Task layout, the static_asserts in Task::dumpLayout()
+ * already fail the build if a hot field leaves the first cache line */
+int main() {
+    Task::dumpLayout(stdout);
+}
@@ -0,0 +1,73 @@
+#ifndef _TIMER_HH_
+#define _TIMER_HH_
+
+#include "util.hh"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+/* One-shot timer, fired by the PerThreadMgr it was added to, in its
+ * scheduling loop. cancel() may come from any thread, so it only makes
+ * the timer inert: the heap drops it once the deadline has passed, or
+ * when it compacts, see PerThreadMgr::addTimer().
+ */
+class Timer : public RefCounted {
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit Timer(clock::time_point deadline)
+        : deadline(deadline)
+    {}
+    virtual ~Timer() = default;
+
+    /* true if fire() will never run. Otherwise fire() has run or is
+     * running on the timer's thread, wait until it has returned */
+    bool cancel() {
+        int s = Armed;
+        if ( state_.compare_exchange_strong(s, Cancelled, std::memory_order_acq_rel) ) {
+            return true;
+        }
+        while ( state_.load(std::memory_order_acquire) == Firing ) {
+            std::this_thread::yield();
+        }
+        return false;
+    }
+
+    bool cancelled() const {
+        return state_.load(std::memory_order_relaxed) == Cancelled;
+    }
+
+    const clock::time_point deadline;
+protected:
+    virtual void fire() = 0;
+private:
+    friend class PerThreadMgr;
+
+    void run() {
+        int s = Armed;
+        if ( state_.compare_exchange_strong(s, Firing, std::memory_order_acq_rel) ) {
+            fire();
+            state_.store(Fired, std::memory_order_release);
+        }
+    }
+
+    enum {
+        Armed,
+        Firing,
+        Fired,
+        Cancelled,
+    };
+    std::atomic<int> state_ = {Armed};
+};
+
+using TimerPtr = DerivedRefPtr<Timer>;
+
+/* the outcome of a wait bounded by a deadline or a CancelToken */
+enum class WaitStatus {
+    Ready,
+    Timeout,
+    Cancelled,
+};
+
+#endif /* _TIMER_HH_ */
@@ -0,0 +1,28 @@
+#ifndef _WAITABLE_HH_
+#define _WAITABLE_HH_
+
+#include "util.hh"
+
+class Task;
+using TaskPtr = DerivedRefPtr<Task>;
+
+/* Something a Task can park on (TaskGroup, co_mutex, ...).
+ *
+ * A parking task cannot be put into a wait list by itself: a waker
+ * on another thread could resume it while it is still running on its
+ * stack. So the task only records the Waitable in Task::blockedBy and
+ * switches out, then the scheduler calls resumeIfNothingToWait() on
+ * its behalf.
+ */
+class Waitable {
+public:
+    /* called by the scheduler once the task has switched out:
+     * return true if the task is runnable right away, otherwise
+     * take ptr over and make it runnable later, through
+     * GlobalMediator::wakeUp() */
+    virtual bool resumeIfNothingToWait(TaskPtr &ptr) = 0;
+protected:
+    ~Waitable() = default;
+};
+
+#endif /* _WAITABLE_HH_ */
@@ -125,6 +125,67 @@ func complex_scheduling_test(test_size int, num int) {
             test_size, num, deltaf, deltaf_nano / float32(test_size * num))
 }
 
+func chan_ping_pong_test(rounds int) {
+    ping := make(chan int)
+    pong := make(chan int)
+    done := make(chan bool)
+    start := time.Now()
+
+    go func() {
+        for i := 0; i < rounds; i++ {
+            v := <-ping
+            pong <- v + 1
+        }
+        done <- true
+    } ()
+
+    v := 0
+    for i := 0; i < rounds; i++ {
+        ping <- v
+        v = <-pong
+    }
+    <-done
+    delta := time.Now().Sub(start)
+    deltaf_nano := float32(delta / time.Nanosecond)
+    deltaf := deltaf_nano / 1000000
+    fmt.Printf("<Go  :chan_ping_pong:rounds:%-8d> duration:%-9.3fms, %-7.3f ns/op\n", rounds, deltaf, deltaf_nano / float32(rounds))
+}
+
+func chan_pipeline_test(stages int, items int, capacity int) {
+    chans := make([]chan int, stages + 1)
+    for i := range chans {
+        chans[i] = make(chan int, capacity)
+    }
+    start := time.Now()
+
+    for s := 0; s < stages; s++ {
+        go func(s int) {
+            for v := range chans[s] {
+                chans[s + 1] <- v + 1
+            }
+            close(chans[s + 1])
+        } (s)
+    }
+
+    go func() {
+        for i := 0; i < items; i++ {
+            chans[0] <- i
+        }
+        close(chans[0])
+    } ()
+
+    sum := 0
+    for v := range chans[stages] {
+        sum += v
+    }
+    fake_sum += sum
+    delta := time.Now().Sub(start)
+    deltaf_nano := float32(delta / time.Nanosecond)
+    deltaf := deltaf_nano / 1000000
+    fmt.Printf("<Go  :chan_pipeline:%-4dstages:%-8ditems:cap:%-4d> duration:%-9.3fms, %-7.3f ns/op\n",
+            stages, items, capacity, deltaf, deltaf_nano / float32(stages * items))
+}
+
 
 func main() {
     massive_yield_test(100)
@@ -142,6 +203,11 @@ func main() {
     complex_scheduling_test(10000, 1000)
     complex_scheduling_test(100000, 100)
 
+    chan_ping_pong_test(1000000)
+    chan_pipeline_test(10, 100000, 0)
+    chan_pipeline_test(10, 100000, 128)
+    chan_pipeline_test(100, 10000, 128)
+
 //    dense_mat_mut_test(4)
 //    dense_mat_mut_test(40)
 //    dense_mat_mut_test(400)
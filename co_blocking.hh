@@ -0,0 +1,108 @@
+#ifndef _CO_BLOCKING_HH_
+#define _CO_BLOCKING_HH_
+
+#include "util.hh"
+#include "BlockingPool.hh"
+#include "GlobalMediator.hh"
+#include "Waitable.hh"
+#include "Task.hh"
+
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/* parks the calling task while invoke() runs in the BlockingPool */
+class BlockingCallBase : public Waitable, public BlockingPool::Job {
+public:
+    bool resumeIfNothingToWait(TaskPtr &ptr) override {
+        task = std::move(ptr);
+        BlockingPool::Instance().submit(this);
+        return false;
+    }
+
+    void run() override {
+        invoke();
+        /* *this is gone once the task is resumed */
+        TaskPtr ptr = std::move(task);
+        globalMediator.wakeUpForeign(std::move(ptr));
+    }
+protected:
+    ~BlockingCallBase() = default;
+
+    /* on a pool thread */
+    virtual void invoke() = 0;
+
+    void call() {
+        co_currentTask->parkOn(this);
+    }
+private:
+    TaskPtr task;
+};
+
+template<class Fn, class R>
+class BlockingCall : public BlockingCallBase {
+public:
+    explicit BlockingCall(Fn &fn)
+        : fn(fn)
+    {}
+
+    R get() {
+        call();
+        R &value = *reinterpret_cast<R*>(result);
+        R res(std::move(value));
+        value.~R();
+        return res;
+    }
+protected:
+    void invoke() override {
+        new (result) R(fn());
+    }
+private:
+    Fn &fn;
+    alignas(R) unsigned char result[sizeof(R)];
+};
+
+template<class Fn>
+class BlockingCall<Fn, void> : public BlockingCallBase {
+public:
+    explicit BlockingCall(Fn &fn)
+        : fn(fn)
+    {}
+
+    void get() {
+        call();
+    }
+protected:
+    void invoke() override {
+        fn();
+    }
+private:
+    Fn &fn;
+};
+
+/* Run a call that blocks (DNS, compression, a legacy client...) on
+ * an OS thread of the BlockingPool, and return its result. The task
+ * parks meanwhile, its worker goes on running other tasks; the pool
+ * grows with the calls in flight, see BlockingPool. fn also gets a
+ * full thread stack, not the task's.
+ *
+ * For non-pure tasks only. fn must not throw, nor use the runtime
+ * (co_* calls, go(), ...): it does not run in a task. The arguments
+ * are forwarded, not copied: the task is parked until fn returns, so
+ * fn may take them by reference.
+ *
+ *     addrinfo *res;
+ *     int rc = co_blocking(getaddrinfo, host, "80", nullptr, &res);
+ */
+template<class Fn, class... Args>
+auto
+co_blocking(Fn&& callback, Args&&... args)
+{
+    auto fn = [&] () -> decltype(auto) {
+        return std::forward<Fn>(callback)(std::forward<Args>(args)...);
+    };
+    using R = std::decay_t<decltype(fn())>;
+    return BlockingCall<decltype(fn), R>(fn).get();
+}
+
+#endif /* _CO_BLOCKING_HH_ */
@@ -0,0 +1,85 @@
+#include "co_user.hh"
+#include "co_blocking.hh"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+constexpr int num_of_calls = 32;
+constexpr int sleep_ms = 50;
+
+int add(int a, int b) {
+    return a + b;
+}
+
+void append(std::string &s, std::unique_ptr<char> c) {
+    s += *c;
+}
+
+void result_test() {
+    int sum = co_blocking(add, 1, 2);
+    assert(sum == 3);
+    std::string s = co_blocking([] () { return std::string(1000, 'x'); });
+    assert(s.size() == 1000);
+
+    /* forwarded: by reference, and move-only */
+    co_blocking(append, s, std::unique_ptr<char>(new char('y')));
+    assert(s.size() == 1001 && s.back() == 'y');
+
+    /* not on the worker thread */
+    std::thread::id worker = std::this_thread::get_id(), caller;
+    co_blocking([&caller] () { caller = std::this_thread::get_id(); });
+    assert(caller != worker);
+    printf("result_test passed.\n");
+}
+
+/* the calls sleep side by side in the pool, the workers keep running */
+void overlap_test() {
+    std::atomic<bool> done = {false};
+    long ticks = 0;
+    TaskBundle ticker, sleepers;
+
+    ticker.registe(go([&done, &ticks] () {
+        while ( !done ) {
+            ++ticks;
+            co_yield;
+        }
+    }));
+
+    auto start = std::chrono::steady_clock::now();
+    for ( int i = 0; i < num_of_calls; ++i ) {
+        sleepers.registe(go([] () {
+            int r = co_blocking(usleep, sleep_ms * 1000);
+            assert(r == 0);
+        }));
+    }
+    sleepers.wait();
+    auto period = std::chrono::steady_clock::now() - start;
+    done = true;
+    ticker.wait();
+
+    /* one after the other, they would take num_of_calls * sleep_ms */
+    assert(period < std::chrono::milliseconds(num_of_calls * sleep_ms / 2));
+    assert(ticks > num_of_calls);
+    printf("overlap_test passed: %d calls of %d ms in %.1lf ms, %ld ticks meanwhile\n",
+            num_of_calls, sleep_ms,
+            std::chrono::duration<double, std::milli>(period).count(), ticks);
+}
+
+int main() {
+    co_init();
+
+    go([] () {
+        for ( auto test : {result_test, overlap_test} ) {
+            TaskBundle().registe(go(test)).wait();
+        }
+        co_terminate();
+    });
+
+    co_mainloop();
+}
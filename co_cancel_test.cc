@@ -0,0 +1,175 @@
+#include "co_user.hh"
+#include "co_chan.hh"
+
+#include <stdio.h>
+#include <cassert>
+#include <chrono>
+#include <atomic>
+
+using namespace std::chrono;
+
+constexpr int num_of_children = 10;
+
+void tree_test() {
+    CancelTokenPtr token = makeRefPtr<CancelToken>();
+    chan<int> never;
+    std::atomic<int> stopped = {0};
+    TaskBundle bundle;
+
+    bundle.registe(go_cancellable(token, [&never, &stopped] () {
+        TaskBundle children;
+        for ( int i = 0; i < num_of_children; ++i ) {
+            /* inherited by children and grandchildren */
+            children.registe(go([&never, &stopped, i] () {
+                assert(co_cancel_token());
+                TaskBundle grandchildren;
+                grandchildren.registe(go([&never, &stopped] () {
+                    int v;
+                    bool ok = never.recv(v);
+                    assert(!ok);
+                    ++stopped;
+                }));
+                grandchildren.registe(go([&stopped] () {
+                    co_sleep_for(hours(1));
+                    ++stopped;
+                }));
+                if ( i % 2 ) {
+                    while ( !co_cancelled() ) {
+                        co_yield;
+                    }
+                } else {
+                    co_select sel;
+                    int v;
+                    int r = sel.recv(never, v).timeout(hours(1)).wait();
+                    assert(r == co_select::Cancelled);
+                }
+                grandchildren.wait();
+                ++stopped;
+            }));
+        }
+        children.wait();
+    }));
+
+    co_sleep_for(milliseconds(5));
+    assert(stopped == 0);
+    auto start = steady_clock::now();
+    token->cancel();
+    /* the cancelled waits of the tree return before the tasks
+     * they waited for, which are stopping on their own */
+    bundle.wait();
+    while ( stopped != 3 * num_of_children ) {
+        assert(steady_clock::now() - start < seconds(1));
+        co_sleep_for(milliseconds(1));
+    }
+
+    /* waits of a cancelled task return at once */
+    TaskBundle().registe(go_cancellable(token, [&never] () {
+        int v;
+        assert(co_cancelled());
+        bool ok = never.recv(v);
+        assert(!ok);
+        ok = never.send(1);
+        assert(!ok);
+    })).wait();
+    printf("tree_test passed.\n");
+}
+
+void subtree_test() {
+    CancelTokenPtr parent = makeRefPtr<CancelToken>();
+    CancelTokenPtr child = makeRefPtr<CancelToken>(parent);
+    chan<int> ch;
+    TaskBundle bundle;
+
+    bundle.registe(go_cancellable(parent, [&ch] () {
+        int v;
+        bool ok = ch.recv(v);
+        assert(ok && v == 1);
+    }));
+    bundle.registe(go_cancellable(child, [&ch] () {
+        int v;
+        bool ok = ch.recv(v);
+        assert(!ok);
+    }));
+    co_sleep_for(milliseconds(1));
+
+    /* cancelling a child leaves its parent alone, the
+     * cancelled receiver is skipped by the sender */
+    child->cancel();
+    assert(!parent->cancelled());
+    bool sent = ch.send(1);
+    assert(sent);
+    bundle.wait();
+
+    CancelTokenPtr late = makeRefPtr<CancelToken>(parent);
+    parent->cancel();
+    assert(late->cancelled() && child->cancelled());
+    assert(makeRefPtr<CancelToken>(parent)->cancelled());
+    printf("subtree_test passed.\n");
+}
+
+void group_wait_test() {
+    CancelTokenPtr token = makeRefPtr<CancelToken>();
+    CancelTokenPtr other = makeRefPtr<CancelToken>();
+    chan<int> ch;
+    TaskHandle worker;
+    std::atomic<bool> returned = {false};
+
+    TaskBundle bundle;
+    bundle.registe(go_cancellable(token, [&] () {
+        worker = go_cancellable(other, [&ch] () {
+            int v;
+            bool ok = ch.recv(v);
+            assert(ok && v == 1);
+        });
+        TaskBundle workers;
+        workers.registe(worker);
+        WaitStatus st = workers.wait();
+        assert(st == WaitStatus::Cancelled);
+        st = workers.wait_for(hours(1));
+        assert(st == WaitStatus::Cancelled);
+        returned = true;
+    }));
+    co_sleep_for(milliseconds(5));
+    assert(!returned);
+
+    /* the waiter returns, the worker with another token goes on */
+    token->cancel();
+    bundle.wait();
+    assert(returned);
+    bool sent = ch.send(1);
+    assert(sent);
+    WaitStatus st = TaskBundle().registe(worker).wait();
+    assert(st == WaitStatus::Ready);
+
+    /* a timed wait parked on the token */
+    bundle.registe(go_cancellable(token = makeRefPtr<CancelToken>(), [] () {
+        TaskBundle sleepers;
+        sleepers.registe(go_cancellable(makeRefPtr<CancelToken>(), [] () {
+            co_sleep_for(milliseconds(50));
+        }));
+        WaitStatus st = sleepers.wait_for(hours(1));
+        assert(st == WaitStatus::Cancelled);
+        st = sleepers.wait();
+        assert(st == WaitStatus::Cancelled);
+    }));
+    co_sleep_for(milliseconds(5));
+    auto start = steady_clock::now();
+    token->cancel();
+    bundle.wait();
+    assert(steady_clock::now() - start < milliseconds(40));
+    printf("group_wait_test passed.\n");
+}
+
+int main() {
+    co_init();
+
+    go([] () {
+        /* one task each, their frames do not add up on a 4KB stack */
+        for ( auto test : {tree_test, subtree_test, group_wait_test} ) {
+            TaskBundle().registe(go(test)).wait();
+        }
+        co_terminate();
+    });
+
+    co_mainloop();
+}
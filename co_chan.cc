@@ -0,0 +1,279 @@
+#include "co_chan.hh"
+#include "GlobalMediator.hh"
+#include "IntrusiveQueue.hh"
+#include "Task.hh"
+#include "debug.hh"
+
+#include <algorithm>
+#include <mutex>
+#include <utility>
+
+struct ChanBase::Parker : public Waitable {
+    ChanBase    *ch;
+    ChanWaiter  w;
+
+    bool resumeIfNothingToWait(TaskPtr &ptr) override {
+        return ch->enqueue(&w, ptr);
+    }
+};
+
+void
+ChanBase::close()
+{
+    IntrusiveQueue<Task> woken;
+    {
+        std::lock_guard<Spinlock> _(mut_);
+        MUST_TRUE(!closed, "close a closed chan");
+        closed = true;
+
+        TaskPtr toWake;
+        for ( ChanWaitQueue *q : {&sendq, &recvq} ) {
+            while ( ChanWaiter *w = popWaiter(*q) ) {
+                complete(w, false, toWake);
+                woken.push(std::move(toWake));
+            }
+        }
+    }
+    while ( TaskPtr next = woken.pop() ) {
+        globalMediator.wakeUp(std::move(next));
+    }
+}
+
+ChanWaiter*
+ChanBase::popWaiter(ChanWaitQueue &q)
+{
+    while ( ChanWaiter *w = q.pop() ) {
+        /* a lost select's waiter is just dropped */
+        if ( !w->sel || w->sel->claim(w->caseIndex) ) {
+            return w;
+        }
+    }
+    return nullptr;
+}
+
+void
+ChanBase::complete(ChanWaiter *w, bool ok, TaskPtr &toWake)
+{
+    w->ok = ok;
+    toWake = w->sel ? std::move(w->sel->task) : std::move(w->task);
+}
+
+bool
+ChanBase::park(void *slot, bool isSend)
+{
+    if ( co_currentTask->cancelToken ) {
+        /* only a select can be claimed by a cancel */
+        co_select sel;
+        sel.addCase(this, slot, isSend);
+        return sel.wait() == 0 && sel.ok();
+    }
+
+    Parker p;
+    p.ch = this;
+    p.w.slot = slot;
+    p.w.isSend = isSend;
+    co_currentTask->parkOn(&p);
+    return p.w.ok;
+}
+
+/* called by the scheduler after the task switched out,
+ * the fast path may have missed a peer in between */
+bool
+ChanBase::enqueue(ChanWaiter *w, TaskPtr &ptr)
+{
+    TaskPtr toWake;
+    Result r;
+    {
+        std::lock_guard<Spinlock> _(mut_);
+        r = tryLocked(w, toWake);
+        if ( r == WouldBlock ) {
+            w->task = std::move(ptr);
+            (w->isSend ? sendq : recvq).push(w);
+        }
+    }
+    wake(toWake);
+    if ( r == WouldBlock ) {
+        return false;
+    }
+    w->ok = r == Done;
+    ptr->state = Task::Runnable;
+    return true;
+}
+
+class co_select::SelectTimer : public Timer {
+public:
+    SelectTimer(co_select *sel, clock::time_point deadline)
+        : Timer(deadline)
+        , sel(sel)
+    {}
+protected:
+    void fire() override {
+        if ( sel->claim(Timeout) ) {
+            globalMediator.wakeUp(std::move(sel->task));
+        }
+    }
+private:
+    co_select   *sel;
+};
+
+co_select&
+co_select::addCase(ChanBase *ch, void *slot, bool isSend)
+{
+    MUST_TRUE(numCases < max_cases, "co_select takes at most %d cases", max_cases);
+    Case &c = cases[numCases++];
+    c.ch = ch;
+    c.w.slot = slot;
+    c.w.isSend = isSend;
+
+    /* keep locks sorted and unique, a select may
+     * both send and receive on one channel */
+    ChanBase **pos = std::lower_bound(locks, locks + numLocks, ch);
+    if ( pos == locks + numLocks || *pos != ch ) {
+        std::copy_backward(pos, locks + numLocks, locks + numLocks + 1);
+        *pos = ch;
+        ++numLocks;
+    }
+    return *this;
+}
+
+void
+co_select::lockAll()
+{
+    for ( int i = 0; i < numLocks; ++i ) {
+        locks[i]->mut_.lock();
+    }
+}
+
+void
+co_select::unlockAll()
+{
+    for ( int i = numLocks - 1; i >= 0; --i ) {
+        locks[i]->mut_.unlock();
+    }
+}
+
+int
+co_select::tryCases(TaskPtr &toWake)
+{
+    /* rotate the first case tried, so that
+     * a busy case cannot starve the others */
+    static thread_local unsigned rotation = 0;
+    int start = numCases ? rotation++ % numCases : 0;
+
+    for ( int k = 0; k < numCases; ++k ) {
+        int i = start + k < numCases ? start + k : start + k - numCases;
+        Case &c = cases[i];
+        ChanBase::Result r = c.ch->tryLocked(&c.w, toWake);
+        if ( r != ChanBase::WouldBlock ) {
+            c.w.ok = r == ChanBase::Done;
+            return i;
+        }
+    }
+    return None;
+}
+
+int
+co_select::try_wait()
+{
+    TaskPtr toWake;
+    lockAll();
+    result = tryCases(toWake);
+    unlockAll();
+    ChanBase::wake(toWake);
+    return result;
+}
+
+int
+co_select::wait()
+{
+    if ( try_wait() != None ) {
+        return result;
+    }
+    MUST_TRUE(numCases > 0 || hasDeadline, "co_select waits for nothing");
+
+    CancelToken *token = co_currentTask->cancelToken.get();
+    if ( token && !token->addWaiter(this) ) {
+        result = Cancelled;
+        return result;
+    }
+
+    co_currentTask->parkOn(this);
+    result = winner.load(std::memory_order_acquire);
+
+    if ( token ) {
+        /* waits for a running onCancel() */
+        token->removeWaiter(this);
+    }
+
+    if ( timer ) {
+        /* a firing timer may still touch this select */
+        timer->cancel();
+        timer = nullptr;
+    }
+    if ( numCases > 0 ) {
+        /* take the losing waiters off their lists */
+        lockAll();
+        for ( int i = 0; i < numCases; ++i ) {
+            Case &c = cases[i];
+            (c.w.isSend ? c.ch->sendq : c.ch->recvq).remove(&c.w);
+        }
+        unlockAll();
+    }
+    return result;
+}
+
+void
+co_select::onCancel()
+{
+    /* the parking hook resumes the task if it is not parked yet */
+    if ( claim(Cancelled) &&
+            parked_.exchange(CancelClaimed, std::memory_order_acq_rel) == Parked ) {
+        globalMediator.wakeUp(std::move(task));
+    }
+}
+
+bool
+co_select::resumeIfNothingToWait(TaskPtr &ptr)
+{
+    TaskPtr toWake;
+    lockAll();
+    int r = tryCases(toWake);
+    if ( r == None ) {
+        if ( hasDeadline ) {
+            /* fires on this thread, not before this hook returns */
+            timer = TimerPtr(new SelectTimer(this, deadline));
+            globalMediator.getThisPerThreadMgr()->addTimer(TimerPtr(timer));
+        }
+        task = std::move(ptr);
+        for ( int i = 0; i < numCases; ++i ) {
+            Case &c = cases[i];
+            c.w.sel = this;
+            c.w.caseIndex = i;
+            (c.w.isSend ? c.ch->sendq : c.ch->recvq).push(&c.w);
+        }
+
+        /* a cancel may resume the task from now on, which ends the
+         * select: unlock through a copy of the locks */
+        ChanBase *held[max_cases];
+        int numHeld = numLocks;
+        std::copy(locks, locks + numLocks, held);
+        if ( parked_.exchange(Parked, std::memory_order_acq_rel) == CancelClaimed ) {
+            /* cancelled before parking, nobody else can claim now */
+            ptr = std::move(task);
+        }
+        for ( int i = numHeld - 1; i >= 0; --i ) {
+            held[i]->mut_.unlock();
+        }
+        if ( !ptr ) {
+            return false;
+        }
+        ptr->state = Task::Runnable;
+        return true;
+    }
+    unlockAll();
+    ChanBase::wake(toWake);
+
+    winner.store(r, std::memory_order_relaxed);
+    ptr->state = Task::Runnable;
+    return true;
+}
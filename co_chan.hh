@@ -0,0 +1,404 @@
+#ifndef _CO_CHAN_HH_
+#define _CO_CHAN_HH_
+
+#include "util.hh"
+#include "debug.hh"
+#include "Spinlock.hh"
+#include "Waitable.hh"
+#include "Task.hh"
+#include "Timer.hh"
+#include "CancelToken.hh"
+#include "GlobalMediator.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <new>
+#include <mutex>
+#include <utility>
+
+class co_select;
+
+/* a parked send or recv, lives on the parked task's stack */
+struct ChanWaiter {
+    /* the value to send, or where to receive */
+    void        *slot = nullptr;
+    bool        isSend = false;
+    bool        ok = false;
+    bool        queued = false;
+    int         caseIndex = 0;
+
+    /* a plain send/recv holds its task, a select's waiters share
+     * the select's task and must win the select to complete */
+    TaskPtr     task;
+    co_select   *sel = nullptr;
+
+    ChanWaiter  *next = nullptr;
+    ChanWaiter  *prev = nullptr;
+};
+
+/* FIFO of waiters, doubly linked so that a select can take its
+ * losing waiters out of the middle */
+struct ChanWaitQueue {
+    ChanWaiter  *head = nullptr;
+    ChanWaiter  *tail = nullptr;
+
+    void push(ChanWaiter *w) {
+        w->next = nullptr;
+        w->prev = tail;
+        if ( tail ) {
+            tail->next = w;
+        } else {
+            head = w;
+        }
+        tail = w;
+        w->queued = true;
+    }
+    ChanWaiter *pop() {
+        ChanWaiter *w = head;
+        if ( w ) {
+            remove(w);
+        }
+        return w;
+    }
+    /* nothing if w is not queued */
+    void remove(ChanWaiter *w) {
+        if ( !w->queued ) {
+            return;
+        }
+        if ( w->prev ) {
+            w->prev->next = w->next;
+        } else {
+            head = w->next;
+        }
+        if ( w->next ) {
+            w->next->prev = w->prev;
+        } else {
+            tail = w->prev;
+        }
+        w->next = w->prev = nullptr;
+        w->queued = false;
+    }
+};
+
+/* The element type independent part of chan<T>: wait lists, close()
+ * and parking. co_select works on channels through it.
+ */
+class ChanBase : public NonCopyable {
+    friend class co_select;
+public:
+    /* parked senders and receivers return false */
+    void close();
+protected:
+    enum Result {
+        Done,
+        Closed,
+        WouldBlock,
+    };
+
+    ~ChanBase() = default;
+
+    /* under mut_: complete the operation of w right away if possible,
+     * tasks it unblocks go to toWake */
+    virtual Result tryLocked(ChanWaiter *w, TaskPtr &toWake) = 0;
+
+    /* under mut_: the first waiter of q that can still complete,
+     * a select's waiter only if this claims the select */
+    static ChanWaiter *popWaiter(ChanWaitQueue &q);
+    static void complete(ChanWaiter *w, bool ok, TaskPtr &toWake);
+    static void wake(TaskPtr &toWake) {
+        if ( toWake ) {
+            globalMediator.wakeUp(std::move(toWake));
+        }
+    }
+
+    /* park the current task until the operation completes */
+    bool park(void *slot, bool isSend);
+
+    bool                closed = false;
+
+    /* guards everything in the channel */
+    Spinlock            mut_;
+    ChanWaitQueue       sendq;
+    ChanWaitQueue       recvq;
+private:
+    struct Parker;
+    bool enqueue(ChanWaiter *w, TaskPtr &ptr);
+};
+
+/* Go-style channel between tasks.
+ *
+ * chan<T>(0) is unbuffered: send() parks until a receiver takes the
+ * value. chan<T>(n) buffers up to n values. Whenever the other side
+ * is already parked, the value is moved directly between the two
+ * tasks' stacks and the parked task is made runnable, without a
+ * round trip through the buffer.
+ *
+ * send() returns false if the channel is closed, recv() returns false
+ * once the channel is closed and drained. Both also return false if
+ * the task is cancelled while parked, see CancelToken. Like the other co_*
+ * primitives, blocking calls must not be made from pure tasks.
+ */
+template<class T>
+class chan : public ChanBase {
+public:
+    explicit chan(std::size_t capacity = 0)
+        : capacity(capacity)
+        , ring(capacity ? static_cast<T*>(::operator new(capacity * sizeof(T))) : nullptr)
+    {}
+
+    ~chan() {
+        while ( count > 0 ) {
+            popFront();
+        }
+        ::operator delete(ring);
+    }
+
+    bool send(T value) {
+        TaskPtr toWake;
+        Result r;
+        {
+            std::lock_guard<Spinlock> _(mut_);
+            r = sendLocked(value, toWake);
+        }
+        if ( r == WouldBlock ) {
+            return park(&value, true);
+        }
+        wake(toWake);
+        return r == Done;
+    }
+
+    bool recv(T &out) {
+        TaskPtr toWake;
+        Result r;
+        {
+            std::lock_guard<Spinlock> _(mut_);
+            r = recvLocked(out, toWake);
+        }
+        if ( r == WouldBlock ) {
+            return park(&out, false);
+        }
+        wake(toWake);
+        return r == Done;
+    }
+
+    /* never park, false if the value could not be sent right away */
+    bool try_send(T value) {
+        TaskPtr toWake;
+        Result r;
+        {
+            std::lock_guard<Spinlock> _(mut_);
+            r = sendLocked(value, toWake);
+        }
+        wake(toWake);
+        return r == Done;
+    }
+
+    bool try_recv(T &out) {
+        TaskPtr toWake;
+        Result r;
+        {
+            std::lock_guard<Spinlock> _(mut_);
+            r = recvLocked(out, toWake);
+        }
+        wake(toWake);
+        return r == Done;
+    }
+
+    std::size_t size() {
+        std::lock_guard<Spinlock> _(mut_);
+        return count;
+    }
+private:
+    Result tryLocked(ChanWaiter *w, TaskPtr &toWake) override {
+        T &value = *static_cast<T*>(w->slot);
+        return w->isSend ? sendLocked(value, toWake) : recvLocked(value, toWake);
+    }
+
+    Result sendLocked(T &value, TaskPtr &toWake) {
+        if ( closed ) {
+            return Closed;
+        }
+        if ( ChanWaiter *w = popWaiter(recvq) ) {
+            /* direct hand-off to a parked receiver */
+            *static_cast<T*>(w->slot) = std::move(value);
+            complete(w, true, toWake);
+            return Done;
+        }
+        if ( count < capacity ) {
+            pushBack(value);
+            return Done;
+        }
+        return WouldBlock;
+    }
+
+    Result recvLocked(T &out, TaskPtr &toWake) {
+        if ( count > 0 ) {
+            out = std::move(ring[head]);
+            popFront();
+            /* the freed buffer slot goes to the first parked sender */
+            if ( ChanWaiter *w = popWaiter(sendq) ) {
+                pushBack(*static_cast<T*>(w->slot));
+                complete(w, true, toWake);
+            }
+            return Done;
+        }
+        if ( ChanWaiter *w = popWaiter(sendq) ) {
+            /* unbuffered, direct hand-off from a parked sender */
+            out = std::move(*static_cast<T*>(w->slot));
+            complete(w, true, toWake);
+            return Done;
+        }
+        return closed ? Closed : WouldBlock;
+    }
+
+    void pushBack(T &value) {
+        std::size_t tail = head + count;
+        if ( tail >= capacity ) {
+            tail -= capacity;
+        }
+        new (&ring[tail]) T(std::move(value));
+        ++count;
+    }
+
+    void popFront() {
+        ring[head].~T();
+        if ( ++head == capacity ) {
+            head = 0;
+        }
+        --count;
+    }
+
+    const std::size_t   capacity;
+
+    /* buffered values, count of them from ring[head] on, wrapping;
+     * kept small as chans often live on 4KB task stacks */
+    T                   *ring;
+    std::size_t         head = 0;
+    std::size_t         count = 0;
+};
+
+/* Waits on several channel operations and an optional timeout, and
+ * completes exactly one of them:
+ *
+ *     int v;
+ *     co_select sel;
+ *     switch ( sel.recv(a, v).send(b, w).timeout(std::chrono::milliseconds(10)).wait() ) {
+ *     case 0:                  ... v received from a, or a closed if !sel.ok()
+ *     case 1:                  ... w sent to b
+ *     case co_select::Timeout: ...
+ *     }
+ *
+ * The task parks with one waiter per case on the channels' wait lists.
+ * The first peer (or the timer) to claim the select wins, the other
+ * waiters are inert from then on and are taken off their lists when
+ * the task resumes. A co_select is used for one wait() only.
+ *
+ * If the task carries a CancelToken, cancelling it claims the select
+ * too: wait() returns Cancelled.
+ */
+class co_select : public Waitable, private CancelToken::Waiter, public NonCopyable {
+public:
+    enum {
+        Timeout = -1,
+
+        /* try_wait(): no case is ready */
+        None = -2,
+
+        Cancelled = -3,
+    };
+
+    /* cases live on the task's stack, keep them few */
+    static constexpr int max_cases = 4;
+
+    template<class T>
+    co_select &recv(chan<T> &ch, T &out) {
+        return addCase(&ch, &out, false);
+    }
+
+    /* value is moved from only if this case is chosen */
+    template<class T>
+    co_select &send(chan<T> &ch, T &value) {
+        return addCase(&ch, &value, true);
+    }
+
+    template<class Rep, class Period>
+    co_select &timeout(std::chrono::duration<Rep, Period> const &d) {
+        hasDeadline = true;
+        deadline = Timer::clock::now() + std::chrono::duration_cast<Timer::clock::duration>(d);
+        return *this;
+    }
+
+    /* the index of the completed case, or Timeout */
+    int wait();
+
+    /* never park, None if no case is ready */
+    int try_wait();
+
+    /* false if the completed case found its channel closed */
+    bool ok() const {
+        return result >= 0 && cases[result].w.ok;
+    }
+
+    bool resumeIfNothingToWait(TaskPtr &ptr) override;
+private:
+    friend class ChanBase;
+    class SelectTimer;
+
+    enum {
+        Undecided = -4,
+    };
+
+    /* parked_: whether cancel or the parking hook resumes the task */
+    enum {
+        Running,
+        CancelClaimed,
+        Parked,
+    };
+
+    void onCancel() override;
+
+    struct Case {
+        ChanBase    *ch = nullptr;
+        ChanWaiter  w;
+    };
+
+    co_select &addCase(ChanBase *ch, void *slot, bool isSend);
+
+    /* the channels' locks, in address order */
+    void lockAll();
+    void unlockAll();
+
+    /* under lockAll(): complete the first ready case */
+    int tryCases(TaskPtr &toWake);
+
+    /* the winner takes the parked task */
+    bool claim(int res) {
+        int s = Undecided;
+        return winner.compare_exchange_strong(s, res, std::memory_order_acq_rel);
+    }
+
+    Case                        cases[max_cases];
+    int                         numCases = 0;
+    ChanBase                    *locks[max_cases];
+    int                         numLocks = 0;
+
+    std::atomic<int>            winner = {Undecided};
+    std::atomic<int>            parked_ = {Running};
+    int                         result = None;
+    TaskPtr                     task;
+
+    bool                        hasDeadline = false;
+    Timer::clock::time_point    deadline;
+    TimerPtr                    timer;
+};
+
+/* park the current task for at least d */
+template<class Rep, class Period>
+void
+co_sleep_for(std::chrono::duration<Rep, Period> const &d)
+{
+    co_select().timeout(d).wait();
+}
+
+#endif /* _CO_CHAN_HH_ */
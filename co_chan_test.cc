@@ -0,0 +1,202 @@
+#include "co_user.hh"
+#include "co_chan.hh"
+
+#include <stdio.h>
+#include <cassert>
+#include <string>
+#include <chrono>
+
+constexpr int num_of_items = 10000;
+
+void unbuffered_test() {
+    chan<int> ch;
+    long sum = 0;
+    TaskBundle bundle;
+
+    bundle.registe(go([&ch] () {
+        for ( int i = 0; i < num_of_items; ++i ) {
+            bool sent = ch.send(i);
+            assert(sent);
+        }
+        ch.close();
+    }));
+    bundle.registe(go([&ch, &sum] () {
+        int v, expected = 0;
+        while ( ch.recv(v) ) {
+            /* a single sender keeps the order */
+            assert(v == expected);
+            ++expected;
+            sum += v;
+        }
+    }));
+    bundle.wait();
+
+    assert(sum == (long)num_of_items * (num_of_items - 1) / 2);
+    bool sent = ch.send(0);
+    assert(!sent);
+    printf("unbuffered_test passed.\n");
+}
+
+void buffered_test() {
+    constexpr int num_of_producers = 10;
+    chan<std::string> ch(16);
+    chan<long> sums;
+    TaskBundle producers, consumers;
+
+    for ( int p = 0; p < num_of_producers; ++p ) {
+        producers.registe(go([&ch] () {
+            for ( int i = 0; i < num_of_items; ++i ) {
+                ch.send(std::to_string(i));
+            }
+        }));
+    }
+    for ( int c = 0; c < 3; ++c ) {
+        consumers.registe(go([&ch, &sums] () {
+            std::string s;
+            long sum = 0;
+            while ( ch.recv(s) ) {
+                sum += std::stol(s);
+            }
+            sums.send(sum);
+        }));
+    }
+
+    producers.wait();
+    ch.close();
+
+    long total = 0, sum;
+    for ( int c = 0; c < 3; ++c ) {
+        bool ok = sums.recv(sum);
+        assert(ok);
+        total += sum;
+    }
+    consumers.wait();
+
+    assert(total == (long)num_of_producers * num_of_items * (num_of_items - 1) / 2);
+    assert(ch.size() == 0);
+    printf("buffered_test passed.\n");
+}
+
+void try_test() {
+    chan<int> ch(1);
+    int v;
+
+    bool ok = ch.try_recv(v);
+    assert(!ok);
+    ok = ch.try_send(1);
+    assert(ok);
+    ok = ch.try_send(2);
+    assert(!ok);
+    ok = ch.try_recv(v);
+    assert(ok && v == 1);
+    ch.close();
+    ok = ch.try_send(3);
+    assert(!ok);
+    ok = ch.recv(v);
+    assert(!ok);
+    printf("try_test passed.\n");
+}
+
+void select_test() {
+    chan<int> a, b(4);
+    chan<bool> done;
+    long sumA = 0, sumB = 0;
+    TaskBundle bundle;
+
+    bundle.registe(go([&a] () {
+        for ( int i = 0; i < num_of_items; ++i ) {
+            a.send(i);
+        }
+    }));
+    bundle.registe(go([&b] () {
+        for ( int i = 0; i < num_of_items; ++i ) {
+            b.send(2 * i);
+        }
+    }));
+    bundle.registe(go([&done] () {
+        done.send(true);
+    }));
+
+    int va, vb, gotA = 0, gotB = 0;
+    bool d;
+    while ( gotA < num_of_items || gotB < num_of_items ) {
+        co_select sel;
+        switch ( sel.recv(a, va).recv(b, vb).wait() ) {
+        case 0:
+            sumA += va;
+            ++gotA;
+            break;
+        case 1:
+            sumB += vb;
+            ++gotB;
+            break;
+        default:
+            assert(false);
+        }
+    }
+    /* done is still pending, and select sends too */
+    int r = co_select().send(a, va).recv(done, d).wait();
+    assert(r == 1 && d);
+    bundle.wait();
+
+    assert(sumA == (long)num_of_items * (num_of_items - 1) / 2);
+    assert(sumB == 2 * sumA);
+    printf("select_test passed.\n");
+}
+
+void select_timeout_test() {
+    using namespace std::chrono;
+    chan<int> a, b;
+    int v;
+
+    auto start = steady_clock::now();
+    co_select sel;
+    int r = sel.recv(a, v).recv(b, v).timeout(milliseconds(20)).wait();
+    assert(r == co_select::Timeout && !sel.ok());
+    assert(steady_clock::now() - start >= milliseconds(20));
+
+    /* the timed out waiters are gone: an unbuffered
+     * send finds no receiver */
+    bool sentA = a.try_send(1);
+    bool sentB = b.try_send(1);
+    assert(!sentA && !sentB);
+
+    /* a winner before the deadline, the timer is cancelled */
+    go([&a] () {
+        co_sleep_for(milliseconds(1));
+        a.send(7);
+    });
+    r = co_select().recv(a, v).recv(b, v).timeout(seconds(10)).wait();
+    assert(r == 0 && v == 7);
+    sentB = b.try_send(1);
+    assert(!sentB);
+
+    /* closed channels complete the select with !ok() */
+    b.close();
+    co_select sel2;
+    r = sel2.recv(a, v).recv(b, v).wait();
+    assert(r == 1 && !sel2.ok());
+
+    r = co_select().recv(a, v).try_wait();
+    assert(r == co_select::None);
+
+    start = steady_clock::now();
+    co_sleep_for(milliseconds(5));
+    assert(steady_clock::now() - start >= milliseconds(5));
+    printf("select_timeout_test passed.\n");
+}
+
+int main() {
+    co_init();
+
+    go([] () {
+        /* one task each, their frames do not add up on a 4KB stack */
+        for ( auto test : {unbuffered_test, buffered_test, try_test,
+                select_test, select_timeout_test} ) {
+            TaskBundle().registe(go(test)).wait();
+        }
+        co_terminate();
+    });
+
+    co_mainloop();
+}
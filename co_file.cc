@@ -0,0 +1,103 @@
+#include "co_file.hh"
+#include "GlobalMediator.hh"
+#include "PerThreadMgr.hh"
+#include "BlockingPool.hh"
+#include "IoRing.hh"
+#include "Waitable.hh"
+#include "Task.hh"
+
+#include <linux/io_uring.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <algorithm>
+#include <climits>
+#include <utility>
+
+/* one call, on the stack of the parked task */
+class FileOp : public Waitable, public IoRing::Request, public BlockingPool::Job {
+public:
+    enum Op {
+        Read,
+        Write,
+        Fsync,
+    };
+
+    FileOp(Op op, int fd, void *buf, size_t count, off_t offset)
+        : op(op)
+        , fd(fd)
+        , buf(buf)
+        /* io_uring takes 32-bit lengths, a short count is fine */
+        , count(std::min<size_t>(count, INT_MAX))
+        , offset(offset)
+    {}
+
+    /* the syscall's return value, errno set */
+    long call() {
+        co_currentTask->parkOn(this);
+        if ( result < 0 ) {
+            errno = (int)-result;
+            return -1;
+        }
+        return result;
+    }
+
+    bool resumeIfNothingToWait(TaskPtr &ptr) override {
+        task = std::move(ptr);
+        IoRing *ring = globalMediator.getThisPerThreadMgr()->ioRing();
+        static const uint8_t opcodes[] = {IORING_OP_READ, IORING_OP_WRITE, IORING_OP_FSYNC};
+        if ( !ring || !ring->prepare(opcodes[op], fd, buf, (unsigned)count, offset, this) ) {
+            /* no ring, or a full one */
+            BlockingPool::Instance().submit(this);
+        }
+        return false;
+    }
+
+    void complete(int res) override {
+        result = res;
+        globalMediator.wakeUp(std::move(task));
+    }
+
+    void run() override {
+        long r;
+        switch ( op ) {
+        case Read:
+            r = ::pread(fd, buf, count, offset);
+            break;
+        case Write:
+            r = ::pwrite(fd, buf, count, offset);
+            break;
+        default:
+            r = ::fsync(fd);
+            break;
+        }
+        result = r < 0 ? -errno : r;
+        globalMediator.wakeUpForeign(std::move(task));
+    }
+private:
+    Op      op;
+    int     fd;
+    void    *buf;
+    size_t  count;
+    off_t   offset;
+    long    result = 0;
+    TaskPtr task;
+};
+
+ssize_t
+co_pread(int fd, void *buf, size_t count, off_t offset)
+{
+    return FileOp(FileOp::Read, fd, buf, count, offset).call();
+}
+
+ssize_t
+co_pwrite(int fd, void const *buf, size_t count, off_t offset)
+{
+    return FileOp(FileOp::Write, fd, const_cast<void*>(buf), count, offset).call();
+}
+
+int
+co_fsync(int fd)
+{
+    return (int)FileOp(FileOp::Fsync, fd, nullptr, 0, 0).call();
+}
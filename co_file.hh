@@ -0,0 +1,21 @@
+#ifndef _CO_FILE_HH_
+#define _CO_FILE_HH_
+
+#include "util.hh"
+
+#include <sys/types.h>
+
+/* File I/O for code running in tasks.
+ *
+ * Same results and errno as the syscalls, but the task parks while
+ * the I/O is in flight and the worker thread goes on running other
+ * tasks. The request goes to the worker's io_uring, or to the
+ * BlockingPool when io_uring is not available (YAMI_IO_URING=0 to
+ * force it). They must not be used by pure tasks.
+ */
+
+ssize_t co_pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t co_pwrite(int fd, void const *buf, size_t count, off_t offset);
+int co_fsync(int fd);
+
+#endif /* _CO_FILE_HH_ */
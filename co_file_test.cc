@@ -0,0 +1,93 @@
+#include "co_user.hh"
+#include "co_file.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <cassert>
+#include <vector>
+
+constexpr int num_of_blocks = 256;
+constexpr size_t block_size = 64 << 10;
+
+void fill(std::vector<char> &block, int i) {
+    for ( size_t j = 0; j < block.size(); ++j ) {
+        block[j] = (char)(i * 31 + j % 251);
+    }
+}
+
+/* every block written and read back by its own task */
+void readwrite_test() {
+    char path[] = "/tmp/co_file_test.XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    unlink(path);
+
+    TaskBundle writers;
+    for ( int i = 0; i < num_of_blocks; ++i ) {
+        writers.registe(go([fd, i] () {
+            std::vector<char> block(block_size);
+            fill(block, i);
+            size_t done = 0;
+            while ( done < block_size ) {
+                ssize_t r = co_pwrite(fd, block.data() + done, block_size - done,
+                        (off_t)(i * block_size + done));
+                assert(r > 0);
+                done += r;
+            }
+        }));
+    }
+    writers.wait();
+    int r = co_fsync(fd);
+    assert(r == 0);
+
+    TaskBundle readers;
+    for ( int i = 0; i < num_of_blocks; ++i ) {
+        readers.registe(go([fd, i] () {
+            std::vector<char> expected(block_size), block(block_size);
+            fill(expected, i);
+            size_t done = 0;
+            while ( done < block_size ) {
+                ssize_t r = co_pread(fd, block.data() + done, block_size - done,
+                        (off_t)(i * block_size + done));
+                assert(r > 0);
+                done += r;
+            }
+            assert(block == expected);
+        }));
+    }
+    readers.wait();
+
+    /* at the end of the file */
+    char c;
+    ssize_t n = co_pread(fd, &c, 1, (off_t)(num_of_blocks * block_size));
+    assert(n == 0);
+    close(fd);
+    printf("readwrite_test passed.\n");
+}
+
+void error_test() {
+    char c = 0;
+    ssize_t n = co_pread(-1, &c, 1, 0);
+    assert(n == -1 && errno == EBADF);
+    n = co_pwrite(-1, &c, 1, 0);
+    assert(n == -1 && errno == EBADF);
+    int r = co_fsync(-1);
+    assert(r == -1 && errno == EBADF);
+    printf("error_test passed.\n");
+}
+
+int main() {
+    co_init();
+
+    go([] () {
+        for ( auto test : {readwrite_test, error_test} ) {
+            TaskBundle().registe(go(test)).wait();
+        }
+        co_terminate();
+    });
+
+    co_mainloop();
+}
@@ -0,0 +1,152 @@
+#ifndef _CO_FUTURE_HH_
+#define _CO_FUTURE_HH_
+
+#include "util.hh"
+#include "Task.hh"
+#include "TaskGroup.hh"
+#include "GlobalMediator.hh"
+
+#include <chrono>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+/* The result of a task started by go_future().
+ *
+ * The value lives in the Task itself (inline if it takes at most a
+ * pointer, on the heap otherwise), so a future costs no allocation
+ * beyond the task's own. get() parks the caller until the task has
+ * terminated, and rethrows the std::exception it ended with, if any.
+ * Copies share the task and its result.
+ *
+ *     Future<long> f = go_future(fib, 30);
+ *     long v = f.get();
+ */
+class FutureBase {
+    template<class Iter>
+    friend Iter when_any(Iter first, Iter last);
+public:
+    bool valid() const {
+        return static_cast<bool>(ptr__);
+    }
+    /* not cancellable, get() needs the result */
+    void wait() {
+        TaskGroup group;
+        group.registe(ptr__).wait(false);
+    }
+    /* get() does not park once this returned Ready */
+    template<class Rep, class Period>
+    WaitStatus wait_for(std::chrono::duration<Rep, Period> const &d) {
+        TaskGroup group;
+        return group.registe(ptr__).wait_for(d);
+    }
+protected:
+    TaskPtr ptr__;
+};
+
+template<class T>
+class Future : public FutureBase {
+    template<class Fn, class... Args>
+    friend auto go_future(Fn&& callback, Args&&... args);
+public:
+    T &get() {
+        wait();
+        ptr__->rethrowIfFailed();
+        return ptr__->result<T>();
+    }
+};
+
+template<>
+class Future<void> : public FutureBase {
+    template<class Fn, class... Args>
+    friend auto go_future(Fn&& callback, Args&&... args);
+public:
+    void get() {
+        wait();
+        ptr__->rethrowIfFailed();
+    }
+};
+
+template<class T>
+struct FutureResult {
+    template<class Fn>
+    static void run(Fn &fn) {
+        co_currentTask->emplaceResult<T>(fn());
+    }
+};
+
+template<>
+struct FutureResult<void> {
+    template<class Fn>
+    static void run(Fn &fn) {
+        fn();
+    }
+};
+
+template<class Fn, class... Args>
+auto
+go_future(Fn&& callback, Args&&... args)
+{
+    auto fn = std::bind(std::forward<Fn>(callback), std::forward<Args>(args)...);
+    using T = std::decay_t<decltype(fn())>;
+
+    /* one reference for the future, one handed to the runnable_queue */
+    Task *task = new Task([fn] () mutable {
+                FutureResult<T>::run(fn);
+            });
+    task->inheritCancelToken();
+    TaskPtr::presetCount(task, 2);
+
+    Future<T> future;
+    future.ptr__ = TaskPtr::adopt(task);
+    globalMediator.addRunnable(TaskPtr::adopt(task));
+    return future;
+}
+
+/* wait for all of the futures */
+template<class Iter,
+         class = std::enable_if_t<!std::is_base_of<FutureBase, Iter>::value>>
+void
+when_all(Iter first, Iter last)
+{
+    /* one at a time: a TaskGroup holds one task without allocating */
+    for ( ; first != last; ++first ) {
+        first->wait();
+    }
+}
+
+inline void
+when_all()
+{}
+
+template<class F, class... Fs>
+void
+when_all(F &first, Fs&... rest)
+{
+    first.wait();
+    when_all(rest...);
+}
+
+/* wait for one of the futures, the first finished one in [first, last) */
+template<class Iter>
+Iter
+when_any(Iter first, Iter last)
+{
+    TaskGroup group;
+    for ( Iter it = first; it != last; ++it ) {
+        group.registe(it->ptr__);
+    }
+    group.waitAny();
+
+    Iter done = last;
+    for ( Iter it = first; it != last; ++it ) {
+        if ( !group.unregiste(it->ptr__.get()) && done == last ) {
+            done = it;
+        }
+    }
+    /* the group lives on this stack, let the finishers leave it */
+    group.drain();
+    return done;
+}
+
+#endif /* _CO_FUTURE_HH_ */
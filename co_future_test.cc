@@ -0,0 +1,130 @@
+#include "co_user.hh"
+#include "co_future.hh"
+#include "co_chan.hh"
+
+#include <stdio.h>
+#include <cassert>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <stdexcept>
+
+long fib(int n) {
+    if ( n < 2 ) {
+        return n;
+    }
+    Future<long> a = go_future(fib, n - 1);
+    Future<long> b = go_future(fib, n - 2);
+    when_all(a, b);
+    return a.get() + b.get();
+}
+
+void get_test() {
+    long f = fib(15);
+    assert(f == 610);
+
+    /* too big to live inline in the task */
+    Future<std::string> s = go_future([] (int n) {
+        return std::string(n, 'x');
+    }, 100);
+    std::string got = s.get();
+    assert(got == std::string(100, 'x'));
+
+    std::atomic<int> ran = {0};
+    Future<void> v = go_future([&ran] () { ++ran; });
+    v.get();
+    assert(ran == 1);
+
+    /* get() again on a finished task */
+    Future<std::string> copy = s;
+    got = copy.get();
+    assert(got.size() == 100);
+    printf("get_test passed.\n");
+}
+
+void when_all_test() {
+    constexpr int num_of_futures = 50;
+    Future<int> fs[num_of_futures];
+    for ( int i = 0; i < num_of_futures; ++i ) {
+        fs[i] = go_future([] (int i) { co_yield; return i * i; }, i);
+    }
+    when_all(fs, fs + num_of_futures);
+    for ( int i = 0; i < num_of_futures; ++i ) {
+        int v = fs[i].get();
+        assert(v == i * i);
+    }
+    printf("when_all_test passed.\n");
+}
+
+void when_any_test() {
+    using namespace std::chrono;
+    chan<int> gate;
+    Future<int> fs[3];
+    fs[0] = go_future([&gate] () { int v; gate.recv(v); return 0; });
+    fs[1] = go_future([] () { co_sleep_for(milliseconds(1)); return 1; });
+    fs[2] = go_future([&gate] () { int v; gate.recv(v); return 2; });
+
+    Future<int> *first = when_any(fs, fs + 3);
+    assert(first == fs + 1);
+    int v = first->get();
+    assert(v == 1);
+
+    /* the others are still running, and can be waited on again */
+    gate.close();
+    when_all(fs, fs + 3);
+    int v0 = fs[0].get(), v2 = fs[2].get();
+    assert(v0 == 0 && v2 == 2);
+
+    /* all finished already */
+    first = when_any(fs, fs + 3);
+    assert(first == fs);
+    printf("when_any_test passed.\n");
+}
+
+/* get() rethrows what the callback threw, there is no result */
+void exception_test() {
+    Future<long> f = go_future([] () -> long {
+        throw std::runtime_error("no result");
+    });
+    bool caught = false;
+    try {
+        f.get();
+    } catch ( std::runtime_error const &e ) {
+        caught = std::string(e.what()) == "no result";
+    }
+    assert(caught);
+
+    /* again, from a copy, and without a value */
+    Future<long> copy = f;
+    caught = false;
+    try {
+        copy.get();
+    } catch ( std::runtime_error const & ) {
+        caught = true;
+    }
+    assert(caught);
+
+    Future<void> v = go_future([] () { throw std::logic_error("void"); });
+    caught = false;
+    try {
+        v.get();
+    } catch ( std::logic_error const & ) {
+        caught = true;
+    }
+    assert(caught);
+    printf("exception_test passed.\n");
+}
+
+int main() {
+    co_init();
+
+    go([] () {
+        /* one task each, their frames do not add up on a 4KB stack */
+        for ( auto test : {get_test, when_all_test, when_any_test, exception_test} ) {
+            TaskBundle().registe(go(test)).wait();
+        }
+        co_terminate();
+    });
+
+    co_mainloop();
+}
@@ -0,0 +1,112 @@
+#include "co_net.hh"
+#include "NetPoller.hh"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+
+static bool
+wouldBlock(int err)
+{
+    return err == EAGAIN || err == EWOULDBLOCK;
+}
+
+/* park until fd may be ready, false with errno set if it cannot */
+static bool
+waitReady(int fd, NetPoller::Direction d)
+{
+    int err = netPoller.wait(fd, d);
+    if ( err != 0 ) {
+        errno = err;
+        return false;
+    }
+    return true;
+}
+
+int
+co_socket(int domain, int type, int protocol)
+{
+    return ::socket(domain, type | SOCK_NONBLOCK | SOCK_CLOEXEC, protocol);
+}
+
+ssize_t
+co_read(int fd, void *buf, size_t count)
+{
+    for ( ;; ) {
+        ssize_t r = ::read(fd, buf, count);
+        if ( r >= 0 || (errno != EINTR && !wouldBlock(errno)) ) {
+            return r;
+        }
+        if ( errno != EINTR && !waitReady(fd, NetPoller::Read) ) {
+            return -1;
+        }
+    }
+}
+
+ssize_t
+co_write(int fd, void const *buf, size_t count)
+{
+    for ( ;; ) {
+        ssize_t r = ::write(fd, buf, count);
+        if ( r >= 0 || (errno != EINTR && !wouldBlock(errno)) ) {
+            return r;
+        }
+        if ( errno != EINTR && !waitReady(fd, NetPoller::Write) ) {
+            return -1;
+        }
+    }
+}
+
+int
+co_accept(int fd, struct sockaddr *addr, socklen_t *addrlen)
+{
+    for ( ;; ) {
+        int r = ::accept4(fd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if ( r >= 0 || (errno != EINTR && !wouldBlock(errno)) ) {
+            return r;
+        }
+        if ( errno != EINTR && !waitReady(fd, NetPoller::Read) ) {
+            return -1;
+        }
+    }
+}
+
+int
+co_connect(int fd, struct sockaddr const *addr, socklen_t addrlen)
+{
+    if ( ::connect(fd, addr, addrlen) == 0 ) {
+        return 0;
+    }
+    if ( errno != EINPROGRESS && errno != EINTR ) {
+        return -1;
+    }
+
+    for ( ;; ) {
+        /* writable once connected, or failed */
+        if ( !waitReady(fd, NetPoller::Write) ) {
+            return -1;
+        }
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if ( ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 ) {
+            return -1;
+        }
+        if ( err != 0 ) {
+            errno = err;
+            return -1;
+        }
+        /* the wakeup may be spurious, ask again */
+        if ( ::connect(fd, addr, addrlen) == 0 || errno == EISCONN ) {
+            return 0;
+        }
+        if ( errno != EALREADY && errno != EINPROGRESS && errno != EINTR ) {
+            return -1;
+        }
+    }
+}
+
+int
+co_close(int fd)
+{
+    return netPoller.close(fd);
+}
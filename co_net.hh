@@ -0,0 +1,31 @@
+#ifndef _CO_NET_HH_
+#define _CO_NET_HH_
+
+#include "util.hh"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/* Socket I/O for code running in tasks, on nonblocking fds.
+ *
+ * Same results and errno as the syscalls, except that EAGAIN parks
+ * the task in the NetPoller until the fd is ready, and the worker
+ * thread goes on running other tasks. They must not be used by pure
+ * tasks; of two tasks reading (or writing) one fd at a time, the
+ * second one fails with EBUSY.
+ */
+
+/* a nonblocking, close-on-exec socket */
+int co_socket(int domain, int type, int protocol);
+
+ssize_t co_read(int fd, void *buf, size_t count);
+ssize_t co_write(int fd, void const *buf, size_t count);
+
+/* the accepted socket is nonblocking too */
+int co_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+int co_connect(int fd, struct sockaddr const *addr, socklen_t addrlen);
+
+/* resumes the tasks waiting on fd, their calls fail with EBADF */
+int co_close(int fd);
+
+#endif /* _CO_NET_HH_ */
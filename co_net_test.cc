@@ -0,0 +1,236 @@
+#include "co_user.hh"
+#include "co_net.hh"
+#include "co_chan.hh"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <cassert>
+#include <vector>
+#include <chrono>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+constexpr int num_of_clients = 100;
+constexpr int num_of_rounds = 100;
+constexpr int message_size = 64;
+
+bool readAll(int fd, char *buf, size_t n) {
+    while ( n > 0 ) {
+        ssize_t r = co_read(fd, buf, n);
+        if ( r <= 0 ) {
+            return false;
+        }
+        buf += r;
+        n -= r;
+    }
+    return true;
+}
+
+bool writeAll(int fd, char const *buf, size_t n) {
+    while ( n > 0 ) {
+        ssize_t r = co_write(fd, buf, n);
+        if ( r < 0 ) {
+            return false;
+        }
+        buf += r;
+        n -= r;
+    }
+    return true;
+}
+
+/* a loopback listener on an ephemeral port */
+int listenLoopback(sockaddr_in &addr) {
+    int fd = co_socket(AF_INET, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    int r = bind(fd, (sockaddr*)&addr, sizeof(addr));
+    assert(r == 0);
+    r = listen(fd, num_of_clients);
+    assert(r == 0);
+    socklen_t len = sizeof(addr);
+    r = getsockname(fd, (sockaddr*)&addr, &len);
+    assert(r == 0);
+    return fd;
+}
+
+void echo_test() {
+    sockaddr_in addr;
+    int lfd = listenLoopback(addr);
+    TaskBundle bundle;
+
+    bundle.registe(go([lfd] () {
+        TaskBundle conns;
+        for ( int i = 0; i < num_of_clients; ++i ) {
+            int fd = co_accept(lfd, nullptr, nullptr);
+            assert(fd >= 0);
+            conns.registe(go([fd] () {
+                char buf[message_size];
+                ssize_t n;
+                while ( (n = co_read(fd, buf, sizeof(buf))) > 0 ) {
+                    bool ok = writeAll(fd, buf, n);
+                    assert(ok);
+                }
+                assert(n == 0);
+                co_close(fd);
+            }));
+        }
+        conns.wait();
+    }));
+
+    for ( int i = 0; i < num_of_clients; ++i ) {
+        bundle.registe(go([&addr, i] () {
+            int fd = co_socket(AF_INET, SOCK_STREAM, 0);
+            assert(fd >= 0);
+            int rc = co_connect(fd, (sockaddr*)&addr, sizeof(addr));
+            assert(rc == 0);
+            char out[message_size], in[message_size];
+            for ( int r = 0; r < num_of_rounds; ++r ) {
+                memset(out, 'a' + (i + r) % 26, sizeof(out));
+                bool ok = writeAll(fd, out, sizeof(out));
+                assert(ok);
+                ok = readAll(fd, in, sizeof(in));
+                assert(ok);
+                assert(memcmp(in, out, sizeof(in)) == 0);
+            }
+            co_close(fd);
+        }));
+    }
+    bundle.wait();
+    co_close(lfd);
+    printf("echo_test passed.\n");
+}
+
+/* more than the socket buffers hold: the writer parks on EAGAIN */
+void bulk_test() {
+    constexpr size_t total = 16 << 20;
+    int sv[2];
+    int r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv);
+    assert(r == 0);
+    TaskBundle bundle;
+
+    bundle.registe(go([fd = sv[0]] () {
+        std::vector<char> buf(total);
+        for ( size_t i = 0; i < total; ++i ) {
+            buf[i] = (char)(i % 251);
+        }
+        bool ok = writeAll(fd, buf.data(), total);
+        assert(ok);
+        co_close(fd);
+    }));
+    bundle.registe(go([fd = sv[1]] () {
+        std::vector<char> buf(64 << 10);
+        size_t got = 0;
+        ssize_t n;
+        while ( (n = co_read(fd, buf.data(), buf.size())) > 0 ) {
+            for ( ssize_t i = 0; i < n; ++i ) {
+                assert(buf[i] == (char)((got + i) % 251));
+            }
+            got += n;
+        }
+        assert(n == 0 && got == total);
+        co_close(fd);
+    }));
+    bundle.wait();
+    printf("bulk_test passed.\n");
+}
+
+void close_test() {
+    int sv[2];
+    int r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv);
+    assert(r == 0);
+    TaskBundle bundle;
+
+    /* parked in co_read, resumed by co_close */
+    bundle.registe(go([fd = sv[0]] () {
+        char c;
+        ssize_t n = co_read(fd, &c, 1);
+        assert(n == -1 && errno == EBADF);
+    }));
+    co_yield;
+    co_close(sv[0]);
+    bundle.wait();
+    co_close(sv[1]);
+    printf("close_test passed.\n");
+}
+
+void busy_test() {
+    int sv[2];
+    int r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv);
+    assert(r == 0);
+    TaskBundle bundle;
+
+    bundle.registe(go([fd = sv[0]] () {
+        char c;
+        ssize_t n = co_read(fd, &c, 1);
+        assert(n == 1 && c == 'x');
+    }));
+    co_sleep_for(std::chrono::milliseconds(5));
+
+    /* one reader per fd, the second one is refused */
+    char c;
+    ssize_t n = co_read(sv[0], &c, 1);
+    assert(n == -1 && errno == EBUSY);
+    n = co_write(sv[1], "x", 1);
+    assert(n == 1);
+    bundle.wait();
+    co_close(sv[0]);
+    co_close(sv[1]);
+    printf("busy_test passed.\n");
+}
+
+/* an fd closed without co_close() is still in the NetPoller, the
+ * next socket of the same number must be polled all the same */
+void reuse_test() {
+    int sv[2];
+    int r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv);
+    assert(r == 0);
+    TaskBundle first;
+    first.registe(go([fd = sv[0]] () {
+        char c;
+        ssize_t n = co_read(fd, &c, 1);
+        assert(n == 1 && c == 'x');
+    }));
+    co_sleep_for(std::chrono::milliseconds(5));
+    co_write(sv[1], "x", 1);
+    first.wait();
+    int reused = sv[0];
+    ::close(sv[1]);
+
+    /* other numbers, then the reader end moves onto the closed one */
+    r = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv);
+    assert(r == 0);
+    ::close(reused);
+    r = dup2(sv[0], reused);
+    assert(r == reused);
+    ::close(sv[0]);
+    TaskBundle second;
+    second.registe(go([reused] () {
+        char c;
+        ssize_t n = co_read(reused, &c, 1);
+        assert(n == 1 && c == 'y');
+    }));
+    co_sleep_for(std::chrono::milliseconds(5));
+    co_write(sv[1], "y", 1);
+    second.wait();
+    co_close(reused);
+    co_close(sv[1]);
+    printf("reuse_test passed.\n");
+}
+
+int main() {
+    co_init();
+
+    go([] () {
+        for ( auto test : {echo_test, bulk_test, close_test, busy_test, reuse_test} ) {
+            TaskBundle().registe(go(test)).wait();
+        }
+        co_terminate();
+    });
+
+    co_mainloop();
+}
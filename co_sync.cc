@@ -0,0 +1,485 @@
+#include "co_sync.hh"
+#include "GlobalMediator.hh"
+#include "Task.hh"
+#include "debug.hh"
+
+#include <mutex>
+#include <utility>
+
+void
+co_mutex::lock()
+{
+    int s = Unlocked;
+    if ( state_.compare_exchange_strong(s, Locked, std::memory_order_acquire) ) {
+        return;
+    }
+
+    co_currentTask->parkOn(this);
+    /* resumed as the owner, see unlock() */
+}
+
+bool
+co_mutex::try_lock()
+{
+    int s = Unlocked;
+    return state_.compare_exchange_strong(s, Locked, std::memory_order_acquire);
+}
+
+void
+co_mutex::unlock()
+{
+    int s = Locked;
+    if ( state_.compare_exchange_strong(s, Unlocked, std::memory_order_release) ) {
+        return;
+    }
+
+    MUST_TRUE(s == Contended, "unlock a co_mutex in state %d", s);
+    TaskPtr next;
+    {
+        std::lock_guard<Spinlock> _(mut_);
+        next = waiters.pop();
+        state_.store(waiters.empty() ? Locked : Contended, std::memory_order_release);
+    }
+    DEBUG_PRINT(DEBUG_Task, "co_mutex hands over to task %d", next->debugId);
+    globalMediator.wakeUp(std::move(next));
+}
+
+bool
+co_mutex::resumeIfNothingToWait(TaskPtr &ptr)
+{
+    std::lock_guard<Spinlock> _(mut_);
+    int s = state_.load(std::memory_order_relaxed);
+    for ( ;; ) {
+        if ( s == Unlocked ) {
+            /* released meanwhile, waiters must be empty */
+            if ( state_.compare_exchange_weak(s, Locked, std::memory_order_acquire) ) {
+                ptr->state = Task::Runnable;
+                return true;
+            }
+        } else if ( s == Contended ||
+                state_.compare_exchange_weak(s, Contended, std::memory_order_relaxed) ) {
+            waiters.push(std::move(ptr));
+            return false;
+        }
+    }
+}
+
+void
+co_condition_variable::wait(std::unique_lock<co_mutex> &lock)
+{
+    MUST_TRUE(lock.owns_lock(), "co_condition_variable waits without the lock");
+    waitingMutex = lock.mutex();
+    co_currentTask->parkOn(this);
+    /* notified, the mutex was released in resumeIfNothingToWait() */
+    lock.mutex()->lock();
+}
+
+void
+co_condition_variable::notify_one()
+{
+    TaskPtr next;
+    {
+        std::lock_guard<Spinlock> _(mut_);
+        next = waiters.pop();
+    }
+    if ( next ) {
+        globalMediator.wakeUp(std::move(next));
+    }
+}
+
+void
+co_condition_variable::notify_all()
+{
+    IntrusiveQueue<Task> woken;
+    {
+        std::lock_guard<Spinlock> _(mut_);
+        woken.swap(waiters);
+    }
+    while ( TaskPtr next = woken.pop() ) {
+        globalMediator.wakeUp(std::move(next));
+    }
+}
+
+bool
+co_condition_variable::resumeIfNothingToWait(TaskPtr &ptr)
+{
+    co_mutex *m = waitingMutex;
+    {
+        std::lock_guard<Spinlock> _(mut_);
+        waiters.push(std::move(ptr));
+    }
+    m->unlock();
+    return false;
+}
+
+void
+co_semaphore::acquire()
+{
+    if ( try_acquire() ) {
+        return;
+    }
+
+    co_currentTask->parkOn(this);
+    /* resumed with a permit, see release() */
+}
+
+bool
+co_semaphore::try_acquire()
+{
+    long p = permits_.load(std::memory_order_relaxed);
+    while ( p > 0 ) {
+        if ( permits_.compare_exchange_weak(p, p - 1, std::memory_order_acquire) ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+co_semaphore::release(long n)
+{
+    IntrusiveQueue<Task> woken;
+    {
+        std::lock_guard<Spinlock> _(mut_);
+        for ( ; n > 0; --n ) {
+            TaskPtr next = waiters.pop();
+            if ( !next ) {
+                permits_.fetch_add(n, std::memory_order_release);
+                break;
+            }
+            woken.push(std::move(next));
+        }
+    }
+    while ( TaskPtr next = woken.pop() ) {
+        globalMediator.wakeUp(std::move(next));
+    }
+}
+
+bool
+co_semaphore::resumeIfNothingToWait(TaskPtr &ptr)
+{
+    std::lock_guard<Spinlock> _(mut_);
+    /* a permit may have been released before we got the lock */
+    if ( try_acquire() ) {
+        ptr->state = Task::Runnable;
+        return true;
+    }
+    waiters.push(std::move(ptr));
+    return false;
+}
+
+struct co_shared_mutex::Parker : public Waitable {
+    co_shared_mutex *m;
+    bool            shared;
+
+    bool resumeIfNothingToWait(TaskPtr &ptr) override {
+        std::lock_guard<Spinlock> _(m->mut_);
+        return shared ? m->parkReader(ptr) : m->parkWriter(ptr);
+    }
+};
+
+void
+co_shared_mutex::lock()
+{
+    if ( try_lock() ) {
+        return;
+    }
+
+    Parker p;
+    p.m = this;
+    p.shared = false;
+    co_currentTask->parkOn(&p);
+    /* resumed as the owner */
+}
+
+bool
+co_shared_mutex::try_lock()
+{
+    unsigned long s = 0;
+    return state_.compare_exchange_strong(s, Writer, std::memory_order_acquire);
+}
+
+void
+co_shared_mutex::unlock()
+{
+    IntrusiveQueue<Task> woken;
+    {
+        std::lock_guard<Spinlock> _(mut_);
+        if ( TaskPtr next = writers.pop() ) {
+            /* Writer stays set, readers backing off do not matter */
+            woken.push(std::move(next));
+        } else {
+            /* the parked readers are let in together */
+            unsigned long n = 0;
+            while ( TaskPtr next = readers.pop() ) {
+                woken.push(std::move(next));
+                ++n;
+            }
+            state_.fetch_add(n * OneReader - Writer, std::memory_order_release);
+        }
+    }
+    while ( TaskPtr next = woken.pop() ) {
+        globalMediator.wakeUp(std::move(next));
+    }
+}
+
+void
+co_shared_mutex::lock_shared()
+{
+    if ( !(state_.fetch_add(OneReader, std::memory_order_acquire) & Writer) ) {
+        return;
+    }
+
+    Parker p;
+    p.m = this;
+    p.shared = true;
+    co_currentTask->parkOn(&p);
+    /* resumed as a reader */
+}
+
+bool
+co_shared_mutex::try_lock_shared()
+{
+    unsigned long s = state_.load(std::memory_order_relaxed);
+    while ( !(s & Writer) ) {
+        if ( state_.compare_exchange_weak(s, s + OneReader, std::memory_order_acquire) ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+co_shared_mutex::unlock_shared()
+{
+    unsigned long s = state_.fetch_sub(OneReader, std::memory_order_release);
+    if ( s == (OneReader | Writer) ) {
+        std::lock_guard<Spinlock> _(mut_);
+        wakeDrainingWriter();
+    }
+}
+
+bool
+co_shared_mutex::parkWriter(TaskPtr &ptr)
+{
+    unsigned long s = state_.load(std::memory_order_relaxed);
+    for ( ;; ) {
+        if ( s & Writer ) {
+            writers.push(std::move(ptr));
+            return false;
+        }
+        if ( state_.compare_exchange_weak(s, s | Writer, std::memory_order_acquire) ) {
+            break;
+        }
+    }
+    if ( s == 0 ) {
+        ptr->state = Task::Runnable;
+        return true;
+    }
+    /* the last reader to leave resumes it, and cannot
+     * take mut_ before drainingWriter is set */
+    drainingWriter = std::move(ptr);
+    return false;
+}
+
+bool
+co_shared_mutex::parkReader(TaskPtr &ptr)
+{
+    /* under mut_, nobody sets or clears Writer while our count holds */
+    if ( !(state_.load(std::memory_order_acquire) & Writer) ) {
+        ptr->state = Task::Runnable;
+        return true;
+    }
+    readers.push(std::move(ptr));
+    if ( state_.fetch_sub(OneReader, std::memory_order_release) == (OneReader | Writer) ) {
+        wakeDrainingWriter();
+    }
+    return false;
+}
+
+void
+co_shared_mutex::wakeDrainingWriter()
+{
+    if ( drainingWriter ) {
+        globalMediator.wakeUp(std::move(drainingWriter));
+    }
+}
+
+void
+CountDownLatch::down(long n)
+{
+    long c = count_.fetch_sub(n * OneCount, std::memory_order_acq_rel) - n * OneCount;
+    MUST_TRUE(c >= 0, "CountDownLatch counted down below zero: %ld", c / OneCount);
+    /* not zero, or zero with nobody parked: the latch may be gone */
+    if ( c != Parked ) {
+        return;
+    }
+
+    IntrusiveQueue<Task> woken;
+    {
+        std::lock_guard<Spinlock> _(mut_);
+        woken.swap(waiters);
+        count_.fetch_and(~Parked, std::memory_order_relaxed);
+    }
+    while ( TaskPtr next = woken.pop() ) {
+        globalMediator.wakeUp(std::move(next));
+    }
+}
+
+bool
+CountDownLatch::markParked()
+{
+    long c = count_.load(std::memory_order_acquire);
+    do {
+        /* just Parked: the down() to zero has yet to take mut_ */
+        if ( c == 0 ) {
+            return false;
+        }
+    } while ( !count_.compare_exchange_weak(c, c | Parked,
+                std::memory_order_acq_rel, std::memory_order_acquire) );
+    return true;
+}
+
+bool
+CountDownLatch::settled()
+{
+    if ( count_.load(std::memory_order_acquire) != 0 ) {
+        return false;
+    }
+    /* a down() to zero that woke waiters clears Parked under mut_,
+     * let it release mut_ before the latch may go */
+    std::lock_guard<Spinlock> _(mut_);
+    return true;
+}
+
+void
+CountDownLatch::wait()
+{
+    if ( settled() ) {
+        return;
+    }
+    co_currentTask->parkOn(this);
+}
+
+/* parks one task of wait_until(), and is its timer */
+class CountDownLatch::TimedWaiter : public Timer, public Waitable {
+public:
+    TimedWaiter(CountDownLatch *latch, clock::time_point deadline)
+        : Timer(deadline)
+        , latch(latch)
+    {}
+
+    bool resumeIfNothingToWait(TaskPtr &ptr) override {
+        std::lock_guard<Spinlock> _(latch->mut_);
+        if ( !latch->markParked() ) {
+            ptr->state = Task::Runnable;
+            return true;
+        }
+        /* fires on this thread, not before this hook returns */
+        globalMediator.getThisPerThreadMgr()->addTimer(TimerPtr(this));
+        task = ptr.get();
+        latch->waiters.push(std::move(ptr));
+        return false;
+    }
+
+    bool timedOut = false;
+protected:
+    void fire() override {
+        TaskPtr ptr;
+        {
+            std::lock_guard<Spinlock> _(latch->mut_);
+            ptr = latch->waiters.remove(task);
+        }
+        if ( ptr ) {
+            timedOut = true;
+            globalMediator.wakeUp(std::move(ptr));
+        }
+    }
+private:
+    CountDownLatch  *latch;
+    /* queued in latch->waiters until a down() or fire() */
+    Task            *task = nullptr;
+};
+
+WaitStatus
+CountDownLatch::wait_until(Timer::clock::time_point deadline)
+{
+    if ( settled() ) {
+        return WaitStatus::Ready;
+    }
+    if ( Timer::clock::now() >= deadline ) {
+        return WaitStatus::Timeout;
+    }
+
+    DerivedRefPtr<TimedWaiter> w(new TimedWaiter(this, deadline));
+    co_currentTask->parkOn(w.get());
+    /* fire() touches the latch, wait until it cannot */
+    w->cancel();
+    return w->timedOut ? WaitStatus::Timeout : WaitStatus::Ready;
+}
+
+bool
+CountDownLatch::resumeIfNothingToWait(TaskPtr &ptr)
+{
+    std::lock_guard<Spinlock> _(mut_);
+    /* a down() to zero after this CAS finds us in waiters */
+    if ( !markParked() ) {
+        ptr->state = Task::Runnable;
+        return true;
+    }
+    waiters.push(std::move(ptr));
+    return false;
+}
+
+void
+co_barrier::arrive_and_wait()
+{
+    IntrusiveQueue<Task> woken;
+    bool last;
+    {
+        std::lock_guard<Spinlock> _(mut_);
+        /* the others arrive once parked, in resumeIfNothingToWait(),
+         * only the last one to arrive completes the phase here */
+        last = arrived + 1 == parties && arriveLocked(woken);
+    }
+    if ( !last ) {
+        co_currentTask->parkOn(this);
+        return;
+    }
+    while ( TaskPtr next = woken.pop() ) {
+        globalMediator.wakeUp(std::move(next));
+    }
+}
+
+bool
+co_barrier::arriveLocked(IntrusiveQueue<Task> &woken)
+{
+    if ( ++arrived < parties ) {
+        return false;
+    }
+    arrived = 0;
+    woken.swap(waiters);
+    return true;
+}
+
+bool
+co_barrier::resumeIfNothingToWait(TaskPtr &ptr)
+{
+    IntrusiveQueue<Task> woken;
+    bool last;
+    {
+        std::lock_guard<Spinlock> _(mut_);
+        last = arriveLocked(woken);
+        if ( !last ) {
+            waiters.push(std::move(ptr));
+        }
+    }
+    while ( TaskPtr next = woken.pop() ) {
+        globalMediator.wakeUp(std::move(next));
+    }
+    if ( !last ) {
+        return false;
+    }
+    ptr->state = Task::Runnable;
+    return true;
+}
@@ -0,0 +1,240 @@
+#ifndef _CO_SYNC_HH_
+#define _CO_SYNC_HH_
+
+#include "util.hh"
+#include "Spinlock.hh"
+#include "Waitable.hh"
+#include "IntrusiveQueue.hh"
+#include "Task.hh"
+#include "Timer.hh"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+/* Synchronization primitives for code running in Tasks: waiting
+ * parks the Task through Waitable, the worker thread goes on
+ * running other tasks. They must not be used by pure tasks.
+ */
+
+/* Mutex for tasks, usable with std::lock_guard/std::unique_lock.
+ *
+ * Uncontended lock()/unlock() cost one CAS each. A contended lock()
+ * parks the task in waiters; unlock() then hands the ownership
+ * directly to the first waiter and makes it runnable, the mutex
+ * never becomes free in between.
+ */
+class co_mutex : public Waitable, public NonCopyable {
+public:
+    void lock();
+    bool try_lock();
+    void unlock();
+
+    bool resumeIfNothingToWait(TaskPtr &ptr) override;
+private:
+    enum {
+        Unlocked,
+        Locked,
+
+        /* locked, and waiters is not empty */
+        Contended,
+    };
+
+    std::atomic<int>        state_ = {Unlocked};
+
+    /* guards waiters */
+    Spinlock                mut_;
+    IntrusiveQueue<Task>    waiters;
+};
+
+/* Condition variable for tasks, used with co_mutex.
+ *
+ * wait() parks the task, and the mutex is released only after the
+ * task is in waiters, so a notify issued right after the unlock is
+ * never lost. All tasks waiting at the same time must use the same
+ * mutex.
+ */
+class co_condition_variable : public Waitable, public NonCopyable {
+public:
+    void wait(std::unique_lock<co_mutex> &lock);
+
+    template<class Predicate>
+    void wait(std::unique_lock<co_mutex> &lock, Predicate pred) {
+        while ( !pred() ) {
+            wait(lock);
+        }
+    }
+
+    void notify_one();
+    void notify_all();
+
+    bool resumeIfNothingToWait(TaskPtr &ptr) override;
+private:
+    /* the mutex to release once parked, only written
+     * and read while the waiter still holds it */
+    co_mutex                *waitingMutex = nullptr;
+
+    /* guards waiters */
+    Spinlock                mut_;
+    IntrusiveQueue<Task>    waiters;
+};
+
+/* Counting semaphore for tasks.
+ *
+ * acquire() takes a permit with one CAS if there is one, otherwise
+ * parks the task. release() hands a permit directly to the first
+ * waiter, it is never visible to other acquirers in between.
+ */
+class co_semaphore : public Waitable, public NonCopyable {
+public:
+    explicit co_semaphore(long permits = 0)
+        : permits_(permits)
+    {}
+
+    void acquire();
+    bool try_acquire();
+    void release(long n = 1);
+
+    long available() const {
+        return permits_.load(std::memory_order_relaxed);
+    }
+
+    bool resumeIfNothingToWait(TaskPtr &ptr) override;
+private:
+    std::atomic<long>       permits_;
+
+    /* guards waiters, permits_ only grows under it */
+    Spinlock                mut_;
+    IntrusiveQueue<Task>    waiters;
+};
+
+/* Reader-writer mutex for tasks, usable with std::shared_lock too.
+ *
+ * lock_shared() is a single fetch_add when no writer is around.
+ * Writers are preferred: once a writer is waiting, new readers park,
+ * the writer takes the mutex when the readers in it have left, and
+ * unlock() hands it to the next parked writer before any reader.
+ * Parked readers are resumed together, already holding the mutex.
+ */
+class co_shared_mutex : public NonCopyable {
+public:
+    void lock();
+    bool try_lock();
+    void unlock();
+
+    void lock_shared();
+    bool try_lock_shared();
+    void unlock_shared();
+private:
+    struct Parker;
+
+    enum : unsigned long {
+        /* a writer holds the mutex, or waits for the readers to leave */
+        Writer = 1,
+        OneReader = 2,
+    };
+
+    /* under mut_ */
+    bool parkWriter(TaskPtr &ptr);
+    bool parkReader(TaskPtr &ptr);
+    /* the readers have left, resume the writer waiting for it */
+    void wakeDrainingWriter();
+
+    /* (readers << 1) | Writer, readers count those backing off too */
+    std::atomic<unsigned long>  state_ = {0};
+
+    /* guards everything below, and setting Writer once readers are in */
+    Spinlock                    mut_;
+    TaskPtr                     drainingWriter;
+    IntrusiveQueue<Task>        writers;
+    IntrusiveQueue<Task>        readers;
+};
+
+/* Count down latch for tasks: wait() parks until the count reaches
+ * zero. Any number of tasks may wait, down() at zero resumes them
+ * all. add() may raise the count again, for the next round of
+ * waiters. A wait_until() timing out takes its task out of waiters
+ * from the timer, unless a down() to zero has already swapped it
+ * out, then the wait is Ready.
+ *
+ * A waiter may destroy the latch once its wait returned: the down()
+ * to zero touches nothing after its fetch_sub, unless a task is
+ * parked, which the Parked bit of count_ tells. That down() clears
+ * the bit under mut_, a wait() finding zero takes mut_ once to let
+ * it finish.
+ */
+class CountDownLatch : public Waitable, public NonCopyable {
+public:
+    explicit CountDownLatch(long count = 0)
+        : count_(count * OneCount)
+    {}
+
+    void add(long n) {
+        count_.fetch_add(n * OneCount, std::memory_order_relaxed);
+    }
+    void down(long n = 1);
+    void wait();
+    WaitStatus wait_until(Timer::clock::time_point deadline);
+    template<class Rep, class Period>
+    WaitStatus wait_for(std::chrono::duration<Rep, Period> const &d) {
+        return wait_until(Timer::clock::now() + std::chrono::duration_cast<Timer::clock::duration>(d));
+    }
+
+    long count() const {
+        return count_.load(std::memory_order_acquire) / OneCount;
+    }
+
+    bool resumeIfNothingToWait(TaskPtr &ptr) override;
+private:
+    class TimedWaiter;
+
+    enum : long {
+        Parked = 1,
+        OneCount = 2,
+    };
+
+    /* under mut_, before a task goes to waiters: false if the
+     * count is zero already */
+    bool markParked();
+    /* zero, and no down() touches the latch any more */
+    bool settled();
+
+    /* (count << 1) | Parked */
+    std::atomic<long>       count_;
+
+    /* guards waiters, a down() to zero empties it */
+    Spinlock                mut_;
+    IntrusiveQueue<Task>    waiters;
+};
+
+/* Reusable barrier for a fixed number of tasks.
+ *
+ * arrive_and_wait() parks the task until all the parties have
+ * arrived, the last one to arrive resumes the others and does not
+ * park. Then the barrier is ready for the next phase, so a set of
+ * long running tasks can step through an iterative algorithm
+ * instead of being respawned for each iteration.
+ */
+class co_barrier : public Waitable, public NonCopyable {
+public:
+    explicit co_barrier(int parties)
+        : parties(parties)
+    {}
+
+    void arrive_and_wait();
+
+    bool resumeIfNothingToWait(TaskPtr &ptr) override;
+private:
+    /* under mut_: one more arrived, true if the phase is complete,
+     * then the waiters of the phase are moved to woken */
+    bool arriveLocked(IntrusiveQueue<Task> &woken);
+
+    const int               parties;
+
+    /* guards everything below */
+    Spinlock                mut_;
+    int                     arrived = 0;
+    IntrusiveQueue<Task>    waiters;
+};
+
+#endif /* _CO_SYNC_HH_ */
@@ -0,0 +1,282 @@
+#include "co_user.hh"
+#include "co_sync.hh"
+#include "co_chan.hh"
+
+#include <stdio.h>
+#include <cassert>
+#include <mutex>
+#include <shared_mutex>
+#include <deque>
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+constexpr int num_of_tasks = 1000;
+constexpr int num_of_rounds = 100;
+
+void mutex_test() {
+    co_mutex mut;
+    long counter = 0;
+    TaskBundle bundle;
+
+    for ( int i = 0; i < num_of_tasks; ++i ) {
+        bundle.registe(go([&mut, &counter] () {
+            for ( int j = 0; j < num_of_rounds; ++j ) {
+                std::lock_guard<co_mutex> _(mut);
+                long c = counter;
+                /* others park on mut meanwhile */
+                co_yield;
+                counter = c + 1;
+            }
+        }));
+    }
+    bundle.wait();
+
+    assert(counter == (long)num_of_tasks * num_of_rounds);
+    bool locked = mut.try_lock();
+    assert(locked);
+    mut.unlock();
+    printf("mutex_test passed.\n");
+}
+
+void condition_variable_test() {
+    co_mutex mut;
+    co_condition_variable notEmpty;
+    std::deque<int> queue;
+    bool closed = false;
+    long sum = 0;
+    TaskBundle consumers, producers;
+
+    for ( int i = 0; i < 10; ++i ) {
+        consumers.registe(go([&] () {
+            for ( ;; ) {
+                std::unique_lock<co_mutex> lock(mut);
+                notEmpty.wait(lock, [&] () { return !queue.empty() || closed; });
+                if ( queue.empty() ) {
+                    return;
+                }
+                sum += queue.front();
+                queue.pop_front();
+            }
+        }));
+    }
+    for ( int i = 0; i < num_of_tasks; ++i ) {
+        producers.registe(go([&, i] () {
+            std::lock_guard<co_mutex> _(mut);
+            queue.push_back(i);
+            notEmpty.notify_one();
+        }));
+    }
+    producers.wait();
+    {
+        std::lock_guard<co_mutex> _(mut);
+        closed = true;
+        notEmpty.notify_all();
+    }
+    consumers.wait();
+
+    assert(queue.empty());
+    assert(sum == (long)num_of_tasks * (num_of_tasks - 1) / 2);
+    printf("condition_variable_test passed.\n");
+}
+
+void semaphore_test() {
+    constexpr int num_of_permits = 4;
+    co_semaphore sem(num_of_permits);
+    std::atomic<int> inside(0), maxInside(0);
+    TaskBundle bundle;
+
+    for ( int i = 0; i < num_of_tasks; ++i ) {
+        bundle.registe(go([&] () {
+            sem.acquire();
+            int now = ++inside;
+            int m = maxInside.load();
+            while ( now > m && !maxInside.compare_exchange_weak(m, now) )
+                ;
+            co_yield;
+            --inside;
+            sem.release();
+        }));
+    }
+    bundle.wait();
+
+    assert(maxInside.load() <= num_of_permits);
+    assert(sem.available() == num_of_permits);
+    bool acquired = co_semaphore().try_acquire();
+    assert(!acquired);
+    printf("semaphore_test passed.\n");
+}
+
+void shared_mutex_test() {
+    constexpr int num_of_writers = 10;
+    co_shared_mutex mut;
+    long a = 0, b = 0;
+    std::atomic<int> readersInside = {0}, maxReadersInside = {0};
+    TaskBundle bundle;
+
+    for ( int i = 0; i < num_of_tasks; ++i ) {
+        bool writer = i % (num_of_tasks / num_of_writers) == 0;
+        bundle.registe(go([&, writer] () {
+            for ( int j = 0; j < num_of_rounds; ++j ) {
+                if ( writer ) {
+                    std::lock_guard<co_shared_mutex> _(mut);
+                    assert(readersInside == 0);
+                    ++a;
+                    co_yield;
+                    ++b;
+                } else {
+                    std::shared_lock<co_shared_mutex> _(mut);
+                    int inside = ++readersInside;
+                    int m = maxReadersInside;
+                    while ( inside > m && !maxReadersInside.compare_exchange_weak(m, inside) )
+                        ;
+                    assert(a == b);
+                    co_yield;
+                    --readersInside;
+                }
+            }
+        }));
+    }
+    bundle.wait();
+
+    assert(a == (long)num_of_writers * num_of_rounds && b == a);
+    assert(maxReadersInside > 1);
+    bool locked = mut.try_lock();
+    assert(locked);
+    locked = mut.try_lock_shared();
+    assert(!locked);
+    mut.unlock();
+    locked = mut.try_lock_shared();
+    assert(locked);
+    locked = mut.try_lock();
+    assert(!locked);
+    mut.unlock_shared();
+    printf("shared_mutex_test passed.\n");
+}
+
+void latch_test() {
+    CountDownLatch start, done;
+    std::atomic<int> started = {0};
+    TaskBundle bundle;
+
+    /* many waiters on one latch, add() adds up */
+    start.add(1);
+    done.add(num_of_tasks / 2);
+    done.add(num_of_tasks - num_of_tasks / 2);
+    for ( int i = 0; i < num_of_tasks; ++i ) {
+        bundle.registe(go([&start, &done, &started] () {
+            start.wait();
+            ++started;
+            done.down();
+        }));
+    }
+    co_yield;
+    assert(started == 0);
+    start.down();
+    done.wait();
+    assert(started == num_of_tasks && done.count() == 0);
+    bundle.wait();
+
+    /* nothing to wait for at zero */
+    start.wait();
+
+    /* a latch on the stack, gone once its wait returned, even if the
+     * down() to zero is still running on another worker */
+    TaskBundle downers;
+    for ( int i = 0; i < num_of_tasks; ++i ) {
+        CountDownLatch scoped(1);
+        downers.registe(go([&scoped] () {
+            scoped.down();
+        }));
+        scoped.wait();
+    }
+    downers.wait();
+    printf("latch_test passed.\n");
+}
+
+void barrier_test() {
+    constexpr int num_of_parties = 10;
+    co_barrier barrier(num_of_parties);
+    std::atomic<int> phase[num_of_rounds] = {};
+    TaskBundle bundle;
+
+    for ( int i = 0; i < num_of_parties; ++i ) {
+        bundle.registe(go([&barrier, &phase] () {
+            for ( int r = 0; r < num_of_rounds; ++r ) {
+                ++phase[r];
+                barrier.arrive_and_wait();
+                /* everybody is done with round r */
+                assert(phase[r] == num_of_parties);
+            }
+        }));
+    }
+    bundle.wait();
+    printf("barrier_test passed.\n");
+}
+
+void timed_wait_test() {
+    using std::chrono::milliseconds;
+
+    /* nobody counts down */
+    CountDownLatch latch(1);
+    WaitStatus st = latch.wait_until(Timer::clock::now());
+    assert(st == WaitStatus::Timeout);
+    st = latch.wait_for(milliseconds(10));
+    assert(st == WaitStatus::Timeout);
+    TaskBundle counter;
+    counter.registe(go([&latch] () {
+        co_sleep_for(milliseconds(5));
+        latch.down();
+    }));
+    st = latch.wait_for(std::chrono::seconds(10));
+    assert(st == WaitStatus::Ready);
+    counter.wait();
+
+    /* fan-out with partial results: the slow task is cancelled, and
+     * the bundle detaches from it, so its state must not be on our stack */
+    CancelTokenPtr token = makeRefPtr<CancelToken>();
+    auto done = std::make_shared<std::atomic<int>>(0);
+    {
+        TaskBundle bundle;
+        for ( int i = 0; i < num_of_rounds; ++i ) {
+            bundle.registe(go_cancellable(token, [done, i] () {
+                if ( i == 0 ) {
+                    co_sleep_for(std::chrono::seconds(10));
+                }
+                ++*done;
+            }));
+        }
+        st = bundle.wait_for(milliseconds(200));
+        assert(st == WaitStatus::Timeout);
+        assert(*done == num_of_rounds - 1);
+        token->cancel();
+    }
+    while ( *done != num_of_rounds ) {
+        co_yield;
+    }
+
+    TaskBundle bundle;
+    for ( int i = 0; i < num_of_rounds; ++i ) {
+        bundle.registe(go([] () {}));
+    }
+    st = bundle.wait_for(std::chrono::seconds(10));
+    assert(st == WaitStatus::Ready);
+    printf("timed_wait_test passed.\n");
+}
+
+int main() {
+    co_init();
+
+    go([] () {
+        mutex_test();
+        condition_variable_test();
+        semaphore_test();
+        shared_mutex_test();
+        latch_test();
+        barrier_test();
+        timed_wait_test();
+        co_terminate();
+    });
+
+    co_mainloop();
+}
@@ -4,7 +4,11 @@
 #include "Task.hh"
 #include "TaskGroup.hh"
 #include "GlobalMediator.hh"
-//#include "mpi_hooks.hh"
+#include "co_sync.hh"
+#ifdef ENABLE_MPI
+#include "mpi_hooks.hh"
+#include "MPIStealer.hh"
+#endif
 
 #include <functional>
 #include <memory>
@@ -16,6 +20,9 @@ class TaskHandle {
     go(Fn&& callback, Args&&... args);
     template<class Fn, class... Args>
     friend TaskHandle
+    go_cancellable(CancelTokenPtr const &token, Fn&& callback, Args&&... args);
+    template<class Fn, class... Args>
+    friend TaskHandle
     go_pure(Fn&& callback, Args&&... args);
     friend class TaskBundle;
 private:
@@ -28,6 +35,9 @@ class TaskBundle {
     go(Fn&& callback, Args&&... args);
     template<class Fn, class... Args>
     friend TaskHandle
+    go_cancellable(CancelTokenPtr const &token, Fn&& callback, Args&&... args);
+    template<class Fn, class... Args>
+    friend TaskHandle
     go_pure(Fn&& callback, Args&&... args);
 private:
     TaskGroup group__;
@@ -39,8 +49,18 @@ public:
     TaskBundle &registe(TaskHandle &&handle) {
         return registe(handle);
     }
-    void wait() {
-        group__.wait();
+    /* Cancelled once the token of the waiting task is cancelled */
+    WaitStatus wait() {
+        return group__.wait();
+    }
+    /* on Timeout or Cancelled the unfinished tasks go on running, a
+     * destroyed bundle no longer waits for them */
+    WaitStatus wait_until(Timer::clock::time_point deadline) {
+        return group__.wait_until(deadline);
+    }
+    template<class Rep, class Period>
+    WaitStatus wait_for(std::chrono::duration<Rep, Period> const &d) {
+        return group__.wait_for(d);
     }
 };
 
@@ -48,49 +68,62 @@ template<class Fn, class... Args>
 TaskHandle
 go(Fn&& callback, Args&&... args)
 {
+    /* one reference for the handle, one handed to the runnable_queue */
+    Task *task = new Task(std::bind(std::forward<Fn>(callback), std::forward<Args>(args)...));
+    task->inheritCancelToken();
+    TaskPtr::presetCount(task, 2);
+
     TaskHandle taskHandle;
-    taskHandle.ptr__ = makeRefPtr<Task>(
-            std::bind(std::forward<Fn>(callback), std::forward<Args>(args)...)); 
-    globalMediator.addRunnable(taskHandle.ptr__);
-    return std::move(taskHandle);
+    taskHandle.ptr__ = TaskPtr::adopt(task);
+    globalMediator.addRunnable(TaskPtr::adopt(task));
+    return taskHandle;
 }
 
 template<class Fn, class... Args>
 TaskHandle
 go_pure(Fn&& callback, Args&&... args)
 {
+    Task *task = new Task(std::bind(std::forward<Fn>(callback), std::forward<Args>(args)...));
+    task->setPure();
+    task->inheritCancelToken();
+    TaskPtr::presetCount(task, 2);
+
     TaskHandle taskHandle;
-    taskHandle.ptr__ = makeRefPtr<Task>(
-            std::bind(std::forward<Fn>(callback), std::forward<Args>(args)...)); 
-    taskHandle.ptr__->setPure();
-    globalMediator.addRunnable(taskHandle.ptr__);
-    return std::move(taskHandle);
+    taskHandle.ptr__ = TaskPtr::adopt(task);
+    globalMediator.addRunnable(TaskPtr::adopt(task));
+    return taskHandle;
 }
 
-class CountDownLatch : public NonCopyable {
-public:
-    CountDownLatch()
-        : fakeTask__(makeRefPtr<Task>([] () {}, true))
-    {}
-    void add(int n) {
-        counter__ = n;
-    }
-    void down() {
-        if ( --counter__ == 0 ) {
-            fakeTask__->state = Task::Terminated;
-            fakeGroup__.informDone(fakeTask__);
-        }
-    }
-    void wait() {
-        fakeGroup__
-            .registe(fakeTask__)
-            .wait();
-    }
-private:
-    std::atomic<int>    counter__ = {0};
-    TaskPtr             fakeTask__;
-    TaskGroup           fakeGroup__;
-};
+/* like go(), the task and the tasks it spawns carry token */
+template<class Fn, class... Args>
+TaskHandle
+go_cancellable(CancelTokenPtr const &token, Fn&& callback, Args&&... args)
+{
+    Task *task = new Task(std::bind(std::forward<Fn>(callback), std::forward<Args>(args)...));
+    task->cancelToken = token;
+    TaskPtr::presetCount(task, 2);
+
+    TaskHandle taskHandle;
+    taskHandle.ptr__ = TaskPtr::adopt(task);
+    globalMediator.addRunnable(TaskPtr::adopt(task));
+    return taskHandle;
+}
+
+/* the token of the running task, null if it has none */
+inline CancelTokenPtr const&
+co_cancel_token()
+{
+    return co_currentTask->cancelToken;
+}
+
+/* true once the token of the running task is cancelled; a co_yield
+ * loop checks it to stop early, blocking waits return on their own */
+inline bool
+co_cancelled()
+{
+    CancelTokenPtr const &token = co_currentTask->cancelToken;
+    return token && token->cancelled();
+}
 
 void
 co_init()
@@ -5,8 +5,20 @@
 #include <chrono>
 #include <vector>
 #include <string>
+#include <algorithm>
 
 #include "co_user.hh"
+#include "Config.hh"
+
+/* MPI progress under load, see Config::mpi_progress:
+ *
+ *     YAMI_MPI_PROGRESS=idle|interval|thread \
+ *         mpirun -np 2 -x YAMI_MPI_PROGRESS ./hello_mpi
+ *
+ * Rank 0 ping-pongs with a task of rank 1, while the other tasks of
+ * rank 1 keep all its workers busy computing. With idle-only progress
+ * the pings wait for the computation to end.
+ */
 
 #define CHECKRET(r)                             \
     if ( (r) != MPI_SUCCESS ) {                 \
@@ -15,90 +27,78 @@
         MPI_Abort(MPI_COMM_WORLD, -1);          \
     }
 
+constexpr int num_of_rounds = 100;
+constexpr int compute_ms = 1000;
+
 int mpi_comm_size;
 int mpi_me;
 
-struct TimeInterval {
-    std::chrono::time_point<std::chrono::high_resolution_clock>  start;
-    std::string message;
-    explicit TimeInterval(std::string const &message = "unknown")
-        : message(message)
-    {
-        start = std::chrono::high_resolution_clock::now();
-    }
-    ~TimeInterval() {
-        auto period = std::chrono::high_resolution_clock::now() - start;
-        printf("<%s> duration: %lfms\n", message.c_str(), 
-                std::chrono::duration<double, std::milli>(period).count());
+using Clock = std::chrono::steady_clock;
+
+double
+millis(Clock::duration d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+char const*
+modeName()
+{
+    switch ( Config::Instance().mpi_progress ) {
+    case Config::MPIProgress::Idle:
+        return "idle";
+    case Config::MPIProgress::Interval:
+        return "interval";
+    default:
+        return "thread";
     }
-};
+}
 
 void process0() {
-//    std::thread tid([] () {
-//        // this evil thread will acquire the lock
-//        // MPI_Send will never succeed
-//        char data[10];
-//        int r;
-//
-//      r = MPI_Ssend(data, sizeof(data), MPI_CHAR,
-//              1, 10, MPI_COMM_WORLD);
-//      CHECKRET(r);
-//    });
-
-
-    /* emulate a huge amount of computation,
-     * this will block the coroutine worker
-     */
-    std::this_thread::sleep_for(std::chrono::milliseconds(2000));
-    printf("process0 after sleep\n");
-    char real_data[10];
-    int r;
-    {
-        TimeInterval _("MPI_Ssend 0");
-        r = MPI_Ssend(real_data, sizeof(real_data), MPI_CHAR,
-                1, 100, MPI_COMM_WORLD);
+    std::vector<double> rtts;
+    auto start = Clock::now();
+    for ( int i = 0; i < num_of_rounds; ++i ) {
+        int data = i;
+        auto sent = Clock::now();
+        CHECKRET(MPI_Send_Hook(&data, 1, MPI_INT, 1, 100, MPI_COMM_WORLD));
+        CHECKRET(MPI_Recv_Hook(&data, 1, MPI_INT, 1, 101, MPI_COMM_WORLD, MPI_STATUS_IGNORE));
+        rtts.push_back(millis(Clock::now() - sent));
+        if ( data != i + 1 ) {
+            printf("wrong reply %d to %d\n", data, i);
+            MPI_Abort(MPI_COMM_WORLD, -1);
+        }
     }
-
-    CHECKRET(r);
-    printf("OK, no global lock: %d\n", mpi_me);
-//    co_terminate();
-//    tid.join();
+    double total = millis(Clock::now() - start);
+    std::sort(rtts.begin(), rtts.end());
+    printf("<%s: %d ping-pongs> total: %.1lfms, median rtt: %.3lfms, max rtt: %.3lfms\n",
+            modeName(), num_of_rounds, total, rtts[rtts.size() / 2], rtts.back());
 }
 
 void process1() {
-    char real_data[10];
-    int r;
-//    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
-
-    for ( int i = 0; i < 10; i++ ) {
-//        go([i] () {
-//                printf("Running: I am a huge task %d at process %d\n", i, mpi_me);
-//        });
-    }
-
-    {
-        TimeInterval _("MPI_Recv 1");
-        
-//        MPI_Request request;
-//        MPI_Recv_Hook(real_data, sizeof(real_data), MPI_CHAR,
-//                0, 100, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-      r = MPI_Recv(real_data, sizeof(real_data), MPI_CHAR,
-              0, 100, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-//      CHECKRET(r);
-
-//        r = MPI_Irecv(real_data, sizeof(real_data), MPI_CHAR,
-//                0, 100, MPI_COMM_WORLD, &request);
-//        CHECKRET(r);
-//
-//        int finished = 0;
-//        while ( !finished ) {
-//            r = MPI_Test(&request, &finished, MPI_STATUS_IGNORE);
-//            CHECKRET(r);
-//        }
+    TaskBundle bundle;
+
+    /* all workers busy, never idle */
+    auto end = Clock::now() + std::chrono::milliseconds(compute_ms);
+    for ( int i = 0; i < 2 * Config::Instance().num_of_threads; ++i ) {
+        bundle.registe(go([end] () {
+            while ( Clock::now() < end ) {
+                auto slice = Clock::now() + std::chrono::microseconds(50);
+                while ( Clock::now() < slice ) {
+                }
+                co_yield;
+            }
+        }));
     }
 
-    printf("OK, no global lock: %d\n", mpi_me);
-//    co_terminate();
+    bundle.registe(go([] () {
+        for ( int i = 0; i < num_of_rounds; ++i ) {
+            int data;
+            CHECKRET(MPI_Recv_Hook(&data, 1, MPI_INT, 0, 100, MPI_COMM_WORLD, MPI_STATUS_IGNORE));
+            ++data;
+            CHECKRET(MPI_Send_Hook(&data, 1, MPI_INT, 0, 101, MPI_COMM_WORLD));
+        }
+    }));
+    bundle.wait();
 }
 
 int main() {
@@ -115,19 +115,18 @@ int main() {
     MPI_Comm_size(MPI_COMM_WORLD, &mpi_comm_size);
     printf("hello from %d of %d\n", mpi_me, mpi_comm_size);
 
-//    co_init();
+    co_init();
 
-    if ( mpi_me == 0 ) {
-//        go(process0);
-        process0();
-    } else if ( mpi_me == 1 ) {
-//        go(process1);
-        process1();
-    }
-    
-//    co_mainloop();
-    
-    printf("should print.\n");
+    go([] () {
+        if ( mpi_me == 0 ) {
+            TaskBundle().registe(go(process0)).wait();
+        } else if ( mpi_me == 1 ) {
+            TaskBundle().registe(go(process1)).wait();
+        }
+        co_terminate();
+    });
+
+    co_mainloop();
 
     MPI_Finalize();
 }
@@ -3,47 +3,32 @@
 
 #include <mpi.h>
 #include "GlobalMediator.hh"
+#include "MPIPoller.hh"
+#include "MPIDispatcher.hh"
+#include "MPIAggregator.hh"
+#include "Config.hh"
 
 
-#define ENABLE_DEBUG_LOCAL
+//#define ENABLE_DEBUG_LOCAL
 #include "debug_local_begin.hh"
 
-#define RETURN_IF_NOT_SUCCESS(r) \
-    if ( (r) != MPI_SUCCESS ) return r;
-
-
 int
 MPI_Send_Hook(
         const void *buf, int count, MPI_Datatype datatype,
         int dest, int tag, MPI_Comm comm)
 {
-    MPI_Request request;
+    bool aggregate = Config::Instance().mpi_send_aggregate;
     int r;
-    r = MPI_Isend(buf, count, datatype, dest, tag, comm, &request);
-    RETURN_IF_NOT_SUCCESS(r);
-
-    int flag;
-    r = MPI_Test(&request, &flag, MPI_STATUS_IGNORE);
-    RETURN_IF_NOT_SUCCESS(r);
-    if ( flag ) {
-        // already ok
+    if ( aggregate && MPIAggregator::Instance().send(buf, count, datatype, dest, tag, comm, &r) ) {
         return r;
     }
 
-    co_currentTask->state = Task::MPIBlocked;
-    co_yield;
-
-    for ( ;; ) {
-        r = MPI_Test(&request, &flag, MPI_STATUS_IGNORE);
-        RETURN_IF_NOT_SUCCESS(r);
-        if ( flag ) {
-            // done
-            co_currentTask->state = Task::Runnable;
-            return r;
-        }
-
-        co_yield;
-    }
+    // parked on the worker's MPIPoller until done
+    return MPIPoller::call([&] (MPI_Request *request) {
+                // not ahead of the smaller ones
+                if ( aggregate ) MPIAggregator::Instance().flush(dest, comm);
+                return MPI_Isend(buf, count, datatype, dest, tag, comm, request);
+            }, MPI_STATUS_IGNORE);
 }
 
 int
@@ -51,42 +36,128 @@ MPI_Recv_Hook(
         void *buf, int count, MPI_Datatype datatype,
         int source, int tag, MPI_Comm comm, MPI_Status *status)
 {
-    MPI_Request request;
-    int r;
+    if ( Config::Instance().mpi_recv_dispatch ) {
+        return MPIDispatcher::Instance().recv(buf, count, datatype, source, tag, comm, status);
+    }
 
-    r = MPI_Irecv(buf, count, datatype, source, tag, comm, &request);
-    RETURN_IF_NOT_SUCCESS(r);
+    DEBUG_PRINT_LOCAL("Waiting for the receive ...");
+    int r = MPIPoller::call([&] (MPI_Request *request) {
+                return MPI_Irecv(buf, count, datatype, source, tag, comm, request);
+            }, status);
+    DEBUG_PRINT_LOCAL("Received.");
+    return r;
+}
 
-    int flag;
-    DEBUG_PRINT_LOCAL("First try ...\n");
-    r = MPI_Test(&request, &flag, MPI_STATUS_IGNORE);
-    RETURN_IF_NOT_SUCCESS(r);
-    if ( flag ) {
-        DEBUG_PRINT_LOCAL("First try ok...\n");
-        // already ok
+int
+MPI_Sendrecv_Hook(
+        const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+        int dest, int sendtag,
+        void *recvbuf, int recvcount, MPI_Datatype recvtype,
+        int source, int recvtag, MPI_Comm comm, MPI_Status *status)
+{
+    // both posted before waiting, as MPI_Sendrecv does
+    MPI_Request send = MPI_REQUEST_NULL;
+    int r;
+    if ( Config::Instance().mpi_send_aggregate && sendtag == MPIAggregator::batch_tag ) {
+        return MPI_ERR_TAG;
+    }
+    if ( Config::Instance().mpi_recv_dispatch ) {
+        // Isend from the worker's stack, not waiting for it
+        r = MPIPoller::call([&] (MPI_Request *request) {
+                    *request = MPI_REQUEST_NULL;
+                    if ( Config::Instance().mpi_send_aggregate ) {
+                        MPIAggregator::Instance().flush(dest, comm);
+                    }
+                    return MPI_Isend(sendbuf, sendcount, sendtype, dest, sendtag, comm, &send);
+                }, MPI_STATUS_IGNORE);
+        if ( r == MPI_SUCCESS ) {
+            r = MPIDispatcher::Instance().recv(recvbuf, recvcount, recvtype,
+                    source, recvtag, comm, status);
+        }
+    } else {
+        r = MPIPoller::call([&] (MPI_Request *request) {
+                    int r = MPI_Isend(sendbuf, sendcount, sendtype, dest, sendtag, comm, &send);
+                    if ( r != MPI_SUCCESS ) return r;
+                    return MPI_Irecv(recvbuf, recvcount, recvtype, source, recvtag, comm, request);
+                }, status);
+    }
+    if ( send == MPI_REQUEST_NULL ) {
         return r;
     }
+    int rs = MPIPoller::wait(&send, MPI_STATUS_IGNORE);
+    return r != MPI_SUCCESS ? r : rs;
+}
 
-    co_currentTask->state = Task::MPIBlocked;
-
-    DEBUG_PRINT_LOCAL("First try got blocked, yielding...\n");
-    co_yield;
-    DEBUG_PRINT_LOCAL("Waken up from yield.");
+int
+MPI_Probe_Hook(int source, int tag, MPI_Comm comm, MPI_Status *status)
+{
+    if ( Config::Instance().mpi_recv_dispatch ) {
+        // the dispatcher may have taken the message already
+        return MPIDispatcher::Instance().probe(source, tag, comm, status);
+    }
+    return MPIPoller::probe(source, tag, comm, status);
+}
 
-    for ( ;; ) {
-        r = MPI_Test(&request, &flag, status);
-        RETURN_IF_NOT_SUCCESS(r);
+int
+MPI_Wait_Hook(MPI_Request *request, MPI_Status *status)
+{
+    return MPIPoller::wait(request, status);
+}
 
-        if ( flag ) {
-            // done
-            co_currentTask->state = Task::Runnable;
-            return r;
+int
+MPI_Waitall_Hook(int count, MPI_Request requests[], MPI_Status statuses[])
+{
+    // one after the other: the ones done meanwhile do not park
+    bool failed = false;
+    for ( int i = 0; i < count; ++i ) {
+        MPI_Status *status = statuses == MPI_STATUSES_IGNORE ? MPI_STATUS_IGNORE : &statuses[i];
+        int r = MPIPoller::wait(&requests[i], status);
+        if ( r != MPI_SUCCESS ) {
+            failed = true;
+            if ( status != MPI_STATUS_IGNORE ) {
+                status->MPI_ERROR = r;
+            }
         }
-        co_yield;
     }
+    return failed ? MPI_ERR_IN_STATUS : MPI_SUCCESS;
+}
+
+int
+MPI_Barrier_Hook(MPI_Comm comm)
+{
+    return MPIPoller::call([&] (MPI_Request *request) {
+                return MPI_Ibarrier(comm, request);
+            }, MPI_STATUS_IGNORE);
+}
+
+int
+MPI_Bcast_Hook(void *buffer, int count, MPI_Datatype datatype,
+        int root, MPI_Comm comm)
+{
+    return MPIPoller::call([&] (MPI_Request *request) {
+                return MPI_Ibcast(buffer, count, datatype, root, comm, request);
+            }, MPI_STATUS_IGNORE);
+}
+
+int
+MPI_Allreduce_Hook(const void *sendbuf, void *recvbuf, int count,
+        MPI_Datatype datatype, MPI_Op op, MPI_Comm comm)
+{
+    return MPIPoller::call([&] (MPI_Request *request) {
+                return MPI_Iallreduce(sendbuf, recvbuf, count, datatype, op, comm, request);
+            }, MPI_STATUS_IGNORE);
+}
+
+int
+MPI_Alltoall_Hook(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+        void *recvbuf, int recvcount, MPI_Datatype recvtype, MPI_Comm comm)
+{
+    return MPIPoller::call([&] (MPI_Request *request) {
+                return MPI_Ialltoall(sendbuf, sendcount, sendtype,
+                        recvbuf, recvcount, recvtype, comm, request);
+            }, MPI_STATUS_IGNORE);
 }
 
 #include "debug_local_end.hh"
 
 #endif /* _MPI_HOOKS_CC_ */
-
@@ -3,11 +3,44 @@
 
 #include <mpi.h>
 
+/* The blocking MPI calls for tasks: the task parks until the call
+ * completes, its worker runs other tasks meanwhile; see MPIPoller.
+ * Outside tasks they are the plain calls. Collectives are started in
+ * the order the tasks call them, like their MPI_I* counterparts: on a
+ * communicator, the tasks of a rank must not call them concurrently.
+ * With Config::mpi_recv_dispatch, the receives go through the
+ * MPIDispatcher, see there for what it takes; with
+ * Config::mpi_send_aggregate, the small sends through the
+ * MPIAggregator. */
+
 int MPI_Send_Hook(const void *buf, int count, MPI_Datatype datatype,
         int dest, int tag, MPI_Comm comm);
 
 int MPI_Recv_Hook(void *buf, int count, MPI_Datatype datatype,
         int source, int tag, MPI_Comm comm, MPI_Status *status);
 
-#endif /* _MPI_HOOKS_HH_ */
+int MPI_Sendrecv_Hook(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+        int dest, int sendtag,
+        void *recvbuf, int recvcount, MPI_Datatype recvtype,
+        int source, int recvtag, MPI_Comm comm, MPI_Status *status);
+
+int MPI_Probe_Hook(int source, int tag, MPI_Comm comm, MPI_Status *status);
+
+/* on requests of the nonblocking calls of the user */
+int MPI_Wait_Hook(MPI_Request *request, MPI_Status *status);
+
+int MPI_Waitall_Hook(int count, MPI_Request requests[], MPI_Status statuses[]);
 
+/* through the MPI-3 nonblocking collectives */
+int MPI_Barrier_Hook(MPI_Comm comm);
+
+int MPI_Bcast_Hook(void *buffer, int count, MPI_Datatype datatype,
+        int root, MPI_Comm comm);
+
+int MPI_Allreduce_Hook(const void *sendbuf, void *recvbuf, int count,
+        MPI_Datatype datatype, MPI_Op op, MPI_Comm comm);
+
+int MPI_Alltoall_Hook(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+        void *recvbuf, int recvcount, MPI_Datatype recvtype, MPI_Comm comm);
+
+#endif /* _MPI_HOOKS_HH_ */
@@ -0,0 +1,433 @@
+#include "co_user.hh"
+#include "co_chan.hh"
+#include "Config.hh"
+#include "MPIAggregator.hh"
+#include "MPIPoller.hh"
+
+#include <mpi.h>
+#include <stdio.h>
+#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+/* mpirun -np 2 ./mpi_hooks_test */
+
+constexpr int num_of_tasks = 2000;
+
+int mpi_me;
+int mpi_peer;
+/* no hook receives on it: the user's own receives, which would miss
+ * the messages the dispatcher took with YAMI_MPI_DISPATCH=1 */
+MPI_Comm plain;
+
+/* outside tasks, the hooks are the blocking calls */
+void outside_test() {
+    int out = mpi_me, in = -1;
+    if ( mpi_me == 0 ) {
+        int r = MPI_Send_Hook(&out, 1, MPI_INT, mpi_peer, 0, MPI_COMM_WORLD);
+        assert(r == MPI_SUCCESS);
+        r = MPI_Recv_Hook(&in, 1, MPI_INT, mpi_peer, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        assert(r == MPI_SUCCESS);
+    } else {
+        int r = MPI_Recv_Hook(&in, 1, MPI_INT, mpi_peer, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        assert(r == MPI_SUCCESS);
+        r = MPI_Send_Hook(&out, 1, MPI_INT, mpi_peer, 0, MPI_COMM_WORLD);
+        assert(r == MPI_SUCCESS);
+    }
+    assert(in == mpi_peer);
+    printf("%d: outside_test passed.\n", mpi_me);
+}
+
+/* every task of rank 0 waits for its message, rank 1 sends them in
+ * the reverse order and waits for the replies: thousands of requests
+ * pending at once on both sides */
+void many_requests_test() {
+    std::vector<int> replies(num_of_tasks, -1);
+    TaskBundle bundle;
+
+    auto start = std::chrono::steady_clock::now();
+    for ( int k = 0; k < num_of_tasks; ++k ) {
+        int i = mpi_me == 0 ? k : num_of_tasks - 1 - k;
+        bundle.registe(go([i, &replies] () {
+            int value = i * 3, in = -1;
+            MPI_Status status;
+            if ( mpi_me == 0 ) {
+                int r = MPI_Recv_Hook(&in, 1, MPI_INT, mpi_peer, i, MPI_COMM_WORLD, &status);
+                assert(r == MPI_SUCCESS);
+                assert(status.MPI_SOURCE == mpi_peer && status.MPI_TAG == i);
+                assert(in == value);
+                ++in;
+                r = MPI_Send_Hook(&in, 1, MPI_INT, mpi_peer, i, MPI_COMM_WORLD);
+                assert(r == MPI_SUCCESS);
+                replies[i] = in;
+            } else {
+                int r = MPI_Send_Hook(&value, 1, MPI_INT, mpi_peer, i, MPI_COMM_WORLD);
+                assert(r == MPI_SUCCESS);
+                r = MPI_Recv_Hook(&in, 1, MPI_INT, mpi_peer, i, MPI_COMM_WORLD, &status);
+                assert(r == MPI_SUCCESS);
+                replies[i] = in;
+            }
+        }));
+    }
+    bundle.wait();
+    auto period = std::chrono::steady_clock::now() - start;
+
+    for ( int i = 0; i < num_of_tasks; ++i ) {
+        assert(replies[i] == i * 3 + 1);
+    }
+    printf("%d: many_requests_test passed: %d round trips in %.1lf ms\n",
+            mpi_me, num_of_tasks,
+            std::chrono::duration<double, std::milli>(period).count());
+}
+
+void sendrecv_test() {
+    TaskBundle bundle;
+    for ( int i = 0; i < num_of_tasks; ++i ) {
+        bundle.registe(go([i] () {
+            int out = mpi_me * num_of_tasks + i, in = -1;
+            MPI_Status status;
+            int r = MPI_Sendrecv_Hook(&out, 1, MPI_INT, mpi_peer, i,
+                    &in, 1, MPI_INT, mpi_peer, i, MPI_COMM_WORLD, &status);
+            assert(r == MPI_SUCCESS);
+            assert(in == mpi_peer * num_of_tasks + i && status.MPI_TAG == i);
+        }));
+    }
+    bundle.wait();
+    printf("%d: sendrecv_test passed.\n", mpi_me);
+}
+
+/* a message of a size the receiver learns by probing */
+void probe_test() {
+    constexpr int size = 1000;
+    if ( mpi_me == 0 ) {
+        co_sleep_for(std::chrono::milliseconds(20));
+        std::vector<int> out(size, 7);
+        int r = MPI_Send_Hook(out.data(), size, MPI_INT, mpi_peer, 1, MPI_COMM_WORLD);
+        assert(r == MPI_SUCCESS);
+    } else {
+        MPI_Status status;
+        int r = MPI_Probe_Hook(mpi_peer, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+        assert(r == MPI_SUCCESS);
+        assert(status.MPI_TAG == 1);
+        int count;
+        MPI_Get_count(&status, MPI_INT, &count);
+        assert(count == size);
+        std::vector<int> in(count);
+        r = MPI_Recv_Hook(in.data(), count, MPI_INT, mpi_peer, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        assert(r == MPI_SUCCESS);
+        assert(in[0] == 7 && in[size - 1] == 7);
+    }
+    printf("%d: probe_test passed.\n", mpi_me);
+}
+
+/* a hook done at once leaves the task Runnable: a later co_yield
+ * must not go back to its request */
+void immediate_test() {
+    int out = mpi_me, in = -1;
+    int r = MPI_Send_Hook(&out, 1, MPI_INT, mpi_peer, 2, MPI_COMM_WORLD);
+    assert(r == MPI_SUCCESS);
+    co_yield;
+    r = MPI_Recv_Hook(&in, 1, MPI_INT, mpi_peer, 2, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    assert(r == MPI_SUCCESS && in == mpi_peer);
+    co_yield;
+
+    /* the null request, done at its first test */
+    r = MPIPoller::call([] (MPI_Request *request) {
+                *request = MPI_REQUEST_NULL;
+                return MPI_SUCCESS;
+            }, MPI_STATUS_IGNORE);
+    assert(r == MPI_SUCCESS);
+    assert(co_currentTask->state == Task::Runnable);
+    co_yield;
+    printf("%d: immediate_test passed.\n", mpi_me);
+}
+
+/* requests of the user's own nonblocking calls */
+void waitall_test() {
+    constexpr int n = 64;
+    std::vector<int> out(n), in(n, -1);
+    std::vector<MPI_Request> requests(2 * n);
+    std::vector<MPI_Status> statuses(2 * n);
+    for ( int i = 0; i < n; ++i ) {
+        out[i] = mpi_me + i;
+        MPI_Irecv(&in[i], 1, MPI_INT, mpi_peer, i, plain, &requests[i]);
+        MPI_Isend(&out[i], 1, MPI_INT, mpi_peer, i, plain, &requests[n + i]);
+    }
+    int r = MPI_Waitall_Hook(2 * n, requests.data(), statuses.data());
+    assert(r == MPI_SUCCESS);
+    for ( int i = 0; i < n; ++i ) {
+        assert(in[i] == mpi_peer + i && statuses[i].MPI_TAG == i);
+        assert(requests[i] == MPI_REQUEST_NULL && requests[n + i] == MPI_REQUEST_NULL);
+    }
+
+    int value = -1;
+    MPI_Request request;
+    MPI_Irecv(&value, 1, MPI_INT, mpi_peer, n, plain, &request);
+    /* not MPI_Send_Hook(), its batch would never match */
+    r = MPIPoller::call([&] (MPI_Request *send) {
+                return MPI_Isend(&mpi_me, 1, MPI_INT, mpi_peer, n, plain, send);
+            }, MPI_STATUS_IGNORE);
+    assert(r == MPI_SUCCESS);
+    r = MPI_Wait_Hook(&request, MPI_STATUS_IGNORE);
+    assert(r == MPI_SUCCESS);
+    assert(value == mpi_peer && request == MPI_REQUEST_NULL);
+    printf("%d: waitall_test passed.\n", mpi_me);
+}
+
+/* the collectives leave the workers running the other tasks */
+void collectives_test() {
+    /* a lone worker kept busy by the ticker never polls with
+     * MPIProgress::Idle */
+    bool tick = Config::Instance().mpi_progress != Config::MPIProgress::Idle
+        || Config::Instance().num_of_threads > 1;
+    std::atomic<bool> done = {false};
+    long ticks = 0;
+    TaskBundle ticker;
+    if ( tick ) {
+        ticker.registe(go([&done, &ticks] () {
+            while ( !done ) {
+                ++ticks;
+                co_yield;
+            }
+        }));
+    }
+
+    /* rank 1 enters late, rank 0 waits in the barrier meanwhile */
+    if ( mpi_me == 1 ) {
+        co_sleep_for(std::chrono::milliseconds(20));
+    }
+    long before = ticks;
+    int r = MPI_Barrier_Hook(MPI_COMM_WORLD);
+    assert(r == MPI_SUCCESS);
+    if ( mpi_me == 0 && tick ) {
+        assert(ticks > before);
+    }
+
+    int value = mpi_me == 0 ? 42 : -1;
+    r = MPI_Bcast_Hook(&value, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    assert(r == MPI_SUCCESS);
+    assert(value == 42);
+
+    int sum = 0, mine = mpi_me + 1;
+    r = MPI_Allreduce_Hook(&mine, &sum, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    assert(r == MPI_SUCCESS);
+    assert(sum == 3);
+
+    int out[2] = {mpi_me * 10, mpi_me * 10 + 1}, in[2] = {-1, -1};
+    r = MPI_Alltoall_Hook(out, 1, MPI_INT, in, 1, MPI_INT, MPI_COMM_WORLD);
+    assert(r == MPI_SUCCESS);
+    assert(in[0] == mpi_me && in[1] == 10 + mpi_me);
+
+    done = true;
+    ticker.wait();
+    printf("%d: collectives_test passed.\n", mpi_me);
+}
+
+/* a dup of MPI_COMM_WORLD, receives on it through the MPIDispatcher */
+MPI_Comm dispatched;
+/* printed from main(), printf() of a double takes more than a task stack */
+double dispatcher_ms;
+double aggregator_ms;
+
+void dispatcher_test() {
+    Config::Instance().mpi_recv_dispatch = true;
+
+    /* half of the messages come before their receive is posted */
+    std::vector<int> got(num_of_tasks, -1);
+    TaskBundle bundle;
+    auto start = std::chrono::steady_clock::now();
+    for ( int k = 0; k < num_of_tasks; ++k ) {
+        int i = mpi_me == 0 ? k : num_of_tasks - 1 - k;
+        bundle.registe(go([i, &got] () {
+            int out = mpi_me * num_of_tasks + i, in = -1;
+            MPI_Status status;
+            int r = MPI_Send_Hook(&out, 1, MPI_INT, mpi_peer, i, dispatched);
+            assert(r == MPI_SUCCESS);
+            r = MPI_Recv_Hook(&in, 1, MPI_INT, mpi_peer, i, dispatched, &status);
+            assert(r == MPI_SUCCESS);
+            assert(status.MPI_SOURCE == mpi_peer && status.MPI_TAG == i);
+            got[i] = in;
+        }));
+    }
+    bundle.wait();
+    auto period = std::chrono::steady_clock::now() - start;
+    for ( int i = 0; i < num_of_tasks; ++i ) {
+        assert(got[i] == mpi_peer * num_of_tasks + i);
+    }
+
+    /* too large for the pool: unexpected on rank 1, awaited on rank 0 */
+    constexpr int large = 64 * 1024;
+    std::vector<char> out(large, 'a' + mpi_me), in(large);
+    TaskBundle sender;
+    sender.registe(go([&out] () {
+        int r = MPI_Send_Hook(out.data(), large, MPI_CHAR, mpi_peer, num_of_tasks, dispatched);
+        assert(r == MPI_SUCCESS);
+    }));
+    if ( mpi_me == 1 ) {
+        co_sleep_for(std::chrono::milliseconds(20));
+    }
+    MPI_Status status;
+    int r = MPI_Recv_Hook(in.data(), large, MPI_CHAR, mpi_peer, num_of_tasks, dispatched, &status);
+    assert(r == MPI_SUCCESS);
+    int count;
+    MPI_Get_count(&status, MPI_CHAR, &count);
+    assert(count == large && in[0] == 'a' + mpi_peer && in[large - 1] == 'a' + mpi_peer);
+    sender.wait();
+
+    /* wildcards, and a count from a pooled message */
+    int value = mpi_me, peers = -1;
+    r = MPI_Send_Hook(&value, 1, MPI_INT, mpi_peer, num_of_tasks + 1, dispatched);
+    assert(r == MPI_SUCCESS);
+    r = MPI_Recv_Hook(&peers, 1, MPI_INT, MPI_ANY_SOURCE, MPI_ANY_TAG, dispatched, &status);
+    assert(r == MPI_SUCCESS);
+    MPI_Get_count(&status, MPI_INT, &count);
+    assert(peers == mpi_peer && count == 1);
+    assert(status.MPI_SOURCE == mpi_peer && status.MPI_TAG == num_of_tasks + 1);
+
+    peers = -1;
+    r = MPI_Sendrecv_Hook(&value, 1, MPI_INT, mpi_peer, num_of_tasks + 2,
+            &peers, 1, MPI_INT, mpi_peer, num_of_tasks + 2, dispatched, MPI_STATUS_IGNORE);
+    assert(r == MPI_SUCCESS);
+    assert(peers == mpi_peer);
+
+    r = MPI_Barrier_Hook(MPI_COMM_WORLD);
+    assert(r == MPI_SUCCESS);
+    Config::Instance().mpi_recv_dispatch = false;
+    dispatcher_ms = std::chrono::duration<double, std::milli>(period).count();
+    printf("%d: dispatcher_test passed.\n", mpi_me);
+}
+
+void aggregator_test() {
+    Config::Instance().mpi_recv_dispatch = true;
+    Config::Instance().mpi_send_aggregate = true;
+
+    std::vector<int> got(num_of_tasks, -1);
+    TaskBundle bundle;
+    auto start = std::chrono::steady_clock::now();
+    for ( int k = 0; k < num_of_tasks; ++k ) {
+        int i = mpi_me == 0 ? k : num_of_tasks - 1 - k;
+        bundle.registe(go([i, &got] () {
+            int out = mpi_me * num_of_tasks + i, in = -1;
+            MPI_Status status;
+            int r = MPI_Send_Hook(&out, 1, MPI_INT, mpi_peer, i, dispatched);
+            assert(r == MPI_SUCCESS);
+            r = MPI_Recv_Hook(&in, 1, MPI_INT, mpi_peer, i, dispatched, &status);
+            assert(r == MPI_SUCCESS);
+            assert(status.MPI_SOURCE == mpi_peer && status.MPI_TAG == i);
+            got[i] = in;
+        }));
+    }
+    bundle.wait();
+    auto period = std::chrono::steady_clock::now() - start;
+    for ( int i = 0; i < num_of_tasks; ++i ) {
+        assert(got[i] == mpi_peer * num_of_tasks + i);
+    }
+
+    /* a large send does not overtake the batch */
+    constexpr int large = 64 * 1024;
+    int tag = num_of_tasks;
+    std::vector<char> out(large, 'a' + mpi_me), in(large);
+    TaskBundle sender;
+    sender.registe(go([&out, tag] () {
+        int first = 1, last = 2;
+        int r = MPI_Send_Hook(&first, 1, MPI_INT, mpi_peer, tag, dispatched);
+        assert(r == MPI_SUCCESS);
+        r = MPI_Send_Hook(out.data(), large, MPI_CHAR, mpi_peer, tag, dispatched);
+        assert(r == MPI_SUCCESS);
+        r = MPI_Send_Hook(&last, 1, MPI_INT, mpi_peer, tag, dispatched);
+        assert(r == MPI_SUCCESS);
+    }));
+    int value = 0, count;
+    MPI_Status status;
+    int r = MPI_Recv_Hook(&value, 1, MPI_INT, mpi_peer, tag, dispatched, MPI_STATUS_IGNORE);
+    assert(r == MPI_SUCCESS);
+    assert(value == 1);
+    r = MPI_Recv_Hook(in.data(), large, MPI_CHAR, mpi_peer, tag, dispatched, &status);
+    assert(r == MPI_SUCCESS);
+    MPI_Get_count(&status, MPI_CHAR, &count);
+    assert(count == large && in[0] == 'a' + mpi_peer);
+    r = MPI_Recv_Hook(&value, 1, MPI_INT, mpi_peer, tag, dispatched, MPI_STATUS_IGNORE);
+    assert(r == MPI_SUCCESS);
+    assert(value == 2);
+    sender.wait();
+
+    /* out on the delay, the workers never idle; only idle workers
+     * would receive it with MPIProgress::Idle */
+    if ( Config::Instance().mpi_progress != Config::MPIProgress::Idle ) {
+        std::atomic<bool> done = {false};
+        TaskBundle busy;
+        for ( int i = 0; i < Config::Instance().num_of_threads; ++i ) {
+            busy.registe(go([&done] () {
+                while ( !done.load() ) {
+                    co_yield;
+                }
+            }));
+        }
+        value = mpi_me;
+        r = MPI_Send_Hook(&value, 1, MPI_INT, mpi_peer, tag + 1, dispatched);
+        assert(r == MPI_SUCCESS);
+        r = MPI_Recv_Hook(&value, 1, MPI_INT, mpi_peer, tag + 1, dispatched, MPI_STATUS_IGNORE);
+        assert(r == MPI_SUCCESS);
+        assert(value == mpi_peer);
+        done = true;
+        busy.wait();
+    }
+
+    /* batch_tag is reserved, a batch claiming more than it holds is
+     * dropped without taking the next message with it */
+    int bad = MPIAggregator::batch_tag;
+    r = MPI_Send_Hook(&value, 1, MPI_INT, mpi_peer, bad, dispatched);
+    assert(r == MPI_ERR_TAG);
+    r = MPI_Recv_Hook(&value, 1, MPI_INT, mpi_peer, bad, dispatched, MPI_STATUS_IGNORE);
+    assert(r == MPI_ERR_TAG);
+    MPIAggregator::Header header{tag + 2, 1 << 20};
+    r = MPIPoller::call([&header, bad] (MPI_Request *request) {
+                return MPI_Isend(&header, sizeof(header), MPI_BYTE, mpi_peer, bad, dispatched, request);
+            }, MPI_STATUS_IGNORE);
+    assert(r == MPI_SUCCESS);
+    value = mpi_me;
+    r = MPI_Send_Hook(&value, 1, MPI_INT, mpi_peer, tag + 2, dispatched);
+    assert(r == MPI_SUCCESS);
+    r = MPI_Recv_Hook(&value, 1, MPI_INT, mpi_peer, tag + 2, dispatched, MPI_STATUS_IGNORE);
+    assert(r == MPI_SUCCESS);
+    assert(value == mpi_peer);
+
+    r = MPI_Barrier_Hook(MPI_COMM_WORLD);
+    assert(r == MPI_SUCCESS);
+    Config::Instance().mpi_send_aggregate = false;
+    Config::Instance().mpi_recv_dispatch = false;
+    aggregator_ms = std::chrono::duration<double, std::milli>(period).count();
+    printf("%d: aggregator_test passed.\n", mpi_me);
+}
+
+int main() {
+    int thread_level;
+    MPI_Init_thread(NULL, NULL, MPI_THREAD_MULTIPLE, &thread_level);
+    assert(thread_level == MPI_THREAD_MULTIPLE);
+
+    int size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &mpi_me);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    assert(size == 2);
+    mpi_peer = 1 - mpi_me;
+
+    outside_test();
+    MPI_Comm_dup(MPI_COMM_WORLD, &dispatched);
+    MPI_Comm_dup(MPI_COMM_WORLD, &plain);
+
+    co_init();
+    go([] () {
+        for ( auto test : {many_requests_test, sendrecv_test, probe_test, immediate_test, waitall_test, collectives_test, dispatcher_test, aggregator_test} ) {
+            TaskBundle().registe(go(test)).wait();
+        }
+        co_terminate();
+    });
+    co_mainloop();
+    printf("%d: %d round trips dispatched in %.1lf ms, aggregated in %.1lf ms\n",
+            mpi_me, num_of_tasks, dispatcher_ms, aggregator_ms);
+
+    MPI_Comm_free(&plain);
+    MPI_Comm_free(&dispatched);
+    MPI_Finalize();
+}
@@ -0,0 +1,147 @@
+#include "co_user.hh"
+#include "MPIStealer.hh"
+
+#include <mpi.h>
+#include <stdio.h>
+#include <cassert>
+#include <cstring>
+#include <chrono>
+#include <string>
+
+/* mpirun -np 4 ./mpi_steal_test */
+
+constexpr int max_depth = 10;
+constexpr int node_us = 50;
+constexpr int num_of_flat = 200;
+
+int mpi_me;
+int mpi_size;
+
+int fn_node;
+int fn_flat;
+
+double tree_ms;
+
+static unsigned long
+mix(unsigned long x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdUL;
+    x ^= x >> 33;
+    return x;
+}
+
+/* an unbalanced tree: 0 to 4 children, by the id of the node */
+static int
+children(unsigned long id, int depth)
+{
+    /* mix(0) is 0, the root would have none */
+    return depth < max_depth ? (int)(mix(id + 1) % 5) : 0;
+}
+
+static long
+count(unsigned long id, int depth)
+{
+    long n = 1;
+    for ( int i = 0; i < children(id, depth); ++i ) {
+        n += count(id * 5 + i + 1, depth + 1);
+    }
+    return n;
+}
+
+static std::string
+pack(unsigned long id, int depth)
+{
+    std::string args((char const*)&id, sizeof(id));
+    args.append((char const*)&depth, sizeof(depth));
+    return args;
+}
+
+static void
+spin(int us)
+{
+    auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(us);
+    while ( std::chrono::steady_clock::now() < end ) {
+    }
+}
+
+static void
+node(std::string const &args)
+{
+    unsigned long id;
+    int depth;
+    memcpy(&id, args.data(), sizeof(id));
+    memcpy(&depth, args.data() + sizeof(id), sizeof(depth));
+    spin(node_us);
+    for ( int i = 0; i < children(id, depth); ++i ) {
+        MPIStealer::Instance().spawn(fn_node, pack(id * 5 + i + 1, depth + 1));
+    }
+}
+
+static void
+flat(std::string const &)
+{
+    spin(node_us);
+}
+
+/* sums over the ranks, outside tasks */
+static long
+total(long mine)
+{
+    long sum;
+    MPI_Allreduce(&mine, &sum, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+    return sum;
+}
+
+int main() {
+    int thread_level;
+    MPI_Init_thread(NULL, NULL, MPI_THREAD_MULTIPLE, &thread_level);
+    assert(thread_level == MPI_THREAD_MULTIPLE);
+    MPI_Comm_rank(MPI_COMM_WORLD, &mpi_me);
+    MPI_Comm_size(MPI_COMM_WORLD, &mpi_size);
+
+    MPIStealer &stealer = MPIStealer::Instance();
+    fn_node = stealer.registe(node);
+    fn_flat = stealer.registe(flat);
+
+    long tree_executed, tree_stolen, flat_executed;
+    co_init();
+    go([&] () {
+        /* the whole tree grows from rank 0 */
+        if ( mpi_me == 0 ) {
+            stealer.spawn(fn_node, pack(0, 0));
+        }
+        auto start = std::chrono::steady_clock::now();
+        stealer.run(MPI_COMM_WORLD);
+        tree_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        tree_executed = stealer.executed();
+        tree_stolen = stealer.stolen();
+
+        /* again, all of it spawned on the last rank */
+        if ( mpi_me == mpi_size - 1 ) {
+            for ( int i = 0; i < num_of_flat; ++i ) {
+                stealer.spawn(fn_flat, std::string());
+            }
+        }
+        stealer.run(MPI_COMM_WORLD);
+        flat_executed = stealer.executed();
+        co_terminate();
+    });
+    co_mainloop();
+
+    long nodes = count(0, 0);
+    /* collectives, on every rank even without asserts */
+    long treeTotal = total(tree_executed);
+    long flatTotal = total(flat_executed);
+    assert(treeTotal == nodes);
+    assert(flatTotal == num_of_flat);
+    if ( mpi_size > 1 ) {
+        /* the others had nothing but what they stole */
+        assert(mpi_me == 0 || tree_stolen > 0);
+        assert(tree_executed > 0);
+    }
+    printf("%d: %ld of %ld nodes run here, %ld stolen, in %.1lf ms\n",
+            mpi_me, tree_executed, nodes, tree_stolen, tree_ms);
+
+    MPI_Finalize();
+}
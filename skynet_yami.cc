@@ -1,5 +1,7 @@
 #include "co_user.hh"
+#include "co_future.hh"
 #include "stdio.h"
+#include <cstdlib>
 #include <chrono>
 #include <string>
 #include <vector>
@@ -43,6 +45,32 @@ void skynet(long &res, int num, int size, int div) {
     res = std::accumulate(rc.begin(), rc.end(), 0L);
 }
 
+/* results come back in the children's tasks, no allocation per level */
+long skynet_future(int num, int size, int div) {
+    if ( size == 1 ) {
+        return num;
+    }
+
+    constexpr int max_div = 10;
+    /* not MUST_TRUE(), compiled out: rc would overflow */
+    if ( div > max_div ) {
+        fprintf(stderr, "skynet_future: div %d over %d\n", div, max_div);
+        abort();
+    }
+    Future<long> rc[max_div];
+    for ( int i = 0; i < div; i++ ) {
+        rc[i] = go_future(skynet_future, num + i * (size / div), size / div, div);
+    }
+
+    when_all(rc, rc + div);
+
+    long res = 0;
+    for ( int i = 0; i < div; i++ ) {
+        res += rc[i].get();
+    }
+    return res;
+}
+
 int main() {
     co_init();
 
@@ -59,6 +87,11 @@ int main() {
 
                 printf("Result: %ld\n", res);
             }
+            {
+                TimeInterval __("Skynet with futures");
+                Future<long> res = go_future(skynet_future, 0, 1000000, 10);
+                printf("Result: %ld\n", res.get());
+            }
             co_terminate();
     });
 
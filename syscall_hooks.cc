@@ -0,0 +1,304 @@
+/* Blocking calls made from tasks, routed through the runtime.
+ *
+ * Link this object into an executable, like mpi_hooks.cc, and the
+ * read, write, recv, send, accept, connect, poll, nanosleep, usleep
+ * and close calls of the program and of the shared libraries it uses
+ * resolve here instead of in libc. Called from a non-pure task, a
+ * socket call that would block parks the task in the NetPoller, and
+ * a sleep parks it on a timer; anywhere else, and on fds that are no
+ * sockets, they are the plain syscalls.
+ *
+ * The fds keep their flags: a call blocks only if the fd is blocking
+ * for the caller, otherwise it sees EAGAIN as usual. SO_RCVTIMEO and
+ * SO_SNDTIMEO are not honoured in tasks. poll() on more than one fd
+ * checks them again every millisecond. A cancelled task sees its
+ * sleeps interrupted, with EINTR.
+ */
+
+#include "GlobalMediator.hh"
+#include "NetPoller.hh"
+#include "Task.hh"
+#include "co_chan.hh"
+#include "co_net.hh"
+
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+/* the libc calls themselves, without coming back here */
+
+static ssize_t
+real_read(int fd, void *buf, size_t count)
+{
+    return syscall(SYS_read, fd, buf, count);
+}
+
+static ssize_t
+real_write(int fd, void const *buf, size_t count)
+{
+    return syscall(SYS_write, fd, buf, count);
+}
+
+static ssize_t
+real_recv(int fd, void *buf, size_t len, int flags)
+{
+    return syscall(SYS_recvfrom, fd, buf, len, flags, nullptr, nullptr);
+}
+
+static ssize_t
+real_send(int fd, void const *buf, size_t len, int flags)
+{
+    return syscall(SYS_sendto, fd, buf, len, flags, nullptr, 0);
+}
+
+static int
+real_poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    struct timespec ts = {timeout / 1000, (timeout % 1000) * 1000000L};
+    return (int)syscall(SYS_ppoll, fds, nfds, timeout < 0 ? nullptr : &ts, nullptr, 0);
+}
+
+/* the current task if it may park, nullptr outside tasks */
+static Task*
+hookedTask()
+{
+    if ( GlobalMediator::thread_id < 0 ) {
+        return nullptr;
+    }
+    TaskPtr &task = co_currentTask;
+    return task && !task->pure() ? task.get() : nullptr;
+}
+
+static bool
+userNonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && (flags & O_NONBLOCK);
+}
+
+/* fds found not to be sockets, until closed */
+constexpr int max_tracked_fd = 1 << 16;
+static std::atomic<bool> notSocket[max_tracked_fd];
+
+static bool
+knownNotSocket(int fd)
+{
+    return fd >= 0 && fd < max_tracked_fd && notSocket[fd].load(std::memory_order_relaxed);
+}
+
+static void
+setNotSocket(int fd, bool v)
+{
+    if ( fd >= 0 && fd < max_tracked_fd ) {
+        notSocket[fd].store(v, std::memory_order_relaxed);
+    }
+}
+
+/* sleep d in the task, EINTR if its cancellation cut it short */
+static int
+taskSleep(Timer::clock::duration d, struct timespec *rem)
+{
+    Timer::clock::time_point deadline = Timer::clock::now() + d;
+    co_sleep_for(d);
+    Timer::clock::duration left = deadline - Timer::clock::now();
+    if ( left <= Timer::clock::duration::zero() ) {
+        return 0;
+    }
+    if ( rem ) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+        rem->tv_sec = ns / 1000000000;
+        rem->tv_nsec = ns % 1000000000;
+    }
+    errno = EINTR;
+    return -1;
+}
+
+/* park until fd may be ready for d; if another task waits on it,
+ * nap instead, as both may block on it outside the hooks */
+static int
+waitFd(int fd, NetPoller::Direction d)
+{
+    int err = netPoller.wait(fd, d);
+    if ( err == EBUSY ) {
+        return taskSleep(std::chrono::milliseconds(1), nullptr) == 0 ? 0 : errno;
+    }
+    return err;
+}
+
+/* call() is nonblocking, park on EAGAIN unless the fd is nonblocking itself */
+template<class Call>
+static ssize_t
+taskIO(int fd, NetPoller::Direction d, Call call)
+{
+    for ( ;; ) {
+        ssize_t r = call();
+        if ( r >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK) || userNonblocking(fd) ) {
+            return r;
+        }
+        if ( int err = waitFd(fd, d) ) {
+            errno = err;
+            return -1;
+        }
+    }
+}
+
+extern "C" {
+
+ssize_t
+read(int fd, void *buf, size_t count)
+{
+    if ( !hookedTask() || knownNotSocket(fd) ) {
+        return real_read(fd, buf, count);
+    }
+    ssize_t r = taskIO(fd, NetPoller::Read, [=] () {
+                return real_recv(fd, buf, count, MSG_DONTWAIT);
+            });
+    if ( r < 0 && errno == ENOTSOCK ) {
+        setNotSocket(fd, true);
+        return real_read(fd, buf, count);
+    }
+    return r;
+}
+
+ssize_t
+write(int fd, void const *buf, size_t count)
+{
+    if ( !hookedTask() || knownNotSocket(fd) ) {
+        return real_write(fd, buf, count);
+    }
+    ssize_t r = taskIO(fd, NetPoller::Write, [=] () {
+                return real_send(fd, buf, count, MSG_DONTWAIT);
+            });
+    if ( r < 0 && errno == ENOTSOCK ) {
+        setNotSocket(fd, true);
+        return real_write(fd, buf, count);
+    }
+    return r;
+}
+
+ssize_t
+recv(int fd, void *buf, size_t len, int flags)
+{
+    if ( !hookedTask() || (flags & MSG_DONTWAIT) ) {
+        return real_recv(fd, buf, len, flags);
+    }
+    return taskIO(fd, NetPoller::Read, [=] () {
+                return real_recv(fd, buf, len, flags | MSG_DONTWAIT);
+            });
+}
+
+ssize_t
+send(int fd, void const *buf, size_t len, int flags)
+{
+    if ( !hookedTask() || (flags & MSG_DONTWAIT) ) {
+        return real_send(fd, buf, len, flags);
+    }
+    return taskIO(fd, NetPoller::Write, [=] () {
+                return real_send(fd, buf, len, flags | MSG_DONTWAIT);
+            });
+}
+
+int
+accept(int fd, struct sockaddr *addr, socklen_t *addrlen)
+{
+    if ( hookedTask() && !userNonblocking(fd) ) {
+        /* a blocking accept() cannot be made nonblocking per call:
+         * wait until a connection is pending */
+        struct pollfd p = {fd, POLLIN, 0};
+        while ( real_poll(&p, 1, 0) == 0 ) {
+            if ( int err = waitFd(fd, NetPoller::Read) ) {
+                errno = err;
+                return -1;
+            }
+        }
+    }
+    return (int)syscall(SYS_accept4, fd, addr, addrlen, 0);
+}
+
+int
+connect(int fd, struct sockaddr const *addr, socklen_t addrlen)
+{
+    int flags;
+    if ( !hookedTask() || (flags = fcntl(fd, F_GETFL)) < 0 || (flags & O_NONBLOCK) ) {
+        return (int)syscall(SYS_connect, fd, addr, addrlen);
+    }
+    /* nonblocking for the time of the call, the task owns fd */
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    int r = co_connect(fd, addr, addrlen);
+    int err = errno;
+    fcntl(fd, F_SETFL, flags);
+    errno = err;
+    return r;
+}
+
+int
+poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    if ( !hookedTask() || timeout == 0 ) {
+        return real_poll(fds, nfds, timeout);
+    }
+    Timer::clock::time_point deadline = timeout < 0 ?
+        Timer::clock::time_point::max() :
+        Timer::clock::now() + std::chrono::milliseconds(timeout);
+
+    for ( ;; ) {
+        int r = real_poll(fds, nfds, 0);
+        if ( r != 0 || Timer::clock::now() >= deadline ) {
+            return r;
+        }
+        short events = nfds == 1 && fds[0].fd >= 0 ? fds[0].events & (POLLIN | POLLOUT) : 0;
+        bool parked = false;
+        if ( events == POLLIN || events == POLLOUT ) {
+            NetPoller::Direction d = events == POLLIN ? NetPoller::Read : NetPoller::Write;
+            int err = timeout < 0 ?
+                netPoller.wait(fds[0].fd, d) :
+                netPoller.wait_until(fds[0].fd, d, deadline);
+            /* EBUSY: another task waits on the fd, poll it below */
+            parked = err != EBUSY;
+        }
+        if ( !parked ) {
+            Timer::clock::duration d = std::min<Timer::clock::duration>(
+                    std::chrono::milliseconds(1), deadline - Timer::clock::now());
+            if ( taskSleep(d, nullptr) != 0 ) {
+                return -1;
+            }
+        }
+    }
+}
+
+int
+nanosleep(struct timespec const *req, struct timespec *rem)
+{
+    if ( !hookedTask() ) {
+        return (int)syscall(SYS_nanosleep, req, rem);
+    }
+    if ( req->tv_sec < 0 || req->tv_nsec < 0 || req->tv_nsec >= 1000000000 ) {
+        errno = EINVAL;
+        return -1;
+    }
+    return taskSleep(std::chrono::seconds(req->tv_sec) + std::chrono::nanoseconds(req->tv_nsec), rem);
+}
+
+int
+usleep(useconds_t usec)
+{
+    struct timespec req = {(time_t)(usec / 1000000), (long)(usec % 1000000) * 1000};
+    return nanosleep(&req, nullptr);
+}
+
+int
+close(int fd)
+{
+    setNotSocket(fd, false);
+    return netPoller.close(fd);
+}
+
+}
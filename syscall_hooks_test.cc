@@ -0,0 +1,211 @@
+#include "co_user.hh"
+#include "Config.hh"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+/* plain blocking calls, as a client library would make them; with a
+ * single worker, any of them really blocking would hang the test */
+
+constexpr int num_of_clients = 20;
+constexpr int num_of_sleepers = 100;
+constexpr int sleep_ms = 20;
+
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+void outside_test() {
+    /* no task: the plain syscalls */
+    int p[2];
+    int r = pipe(p);
+    assert(r == 0);
+    ssize_t n = write(p[1], "x", 1);
+    assert(n == 1);
+    char c;
+    n = read(p[0], &c, 1);
+    assert(n == 1 && c == 'x');
+    int r0 = close(p[0]), r1 = close(p[1]);
+    assert(r0 == 0 && r1 == 0);
+    printf("outside_test passed.\n");
+}
+
+void socketpair_test() {
+    int sv[2];
+    int r = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    assert(r == 0);
+    TaskBundle bundle;
+
+    bundle.registe(go([fd = sv[0]] () {
+        char buf[4];
+        ssize_t n = read(fd, buf, sizeof(buf));
+        assert(n == 4 && memcmp(buf, "ping", 4) == 0);
+        n = send(fd, "pong", 4, 0);
+        assert(n == 4);
+    }));
+    bundle.registe(go([fd = sv[1]] () {
+        usleep(sleep_ms * 1000);
+        ssize_t n = write(fd, "ping", 4);
+        assert(n == 4);
+        char buf[4];
+        n = recv(fd, buf, sizeof(buf), 0);
+        assert(n == 4 && memcmp(buf, "pong", 4) == 0);
+    }));
+    bundle.wait();
+
+    /* a nonblocking fd still sees EAGAIN */
+    char c;
+    int flags = fcntl(sv[0], F_GETFL);
+    fcntl(sv[0], F_SETFL, flags | O_NONBLOCK);
+    ssize_t n = read(sv[0], &c, 1);
+    assert(n == -1 && errno == EAGAIN);
+    close(sv[0]);
+    close(sv[1]);
+    printf("socketpair_test passed.\n");
+}
+
+void echo_test() {
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int r = bind(lfd, (sockaddr*)&addr, sizeof(addr));
+    assert(r == 0);
+    r = listen(lfd, num_of_clients);
+    assert(r == 0);
+    socklen_t len = sizeof(addr);
+    r = getsockname(lfd, (sockaddr*)&addr, &len);
+    assert(r == 0);
+    TaskBundle bundle;
+
+    bundle.registe(go([lfd] () {
+        TaskBundle conns;
+        for ( int i = 0; i < num_of_clients; ++i ) {
+            int fd = accept(lfd, nullptr, nullptr);
+            assert(fd >= 0);
+            conns.registe(go([fd] () {
+                char buf[64];
+                ssize_t n;
+                while ( (n = read(fd, buf, sizeof(buf))) > 0 ) {
+                    ssize_t w = write(fd, buf, n);
+                    assert(w == n);
+                }
+                close(fd);
+            }));
+        }
+        conns.wait();
+    }));
+    for ( int i = 0; i < num_of_clients; ++i ) {
+        bundle.registe(go([&addr, i] () {
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            int rc = connect(fd, (sockaddr*)&addr, sizeof(addr));
+            assert(rc == 0);
+            /* still blocking for its owner */
+            int flags = fcntl(fd, F_GETFL);
+            assert(!(flags & O_NONBLOCK));
+            char out = 'a' + i, in;
+            for ( int r = 0; r < 10; ++r ) {
+                ssize_t n = write(fd, &out, 1);
+                assert(n == 1);
+                n = read(fd, &in, 1);
+                assert(n == 1 && in == out);
+            }
+            close(fd);
+        }));
+    }
+    bundle.wait();
+    close(lfd);
+    printf("echo_test passed.\n");
+}
+
+void poll_test() {
+    int sv[2];
+    int r = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    assert(r == 0);
+    std::atomic<bool> done = {false};
+    long ticks = 0;
+    TaskBundle ticker, bundle;
+
+    ticker.registe(go([&done, &ticks] () {
+        while ( !done ) {
+            ++ticks;
+            co_yield;
+        }
+    }));
+
+    /* times out, the worker running the ticker meanwhile */
+    struct pollfd p = {sv[0], POLLIN, 0};
+    auto start = steady_clock::now();
+    r = poll(&p, 1, sleep_ms);
+    assert(r == 0);
+    assert(steady_clock::now() - start >= milliseconds(sleep_ms));
+    assert(ticks > 0);
+
+    bundle.registe(go([fd = sv[1]] () {
+        usleep(sleep_ms * 1000);
+        ssize_t n = write(fd, "x", 1);
+        assert(n == 1);
+    }));
+    r = poll(&p, 1, -1);
+    assert(r == 1 && (p.revents & POLLIN));
+    bundle.wait();
+
+    /* two fds */
+    struct pollfd two[2] = {{sv[0], POLLIN, 0}, {sv[1], POLLIN, 0}};
+    r = poll(two, 2, sleep_ms);
+    assert(r == 1 && (two[0].revents & POLLIN));
+
+    done = true;
+    ticker.wait();
+    close(sv[0]);
+    close(sv[1]);
+    printf("poll_test passed.\n");
+}
+
+void sleep_test() {
+    TaskBundle bundle;
+    auto start = steady_clock::now();
+    for ( int i = 0; i < num_of_sleepers; ++i ) {
+        bundle.registe(go([i] () {
+            int r;
+            if ( i % 2 ) {
+                r = usleep(sleep_ms * 1000);
+            } else {
+                struct timespec req = {0, sleep_ms * 1000000L};
+                r = nanosleep(&req, nullptr);
+            }
+            assert(r == 0);
+        }));
+    }
+    bundle.wait();
+    auto period = steady_clock::now() - start;
+    assert(period >= milliseconds(sleep_ms));
+    assert(period < milliseconds(num_of_sleepers * sleep_ms / 4));
+    printf("sleep_test passed.\n");
+}
+
+int main() {
+    outside_test();
+
+    Config::Instance().num_of_threads = 1;
+    co_init();
+
+    go([] () {
+        for ( auto test : {socketpair_test, echo_test, poll_test, sleep_test} ) {
+            TaskBundle().registe(go(test)).wait();
+        }
+        co_terminate();
+    });
+
+    co_mainloop();
+}
@@ -1,4 +1,5 @@
 #include "co_user.hh"
+#include "co_chan.hh"
 #include "stdio.h"
 
 #include <chrono>
@@ -157,6 +158,80 @@ complex_scheduling_test(int test_size, int num)
     }
 }
 
+void
+chan_ping_pong_test(int rounds)
+{
+    /* off the 4KB task stack, TimeInterval's printf needs it */
+    std::unique_ptr<chan<int>> ping(new chan<int>), pong(new chan<int>);
+    CountDownLatch latch;
+    latch.add(1);
+
+    {
+        char msg[128];
+        snprintf(msg, 128, "Yami:chan_ping_pong:rounds: %-8d", rounds);
+        TimeInterval _(msg, rounds);
+
+        go([&ping, &pong, &latch, rounds] () {
+            int v;
+            for ( int i = 0; i < rounds; ++i ) {
+                ping->recv(v);
+                pong->send(v + 1);
+            }
+            latch.down();
+        });
+
+        int v = 0;
+        for ( int i = 0; i < rounds; ++i ) {
+            ping->send(v);
+            pong->recv(v);
+        }
+        latch.wait();
+
+        /* avoid optimization */
+        fprintf(trash, "%d", v);
+    }
+}
+
+void
+chan_pipeline_test(int stages, int items, int capacity)
+{
+    std::vector<std::unique_ptr<chan<long>>> chans;
+    for ( int i = 0; i <= stages; ++i ) {
+        chans.emplace_back(new chan<long>(capacity));
+    }
+
+    {
+        char msg[128];
+        snprintf(msg, 128, "Yami:chan_pipeline:%-4dstages:%-8ditems:cap: %-4d", stages, items, capacity);
+        TimeInterval _(msg, stages * items);
+
+        for ( int s = 0; s < stages; ++s ) {
+            go([&chans, s] () {
+                long v;
+                while ( chans[s]->recv(v) ) {
+                    chans[s + 1]->send(v + 1);
+                }
+                chans[s + 1]->close();
+            });
+        }
+
+        go([&chans, items] () {
+            for ( long i = 0; i < items; ++i ) {
+                chans[0]->send(i);
+            }
+            chans[0]->close();
+        });
+
+        long v, sum = 0;
+        while ( chans[stages]->recv(v) ) {
+            sum += v;
+        }
+
+        /* avoid optimization */
+        fprintf(trash, "%ld", sum);
+    }
+}
+
 #include "Config.hh"
 #include <stdio.h>
 #include <stdlib.h>
@@ -231,6 +306,63 @@ dense_mat_mut_test(int ntasks = Config::Instance().num_of_threads)
 //    printf("Passed.\n");
 }
 
+const int stencil_size = 1 << 16;
+double stencil[2][stencil_size];
+
+/* one Jacobi sweep over rows [begin, end), from stencil[it % 2] */
+void
+stencil_sweep(int it, int begin, int end)
+{
+    double const *in = stencil[it % 2];
+    double *out = stencil[(it + 1) % 2];
+    for ( int i = std::max(begin, 1); i < std::min(end, stencil_size - 1); ++i ) {
+        out[i] = (in[i - 1] + in[i] + in[i + 1]) / 3;
+    }
+}
+
+void
+stencil_test(int ntasks, int iterations)
+{
+    int chunk = stencil_size / ntasks;
+    std::fill(stencil[0], stencil[0] + stencil_size, 0.0);
+    stencil[0][0] = stencil[1][0] = 1.0;
+
+    {
+        char msg[128];
+        snprintf(msg, 128, "Yami:stencil:respawn:%-4dtasks:%-6dits", ntasks, iterations);
+        TimeInterval _(msg, ntasks * iterations);
+
+        for ( int it = 0; it < iterations; ++it ) {
+            TaskBundle bundle;
+            for ( int t = 0; t < ntasks; ++t ) {
+                bundle.registe(go(stencil_sweep, it, t * chunk, (t + 1) * chunk));
+            }
+            bundle.wait();
+        }
+    }
+
+    {
+        char msg[128];
+        snprintf(msg, 128, "Yami:stencil:barrier:%-4dtasks:%-6dits", ntasks, iterations);
+        TimeInterval _(msg, ntasks * iterations);
+
+        co_barrier barrier(ntasks);
+        TaskBundle bundle;
+        for ( int t = 0; t < ntasks; ++t ) {
+            bundle.registe(go([&barrier, t, chunk, iterations] () {
+                for ( int it = 0; it < iterations; ++it ) {
+                    stencil_sweep(it, t * chunk, (t + 1) * chunk);
+                    barrier.arrive_and_wait();
+                }
+            }));
+        }
+        bundle.wait();
+    }
+
+    /* avoid optimization */
+    fprintf(trash, "%lf", stencil[iterations % 2][1]);
+}
+
 template<class Iterator>
 void
 merge_sort(Iterator first, Iterator last, std::size_t min_diff)
@@ -367,6 +499,36 @@ run_benchmarks()
             .wait()
             ;
 
+        TaskBundle()
+            .registe(go(std::bind(chan_ping_pong_test, 1000000)))
+            .wait()
+            ;
+
+        TaskBundle()
+            .registe(go(std::bind(chan_pipeline_test, 10, 100000, 0)))
+            .wait()
+            ;
+
+        TaskBundle()
+            .registe(go(std::bind(chan_pipeline_test, 10, 100000, 128)))
+            .wait()
+            ;
+
+        TaskBundle()
+            .registe(go(std::bind(chan_pipeline_test, 100, 10000, 128)))
+            .wait()
+            ;
+
+        TaskBundle()
+            .registe(go(std::bind(stencil_test, 16, 1000)))
+            .wait()
+            ;
+
+        TaskBundle()
+            .registe(go(std::bind(stencil_test, 256, 1000)))
+            .wait()
+            ;
+
         TaskBundle()
             .registe(go(std::bind(merge_sort_test, 1000000000LU, 100000000LU)))
             .wait()
@@ -6,6 +6,9 @@
 #include <cstddef>
 #include <utility>
 
+/* for padding/aligning data shared between threads */
+constexpr std::size_t cache_line_size = 64;
+
 #define FOR_N_TIMES(n) for ( int _M_G_C_X_C8377 = 0; _M_G_C_X_C8377 < (n); ++_M_G_C_X_C8377 )
 
 struct NonCopyable {
@@ -144,6 +147,18 @@ public:
     void set(Derived *ptr) {
         real_ptr__ = ptr;
     }
+
+    /* take over a reference already counted in counter__ */
+    static DerivedRefPtr adopt(Derived *ptr) {
+        DerivedRefPtr res;
+        res.real_ptr__ = ptr;
+        return res;
+    }
+    /* only for an object not yet visible to other threads:
+     * count n references at once, without atomic RMW */
+    static void presetCount(Derived *ptr, unsigned int n) {
+        ptr->counter__.store(n, std::memory_order_relaxed);
+    }
     static void decrease(Derived *ptr) {
         if ( ptr && --ptr->counter__ == 0 ) {
             delete ptr;
@@ -163,7 +178,9 @@ template<class Derived, class... Args>
 DerivedRefPtr<Derived>
 makeRefPtr(Args&&... args)
 {
-    return std::move(DerivedRefPtr<Derived>(new Derived(std::forward<Args>(args)...)));
+    Derived *ptr = new Derived(std::forward<Args>(args)...);
+    DerivedRefPtr<Derived>::presetCount(ptr, 1);
+    return DerivedRefPtr<Derived>::adopt(ptr);
 }
 
 #endif /* _UTIL_HH_ */